@@ -0,0 +1,8 @@
+# Run by the resource_pack target with PACKER, ROOT and OUTPUT set. The inputs are globbed when the target runs rather
+# than at configure time, so new files and the .dds written by cook_textures are packed without configuring again.
+file(GLOB_RECURSE PACK_RESOURCES "${ROOT}/resources/*")
+file(GLOB PACK_SHADERS "${ROOT}/src/*/*.glsl")
+execute_process(COMMAND ${PACKER} ${OUTPUT} --base ${ROOT} ${PACK_RESOURCES} ${PACK_SHADERS} RESULT_VARIABLE PACK_RESULT)
+if(NOT PACK_RESULT EQUAL 0)
+    message(FATAL_ERROR "resource_packer failed")
+endif()
@@ -0,0 +1,353 @@
+#ifndef BLOCK_COMPRESSION_H
+#define BLOCK_COMPRESSION_H
+
+#include <helpers/dds.h>
+#include <helpers/thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// CPU encoders of the 4x4 block formats the texture cooker writes, and the mip chain it feeds them.
+// BC4 and BC5 pick the block's extremes as endpoints and the nearest of the 8 interpolated values per texel.
+// BC7 only uses mode 6: one subset, RGBA endpoints of 7 bits plus a shared bit each and 4 bit indices. The endpoints
+// start on the principal axis of the block's colors and are refit by least squares to the chosen indices.
+
+// interpolation weights of 4 bit BC7 indices, in 64ths
+const int BC7_WEIGHTS4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+// least squares refits of the BC7 endpoints after the first index assignment
+const int BC7_REFINE_PASSES = 2;
+
+// 16 texels of one channel into 8 bytes
+inline void encodeBc4Block(const unsigned char values[16], unsigned char *out)
+{
+    unsigned char low = 255, high = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        low = std::min(low, values[i]);
+        high = std::max(high, values[i]);
+    }
+    out[0] = high;
+    out[1] = low;
+    uint64_t indices = 0;
+    if (high > low)
+    {
+        // red0 > red1: index 0 and 1 are the endpoints, 2 to 7 step from red0 towards red1
+        int palette[8] = {high, low};
+        for (int i = 2; i < 8; ++i)
+            palette[i] = ((8 - i) * high + (i - 1) * low + 3) / 7;
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0, bestError = 256;
+            for (int j = 0; j < 8; ++j)
+            {
+                int error = std::abs(palette[j] - values[i]);
+                if (error < bestError)
+                {
+                    best = j;
+                    bestError = error;
+                }
+            }
+            indices |= (uint64_t)best << (3 * i);
+        }
+    }
+    for (int i = 0; i < 6; ++i)
+        out[2 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+namespace bc7_detail
+{
+struct Endpoints
+{
+    int q[2][4]; // 7 bit endpoint values
+    int p[2]; // shared lowest bit of each endpoint
+};
+
+// the 8 bit value of every channel of an endpoint
+inline int expand(const Endpoints &e, int endpoint, int channel)
+{
+    return e.q[endpoint][channel] << 1 | e.p[endpoint];
+}
+
+// 7 bits and a shared bit closest to an endpoint given in 0-255
+inline void quantize(const float value[4], Endpoints &e, int endpoint)
+{
+    float bestError = 1e30f;
+    for (int p = 0; p < 2; ++p)
+    {
+        int q[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            q[c] = std::min(std::max((int)std::floor((value[c] - p) * 0.5f + 0.5f), 0), 127);
+            float d = (float)(q[c] << 1 | p) - value[c];
+            error += d * d;
+        }
+        if (error < bestError)
+        {
+            bestError = error;
+            e.p[endpoint] = p;
+            for (int c = 0; c < 4; ++c)
+                e.q[endpoint][c] = q[c];
+        }
+    }
+}
+
+// nearest palette entry of every texel, returns the total squared error
+inline int assignIndices(const unsigned char *rgba, const Endpoints &e, int indices[16])
+{
+    int palette[16][4];
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 4; ++c)
+            palette[i][c] = ((64 - BC7_WEIGHTS4[i]) * expand(e, 0, c) + BC7_WEIGHTS4[i] * expand(e, 1, c) + 32) >> 6;
+    int total = 0;
+    for (int t = 0; t < 16; ++t)
+    {
+        const unsigned char *texel = rgba + 4 * t;
+        int best = 0, bestError = 1 << 30;
+        for (int i = 0; i < 16; ++i)
+        {
+            int error = 0;
+            for (int c = 0; c < 4; ++c)
+            {
+                int d = palette[i][c] - texel[c];
+                error += d * d;
+            }
+            if (error < bestError)
+            {
+                best = i;
+                bestError = error;
+            }
+        }
+        indices[t] = best;
+        total += bestError;
+    }
+    return total;
+}
+
+// endpoints minimising the squared error for fixed indices, false if the indices do not span a line
+inline bool refit(const unsigned char *rgba, const int indices[16], float endpoints[2][4])
+{
+    float a = 0.0f, b = 0.0f, c = 0.0f, x0[4] = {}, x1[4] = {};
+    for (int t = 0; t < 16; ++t)
+    {
+        float w = BC7_WEIGHTS4[indices[t]] / 64.0f;
+        a += (1.0f - w) * (1.0f - w);
+        b += (1.0f - w) * w;
+        c += w * w;
+        for (int ch = 0; ch < 4; ++ch)
+        {
+            x0[ch] += (1.0f - w) * rgba[4 * t + ch];
+            x1[ch] += w * rgba[4 * t + ch];
+        }
+    }
+    float det = a * c - b * b;
+    if (std::abs(det) < 1e-6f)
+        return false;
+    for (int ch = 0; ch < 4; ++ch)
+    {
+        endpoints[0][ch] = std::min(std::max((c * x0[ch] - b * x1[ch]) / det, 0.0f), 255.0f);
+        endpoints[1][ch] = std::min(std::max((a * x1[ch] - b * x0[ch]) / det, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+// appends the lowest count bits of value at bit position
+inline void putBits(unsigned char *out, int &position, int count, int value)
+{
+    for (int i = 0; i < count; ++i, ++position)
+        if (value >> i & 1)
+            out[position >> 3] |= (unsigned char)(1 << (position & 7));
+}
+}
+
+// 16 RGBA texels into 16 bytes of BC7 mode 6
+inline void encodeBc7Block(const unsigned char rgba[64], unsigned char *out)
+{
+    using namespace bc7_detail;
+    float mean[4] = {};
+    for (int t = 0; t < 16; ++t)
+        for (int c = 0; c < 4; ++c)
+            mean[c] += rgba[4 * t + c] / 16.0f;
+    float covariance[4][4] = {};
+    for (int t = 0; t < 16; ++t)
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                covariance[i][j] += (rgba[4 * t + i] - mean[i]) * (rgba[4 * t + j] - mean[j]);
+    // principal axis by power iteration
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[4] = {}, length = 0.0f;
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int j = 0; j < 4; ++j)
+                next[i] += covariance[i][j] * axis[j];
+            length = std::max(length, std::abs(next[i]));
+        }
+        if (length < 1e-6f)
+            break;
+        for (int i = 0; i < 4; ++i)
+            axis[i] = next[i] / length;
+    }
+    float low = 0.0f, high = 0.0f;
+    for (int t = 0; t < 16; ++t)
+    {
+        float projection = 0.0f;
+        for (int c = 0; c < 4; ++c)
+            projection += (rgba[4 * t + c] - mean[c]) * axis[c];
+        low = std::min(low, projection);
+        high = std::max(high, projection);
+    }
+    float lengthSquared = 0.0f;
+    for (int c = 0; c < 4; ++c)
+        lengthSquared += axis[c] * axis[c];
+    float endpoints[2][4];
+    for (int c = 0; c < 4; ++c)
+    {
+        endpoints[0][c] = std::min(std::max(mean[c] + low * axis[c] / lengthSquared, 0.0f), 255.0f);
+        endpoints[1][c] = std::min(std::max(mean[c] + high * axis[c] / lengthSquared, 0.0f), 255.0f);
+    }
+
+    Endpoints best;
+    int bestIndices[16];
+    quantize(endpoints[0], best, 0);
+    quantize(endpoints[1], best, 1);
+    int bestError = assignIndices(rgba, best, bestIndices);
+    for (int pass = 0; pass < BC7_REFINE_PASSES && bestError > 0; ++pass)
+    {
+        if (!refit(rgba, bestIndices, endpoints))
+            break;
+        Endpoints candidate;
+        int indices[16];
+        quantize(endpoints[0], candidate, 0);
+        quantize(endpoints[1], candidate, 1);
+        int error = assignIndices(rgba, candidate, indices);
+        if (error >= bestError)
+            break;
+        best = candidate;
+        bestError = error;
+        std::copy(indices, indices + 16, bestIndices);
+    }
+
+    // the first index is stored without its top bit, which has to be 0: swap the endpoints otherwise
+    if (bestIndices[0] >= 8)
+    {
+        std::swap(best.q[0], best.q[1]);
+        std::swap(best.p[0], best.p[1]);
+        for (int t = 0; t < 16; ++t)
+            bestIndices[t] = 15 - bestIndices[t];
+    }
+    std::fill(out, out + 16, 0);
+    int position = 0;
+    putBits(out, position, 7, 1 << 6); // mode 6
+    for (int c = 0; c < 4; ++c)
+    {
+        putBits(out, position, 7, best.q[0][c]);
+        putBits(out, position, 7, best.q[1][c]);
+    }
+    putBits(out, position, 1, best.p[0]);
+    putBits(out, position, 1, best.p[1]);
+    putBits(out, position, 3, bestIndices[0]);
+    for (int t = 1; t < 16; ++t)
+        putBits(out, position, 4, bestIndices[t]);
+}
+
+// compresses an RGBA8 image, block rows spread over the pool; BC4 reads red, BC5 red and green
+inline std::vector<unsigned char> compressImage(const unsigned char *rgba, int width, int height, uint32_t format, ThreadPool &pool)
+{
+    int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+    unsigned int blockBytes = DdsImage::blockBytes(format);
+    std::vector<unsigned char> blocks((size_t)blocksX * blocksY * blockBytes);
+    pool.parallelFor(0, blocksY, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int by = begin; by < end; ++by)
+            for (int bx = 0; bx < blocksX; ++bx)
+            {
+                // edge blocks repeat the last row and column
+                unsigned char texels[64];
+                for (int y = 0; y < 4; ++y)
+                    for (int x = 0; x < 4; ++x)
+                    {
+                        int sx = std::min(bx * 4 + x, width - 1), sy = std::min((int)by * 4 + y, height - 1);
+                        std::copy(rgba + 4 * ((size_t)sy * width + sx), rgba + 4 * ((size_t)sy * width + sx) + 4, texels + 4 * (4 * y + x));
+                    }
+                unsigned char *out = blocks.data() + ((size_t)by * blocksX + bx) * blockBytes;
+                if (format == DXGI_FORMAT_BC4_UNORM || format == DXGI_FORMAT_BC5_UNORM)
+                {
+                    unsigned char channel[16];
+                    for (int c = 0; c < (format == DXGI_FORMAT_BC5_UNORM ? 2 : 1); ++c)
+                    {
+                        for (int t = 0; t < 16; ++t)
+                            channel[t] = texels[4 * t + c];
+                        encodeBc4Block(channel, out + 8 * c);
+                    }
+                }
+                else
+                    encodeBc7Block(texels, out);
+            }
+    });
+    return blocks;
+}
+
+// how the texels of a mip chain are averaged
+enum MipFilter
+{
+    MIP_LINEAR, // data, averaged as stored
+    MIP_SRGB, // color, averaged as linear light and encoded again
+    MIP_NORMAL // tangent space normals in RG(B), averaged as vectors and renormalised
+};
+
+// the full mip chain of an RGBA8 image down to 1x1 with a 2x2 box filter, level 0 is a copy
+inline std::vector<std::vector<unsigned char>> buildMipChain(const unsigned char *rgba, int width, int height, MipFilter filter)
+{
+    float toLinear[256];
+    for (int i = 0; i < 256; ++i)
+    {
+        float value = i / 255.0f;
+        toLinear[i] = filter != MIP_SRGB ? value
+                      : value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+    }
+    std::vector<std::vector<unsigned char>> levels(1, std::vector<unsigned char>(rgba, rgba + 4 * (size_t)width * height));
+    int w = width, h = height;
+    while (w > 1 || h > 1)
+    {
+        int nw = std::max(w / 2, 1), nh = std::max(h / 2, 1);
+        const std::vector<unsigned char> &source = levels.back();
+        std::vector<unsigned char> level(4 * (size_t)nw * nh);
+        for (int y = 0; y < nh; ++y)
+            for (int x = 0; x < nw; ++x)
+            {
+                float sum[4] = {};
+                for (int j = 0; j < 2; ++j)
+                    for (int i = 0; i < 2; ++i)
+                    {
+                        const unsigned char *texel = &source[4 * ((size_t)std::min(2 * y + j, h - 1) * w + std::min(2 * x + i, w - 1))];
+                        for (int c = 0; c < 3; ++c)
+                            sum[c] += filter == MIP_NORMAL ? texel[c] / 127.5f - 1.0f : toLinear[texel[c]];
+                        sum[3] += texel[3] / 255.0f; // alpha is coverage, always linear
+                    }
+                unsigned char *out = &level[4 * ((size_t)y * nw + x)];
+                if (filter == MIP_NORMAL)
+                {
+                    float length = std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+                    for (int c = 0; c < 3; ++c)
+                        out[c] = (unsigned char)std::floor(((length > 0.0f ? sum[c] / length : c == 2 ? 1.0f : 0.0f) * 0.5f + 0.5f) * 255.0f + 0.5f);
+                }
+                else
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        float value = sum[c] * 0.25f;
+                        if (filter == MIP_SRGB)
+                            value = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+                        out[c] = (unsigned char)std::floor(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+                    }
+                out[3] = (unsigned char)std::floor(sum[3] * 0.25f * 255.0f + 0.5f);
+            }
+        levels.push_back(level);
+        w = nw;
+        h = nh;
+    }
+    return levels;
+}
+#endif
@@ -0,0 +1,174 @@
+#ifndef CASCADED_SHADOWS_H
+#define CASCADED_SHADOWS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <helpers/point_shadow.h>
+#include <helpers/shader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Cascaded shadow maps of a directional light, one layer of a depth array texture per cascade.
+// Splits blend logarithmic and uniform distribution of [nearPlane, shadowDistance] by splitLambda. Every cascade
+// is fitted around the bounding sphere of its frustum slice and snapped to whole texels in light space, so the
+// shadow map neither resizes nor swims while the camera turns or moves. All cascades are rendered in one pass
+// with cascade_depth_geom.glsl routing every triangle to each layer.
+class CascadedShadowMap
+{
+public:
+    static const unsigned int MAX_CASCADES = 4;
+
+    unsigned int size;
+    unsigned int cascadeCount;
+    float shadowDistance;
+    float splitLambda;
+    unsigned int texture;
+
+    // view space distance where every cascade ends, light space transforms and world size of one texel
+    float splits[MAX_CASCADES];
+    glm::mat4 lightSpaceMatrices[MAX_CASCADES];
+    float texelSizes[MAX_CASCADES];
+
+    CascadedShadowMap(unsigned int size = 2048, unsigned int cascadeCount = MAX_CASCADES, float shadowDistance = 60.0f,
+                      float splitLambda = 0.75f)
+            : size(size), cascadeCount(1), shadowDistance(shadowDistance), splitLambda(splitLambda)
+    {
+        setCascadeCount(cascadeCount);
+        for (unsigned int i = 0; i < MAX_CASCADES; ++i)
+        {
+            splits[i] = 0.0f;
+            lightSpaceMatrices[i] = glm::mat4(1.0f);
+            texelSizes[i] = 0.0f;
+        }
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, MAX_CASCADES, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::CASCADED_SHADOWS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    ~CascadedShadowMap()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteTextures(1, &texture);
+    }
+
+    CascadedShadowMap(const CascadedShadowMap &) = delete;
+    CascadedShadowMap &operator=(const CascadedShadowMap &) = delete;
+
+    // 2 to MAX_CASCADES cascades
+    void setCascadeCount(unsigned int count)
+    {
+        cascadeCount = std::min(std::max(count, 2u), MAX_CASCADES);
+    }
+
+    // fits the cascades to the camera; lightDir is the direction the light travels in
+    void update(const glm::mat4 &view, float fovY, float aspect, float nearPlane, const glm::vec3 &lightDir)
+    {
+        glm::mat4 inverseView = glm::inverse(view);
+        glm::vec3 up = std::abs(lightDir.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDir, up);
+        float tanY = std::tan(fovY * 0.5f), tanX = tanY * aspect;
+
+        float sliceNear = nearPlane;
+        for (unsigned int i = 0; i < cascadeCount; ++i)
+        {
+            // practical split scheme
+            float p = (i + 1) / (float)cascadeCount;
+            float logSplit = nearPlane * std::pow(shadowDistance / nearPlane, p);
+            float uniformSplit = nearPlane + (shadowDistance - nearPlane) * p;
+            float sliceFar = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+            splits[i] = sliceFar;
+
+            // bounding sphere of the slice, its radius does not depend on the camera orientation
+            glm::vec3 corners[8];
+            for (unsigned int c = 0; c < 8; ++c)
+            {
+                float z = (c & 4) ? sliceFar : sliceNear;
+                glm::vec3 viewCorner((c & 1 ? 1.0f : -1.0f) * tanX * z, (c & 2 ? 1.0f : -1.0f) * tanY * z, -z);
+                corners[c] = glm::vec3(inverseView * glm::vec4(viewCorner, 1.0f));
+            }
+            glm::vec3 center(0.0f);
+            for (const glm::vec3 &corner : corners)
+                center += corner / 8.0f;
+            float radius = 0.0f;
+            for (const glm::vec3 &corner : corners)
+                radius = std::max(radius, glm::length(corner - center));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            // move the center in whole texels only
+            float texelSize = 2.0f * radius / size;
+            glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+            lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+            lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+            // casters in front of the near plane are flattened onto it by depth clamping
+            glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, -radius, radius);
+            lightSpaceMatrices[i] = projection * glm::translate(glm::mat4(1.0f), -lightCenter) * lightView;
+            texelSizes[i] = texelSize;
+            sliceNear = sliceFar;
+        }
+    }
+
+    // renders all cascades in one pass with shadow_mapping_depth_vert.glsl, cascade_depth_geom.glsl and
+    // cascade_depth_frag.glsl
+    void render(const std::vector<ShadowCaster> &casters, Shader &shader)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_CLAMP);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+        shader.use();
+        shader.setInt("cascadeCount", cascadeCount);
+        for (unsigned int i = 0; i < cascadeCount; ++i)
+            shader.setMat4("cascadeMatrices[" + std::to_string(i) + "]", lightSpaceMatrices[i]);
+        for (const ShadowCaster &caster : casters)
+        {
+            shader.setMat4("model", caster.model);
+            caster.draw(1);
+        }
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // binds the array texture and sets cascadeMap, cascadeCount, cascadeSplits, cascadeMatrices and cascadeTexelSizes
+    void setUniforms(Shader &shader, unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        shader.setInt("cascadeMap", unit);
+        shader.setInt("cascadeCount", cascadeCount);
+        for (unsigned int i = 0; i < cascadeCount; ++i)
+        {
+            shader.setFloat("cascadeSplits[" + std::to_string(i) + "]", splits[i]);
+            shader.setMat4("cascadeMatrices[" + std::to_string(i) + "]", lightSpaceMatrices[i]);
+            shader.setFloat("cascadeTexelSizes[" + std::to_string(i) + "]", texelSizes[i]);
+        }
+    }
+
+private:
+    unsigned int FBO;
+};
+#endif
@@ -0,0 +1,59 @@
+#ifndef CHANNEL_PACKING_H
+#define CHANNEL_PACKING_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CHANNEL_PACKING_SSE2
+#endif
+
+// Several single channel maps of a material packed into the channels of one texture, like the occlusion, roughness
+// and metallic maps of pbr in R, G and B (ORM), so a fragment reads them with one fetch.
+
+// interleaves three 8 bit planes into RGBA with alpha 255, 16 texels at a time with SSE2
+inline void interleaveChannels(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgba, size_t count)
+{
+    size_t i = 0;
+#ifdef CHANNEL_PACKING_SSE2
+    const __m128i opaque = _mm_set1_epi8((char)0xFF);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m128i red = _mm_loadu_si128((const __m128i *)(r + i));
+        __m128i green = _mm_loadu_si128((const __m128i *)(g + i));
+        __m128i blue = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i rgLow = _mm_unpacklo_epi8(red, green), rgHigh = _mm_unpackhi_epi8(red, green);
+        __m128i baLow = _mm_unpacklo_epi8(blue, opaque), baHigh = _mm_unpackhi_epi8(blue, opaque);
+        __m128i *out = (__m128i *)(rgba + 4 * i);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(rgLow, baLow));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLow, baLow));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHigh, baHigh));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHigh, baHigh));
+    }
+#endif
+    for (; i < count; ++i)
+    {
+        rgba[4 * i + 0] = r[i];
+        rgba[4 * i + 1] = g[i];
+        rgba[4 * i + 2] = b[i];
+        rgba[4 * i + 3] = 255;
+    }
+}
+
+// the cooked asset of packed maps: their names joined in the folder of the first, e.g. ground/ao_roughness_metallic.dds
+inline std::string packedTexturePath(const std::vector<std::string> &channels)
+{
+    if (channels.empty())
+        return std::string();
+    size_t slash = channels[0].find_last_of("/\\");
+    std::string path = slash == std::string::npos ? std::string() : channels[0].substr(0, slash + 1);
+    for (size_t i = 0; i < channels.size(); ++i)
+    {
+        std::string name = channels[i].substr(channels[i].find_last_of("/\\") + 1);
+        path += (i ? "_" : "") + name.substr(0, name.find_last_of('.'));
+    }
+    return path + ".dds";
+}
+#endif
@@ -0,0 +1,184 @@
+#ifndef CONE_STEP_H
+#define CONE_STEP_H
+
+#include <helpers/resource_pack.h>
+#include <helpers/thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CONE_STEP_SSE2
+#endif
+
+// Relaxed cone step map of a depth map (0 is the top of the relief, 1 the deepest point, as parallax_mapping_frag.glsl
+// reads it). Every texel stores its depth and the square root of its cone ratio, the horizontal distance in texture
+// coordinates per unit of depth. A relaxed cone is the widest cone above the texel such that a ray through its apex
+// enters the relief at most once before reaching the apex, so a ray may step right up to the cone boundary: it can
+// end below the surface, but never beyond the first intersection, which a short binary search then refines.
+struct ConeStepMap
+{
+    int width;
+    int height;
+    unsigned long long source; // fnv1a of the depth map file it was baked from, a cache of another one is stale
+    std::vector<unsigned char> texels; // depth, sqrt(cone ratio) pairs, row by row
+
+    ConeStepMap() : width(0), height(0), source(0)
+    {
+    }
+};
+
+// layout of the .cone file, bumped when it or the bake changes
+const int CONE_STEP_FILE_VERSION = 2;
+// cone ratios are clamped to this before sqrt encoding to 8 bits
+const float CONE_STEP_MAX_RATIO = 1.0f;
+// directions every cone is traced in, a multiple of 4
+const int CONE_STEP_DIRECTIONS = 32;
+// a ray has to rise this far above the surface to count as leaving it, 8 bit depth turns slopes into terraces
+const float CONE_STEP_TOLERANCE = 1.5f / 255.0f;
+
+// widest relaxed cone ratio at texel (x, y) of depth, traced along CONE_STEP_DIRECTIONS rays.
+// Walking away from the apex, k(r) = r / (apexDepth - depth(r)) is the flattest ray slope that is below the surface r
+// away from the apex (infinite where the surface is below the apex). A ray of ratio c reaching the apex exits the
+// relief on its way there if some farther point has k <= c while a nearer one has k > c, so the cone along one
+// direction is the smallest k that is below the largest k seen closer to the apex. Nearer points count as exits only
+// when the ray clears them by CONE_STEP_TOLERANCE, otherwise every quantised slope would narrow the cone to itself.
+inline float relaxedConeRatio(const std::vector<float> &depth, int width, int height, int x, int y)
+{
+    float apexDepth = depth[y * width + x];
+    float best = CONE_STEP_MAX_RATIO;
+    if (apexDepth <= 0.0f)
+        return best;
+    const float infinity = std::numeric_limits<float>::infinity();
+    for (int group = 0; group < CONE_STEP_DIRECTIONS; group += 4)
+    {
+        float dirX[4], dirY[4], scale[4];
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            float angle = 2.0f * 3.14159265f * (group + lane) / CONE_STEP_DIRECTIONS;
+            dirX[lane] = std::cos(angle);
+            dirY[lane] = std::sin(angle);
+            // texture space distance of one texel step along the direction
+            scale[lane] = std::sqrt(dirX[lane] * dirX[lane] / (width * width) + dirY[lane] * dirY[lane] / (height * height));
+        }
+        float minScale = std::min(std::min(scale[0], scale[1]), std::min(scale[2], scale[3]));
+#ifdef CONE_STEP_SSE2
+        __m128 apex = _mm_set1_ps(apexDepth);
+        __m128 steps = _mm_loadu_ps(scale);
+        __m128 inf = _mm_set1_ps(infinity);
+        __m128 zero = _mm_setzero_ps();
+        __m128 tolerance = _mm_set1_ps(CONE_STEP_TOLERANCE);
+        __m128 nearMax = zero, cone = _mm_set1_ps(best);
+#else
+        float nearMax[4] = {0.0f, 0.0f, 0.0f, 0.0f}, cone[4] = {best, best, best, best};
+#endif
+        // k(r) >= r / apexDepth, nothing farther can narrow the cone below best
+        for (int r = 1; r * minScale < best * apexDepth; ++r)
+        {
+            float sampled[4];
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                int sx = std::min(std::max((int)std::floor(x + 0.5f + dirX[lane] * r), 0), width - 1);
+                int sy = std::min(std::max((int)std::floor(y + 0.5f + dirY[lane] * r), 0), height - 1);
+                sampled[lane] = depth[sy * width + sx];
+            }
+#ifdef CONE_STEP_SSE2
+            __m128 h = _mm_sub_ps(apex, _mm_loadu_ps(sampled));
+            __m128 above = _mm_cmpgt_ps(h, zero);
+            __m128 distance = _mm_mul_ps(_mm_set1_ps((float)r), steps);
+            __m128 k = _mm_or_ps(_mm_and_ps(above, _mm_div_ps(distance, _mm_max_ps(h, _mm_set1_ps(1e-6f)))), _mm_andnot_ps(above, inf));
+            __m128 exits = _mm_cmplt_ps(k, nearMax);
+            cone = _mm_min_ps(cone, _mm_or_ps(_mm_and_ps(exits, k), _mm_andnot_ps(exits, inf)));
+            __m128 cleared = _mm_add_ps(h, tolerance);
+            __m128 clearedAbove = _mm_cmpgt_ps(cleared, zero);
+            __m128 clearance = _mm_div_ps(distance, _mm_max_ps(cleared, _mm_set1_ps(1e-6f)));
+            nearMax = _mm_max_ps(nearMax, _mm_or_ps(_mm_and_ps(clearedAbove, clearance), _mm_andnot_ps(clearedAbove, inf)));
+#else
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                float h = apexDepth - sampled[lane];
+                float k = h > 0.0f ? r * scale[lane] / h : infinity;
+                if (k < nearMax[lane])
+                    cone[lane] = std::min(cone[lane], k);
+                float cleared = h + CONE_STEP_TOLERANCE;
+                nearMax[lane] = std::max(nearMax[lane], cleared > 0.0f ? r * scale[lane] / cleared : infinity);
+            }
+#endif
+        }
+#ifdef CONE_STEP_SSE2
+        float cones[4];
+        _mm_storeu_ps(cones, cone);
+        best = std::min(std::min(best, std::min(cones[0], cones[1])), std::min(cones[2], cones[3]));
+#else
+        best = std::min(std::min(best, std::min(cone[0], cone[1])), std::min(cone[2], cone[3]));
+#endif
+    }
+    return best;
+}
+
+// bakes the cone step map of an 8 bit image whose first channel is the depth, rows are spread over the pool
+inline ConeStepMap bakeConeStepMap(const unsigned char *image, int width, int height, int channels, ThreadPool &pool)
+{
+    std::vector<float> depth(width * height);
+    for (int i = 0; i < width * height; ++i)
+        depth[i] = image[i * channels] / 255.0f;
+
+    ConeStepMap map;
+    map.width = width;
+    map.height = height;
+    map.texels.resize(width * height * 2);
+    pool.parallelFor(0, height, [&](unsigned int begin, unsigned int end) {
+        for (int y = (int)begin; y < (int)end; ++y)
+            for (int x = 0; x < width; ++x)
+            {
+                float ratio = relaxedConeRatio(depth, width, height, x, y);
+                unsigned char *texel = &map.texels[(y * width + x) * 2];
+                texel[0] = image[(y * width + x) * channels];
+                // rounded down, a narrower cone stays valid
+                texel[1] = (unsigned char)std::floor(std::sqrt(std::min(ratio, CONE_STEP_MAX_RATIO) / CONE_STEP_MAX_RATIO) * 255.0f);
+            }
+    });
+    return map;
+}
+
+// the file is "CONE", version, width, height, the source hash and the texels, native byte order
+inline bool saveConeStepMap(const std::string &path, const ConeStepMap &map)
+{
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    int header[3] = {CONE_STEP_FILE_VERSION, map.width, map.height};
+    bool written = std::fwrite("CONE", 1, 4, file) == 4 && std::fwrite(header, sizeof(int), 3, file) == 3
+                   && std::fwrite(&map.source, sizeof(map.source), 1, file) == 1
+                   && std::fwrite(map.texels.data(), 1, map.texels.size(), file) == map.texels.size();
+    std::fclose(file);
+    return written;
+}
+
+inline bool loadConeStepMap(const std::string &path, ConeStepMap &map)
+{
+    Resource resource;
+    if (!readResource(path, resource))
+        return false;
+    ResourceReader file(resource);
+    char magic[4];
+    int header[3];
+    bool read = file.read(magic, 4) && std::memcmp(magic, "CONE", 4) == 0 && file.read(header, sizeof(header))
+                && header[0] == CONE_STEP_FILE_VERSION && header[1] > 0 && header[2] > 0
+                && file.read(&map.source, sizeof(map.source));
+    if (read)
+    {
+        map.width = header[1];
+        map.height = header[2];
+        map.texels.resize((size_t)map.width * map.height * 2);
+        read = file.read(map.texels.data(), map.texels.size());
+    }
+    return read;
+}
+#endif
@@ -0,0 +1,91 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+
+// Axis-aligned bounding box
+struct BoundingBox
+{
+    glm::vec3 min;
+    glm::vec3 max;
+
+    BoundingBox(glm::vec3 min = glm::vec3(0.0f), glm::vec3 max = glm::vec3(0.0f)) : min(min), max(max)
+    {
+    }
+
+    glm::vec3 center() const
+    {
+        return (min + max) * 0.5f;
+    }
+
+    glm::vec3 extents() const
+    {
+        return (max - min) * 0.5f;
+    }
+
+    // box enclosing this box after an affine transform
+    BoundingBox transformed(const glm::mat4 &model) const
+    {
+        glm::vec3 c = glm::vec3(model * glm::vec4(center(), 1.0f));
+        glm::vec3 e = extents();
+        glm::mat3 absolute(glm::abs(glm::vec3(model[0])), glm::abs(glm::vec3(model[1])), glm::abs(glm::vec3(model[2])));
+        glm::vec3 r = absolute * e;
+        return BoundingBox(c - r, c + r);
+    }
+
+    // squared distance from a point to the box, 0 inside
+    float distanceSquared(const glm::vec3 &point) const
+    {
+        glm::vec3 delta = glm::clamp(point, min, max) - point;
+        return glm::dot(delta, delta);
+    }
+
+    bool intersectsSphere(const glm::vec3 &center, float radius) const
+    {
+        return distanceSquared(center) <= radius * radius;
+    }
+};
+
+// Six clip planes extracted from a projection * view matrix (Gribb & Hartmann), normals point inwards
+class Frustum
+{
+public:
+    glm::vec4 planes[6];
+
+    explicit Frustum(const glm::mat4 &viewProjection)
+    {
+        glm::mat4 m = glm::transpose(viewProjection);
+        planes[0] = m[3] + m[0]; // left
+        planes[1] = m[3] - m[0]; // right
+        planes[2] = m[3] + m[1]; // bottom
+        planes[3] = m[3] - m[1]; // top
+        planes[4] = m[3] + m[2]; // near
+        planes[5] = m[3] - m[2]; // far
+        for (glm::vec4 &plane : planes)
+            plane /= glm::length(glm::vec3(plane));
+    }
+
+    bool intersectsSphere(const glm::vec3 &center, float radius) const
+    {
+        for (const glm::vec4 &plane : planes)
+            if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+                return false;
+        return true;
+    }
+
+    bool intersectsBox(const BoundingBox &box) const
+    {
+        glm::vec3 c = box.center(), e = box.extents();
+        for (const glm::vec4 &plane : planes)
+        {
+            glm::vec3 n = glm::vec3(plane);
+            float r = glm::dot(glm::abs(n), e);
+            if (glm::dot(n, c) + plane.w < -r)
+                return false;
+        }
+        return true;
+    }
+};
+#endif
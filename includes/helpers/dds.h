@@ -0,0 +1,169 @@
+#ifndef DDS_H
+#define DDS_H
+
+#include <helpers/resource_pack.h>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// block compressed formats the texture cooker writes, by their DXGI numbers
+const uint32_t DXGI_FORMAT_BC4_UNORM = 80;
+const uint32_t DXGI_FORMAT_BC5_UNORM = 83;
+const uint32_t DXGI_FORMAT_BC7_UNORM = 98;
+const uint32_t DXGI_FORMAT_BC7_UNORM_SRGB = 99;
+
+// A mipmapped 2D texture of 4x4 blocks, as stored in a .dds file with the DX10 header extension
+struct DdsImage
+{
+    uint32_t format; // one of the DXGI formats above, 0 when empty
+    int width, height;
+    std::vector<std::vector<unsigned char>> levels; // largest first, down to 1x1
+
+    DdsImage() : format(0), width(0), height(0)
+    {
+    }
+
+    static unsigned int blockBytes(uint32_t format)
+    {
+        return format == DXGI_FORMAT_BC4_UNORM ? 8 : 16;
+    }
+
+    static int levelSize(int size, unsigned int level)
+    {
+        return std::max(size >> level, 1);
+    }
+
+    static size_t levelBytes(uint32_t format, int width, int height)
+    {
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+    }
+};
+
+// the cooked asset of a source image: the same name with the extension .dds
+inline std::string cookedTexturePath(const std::string &source)
+{
+    size_t dot = source.find_last_of('.');
+    size_t slash = source.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return source + ".dds";
+    return source.substr(0, dot) + ".dds";
+}
+
+// a cooked asset older than its source is stale and ignored
+inline bool cookedTextureCurrent(const std::string &source, const std::string &cooked)
+{
+    struct stat sourceStat, cookedStat;
+    if (stat(cooked.c_str(), &cookedStat) != 0)
+        return false;
+    return stat(source.c_str(), &sourceStat) != 0 || cookedStat.st_mtime >= sourceStat.st_mtime;
+}
+
+namespace dds_detail
+{
+// DDS_HEADER after the magic, then DDS_HEADER_DXT10; every field is a little endian uint32
+const unsigned int HEADER_WORDS = 31;
+const unsigned int DX10_WORDS = 5;
+const uint32_t FLAGS = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000; // caps, height, width, pixel format, mip count, linear size
+const uint32_t PIXEL_FORMAT_FOURCC = 0x4;
+const uint32_t CAPS = 0x1000 | 0x400000 | 0x8; // texture, mipmap, complex
+const uint32_t DIMENSION_TEXTURE2D = 3;
+
+inline uint32_t fourCC(const char *code)
+{
+    return (uint32_t)(unsigned char)code[0] | (uint32_t)(unsigned char)code[1] << 8 |
+           (uint32_t)(unsigned char)code[2] << 16 | (uint32_t)(unsigned char)code[3] << 24;
+}
+
+inline void put(unsigned char *bytes, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i)
+        bytes[i] = (unsigned char)(value >> (8 * i));
+}
+
+inline uint32_t get(const unsigned char *bytes)
+{
+    return (uint32_t)bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+}
+
+inline bool saveDds(const std::string &path, const DdsImage &image)
+{
+    using namespace dds_detail;
+    unsigned char header[4 * (1 + HEADER_WORDS + DX10_WORDS)] = {};
+    std::memcpy(header, "DDS ", 4);
+    unsigned char *h = header + 4;
+    put(h + 0, 124); // header size
+    put(h + 4, FLAGS);
+    put(h + 8, image.height);
+    put(h + 12, image.width);
+    put(h + 16, (uint32_t)(image.levels.empty() ? 0 : image.levels[0].size()));
+    put(h + 24, (uint32_t)image.levels.size());
+    put(h + 72, 32); // pixel format size
+    put(h + 76, PIXEL_FORMAT_FOURCC);
+    put(h + 80, fourCC("DX10"));
+    put(h + 104, CAPS);
+    unsigned char *dx10 = h + 4 * HEADER_WORDS;
+    put(dx10 + 0, image.format);
+    put(dx10 + 4, DIMENSION_TEXTURE2D);
+    put(dx10 + 12, 1); // array size
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    for (const std::vector<unsigned char> &level : image.levels)
+        written = written && std::fwrite(level.data(), 1, level.size(), file) == level.size();
+    std::fclose(file);
+    return written;
+}
+
+// reads the files saveDds writes: BC4, BC5 or BC7 2D textures with the DX10 header; levels finer than firstLevel are
+// skipped and left empty, in a pack their pages are never touched
+inline bool loadDds(const std::string &path, DdsImage &image, unsigned int firstLevel = 0)
+{
+    using namespace dds_detail;
+    Resource resource;
+    if (!readResource(path, resource))
+        return false;
+    ResourceReader file(resource);
+    unsigned char header[4 * (1 + HEADER_WORDS + DX10_WORDS)];
+    const unsigned char *h = header + 4, *dx10 = header + 4 + 4 * HEADER_WORDS;
+    bool read = file.read(header, sizeof(header)) && std::memcmp(header, "DDS ", 4) == 0
+                && get(h + 0) == 124 && (get(h + 76) & PIXEL_FORMAT_FOURCC) && get(h + 80) == fourCC("DX10")
+                && get(dx10 + 4) == DIMENSION_TEXTURE2D && get(dx10 + 12) == 1;
+    if (read)
+    {
+        image.format = get(dx10);
+        image.height = (int)get(h + 8);
+        image.width = (int)get(h + 12);
+        unsigned int levels = std::max(get(h + 24), 1u);
+        read = (image.format == DXGI_FORMAT_BC4_UNORM || image.format == DXGI_FORMAT_BC5_UNORM ||
+                image.format == DXGI_FORMAT_BC7_UNORM || image.format == DXGI_FORMAT_BC7_UNORM_SRGB)
+               && image.width > 0 && image.height > 0 && levels <= 32;
+        image.levels.resize(read ? levels : 0);
+        for (unsigned int level = 0; read && level < levels; ++level)
+        {
+            size_t size = DdsImage::levelBytes(image.format, DdsImage::levelSize(image.width, level),
+                                               DdsImage::levelSize(image.height, level));
+            if (level < firstLevel)
+            {
+                read = file.skip(size);
+                continue;
+            }
+            std::vector<unsigned char> &bytes = image.levels[level];
+            bytes.resize(size);
+            read = file.read(bytes.data(), bytes.size());
+        }
+    }
+    if (!read)
+        image = DdsImage();
+    return read;
+}
+#endif
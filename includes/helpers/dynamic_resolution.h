@@ -0,0 +1,78 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <helpers/gpu_timer.h>
+
+#include <algorithm>
+#include <cmath>
+
+// scale changes in steps of this to keep render targets stable
+const float DYNAMIC_RESOLUTION_STEP = 0.05f;
+// frames below this fraction of the budget grow the scale
+const float DYNAMIC_RESOLUTION_HEADROOM = 0.8f;
+
+// Chooses the fraction of the window's width and height the scene is rendered at so the GPU frame time stays within
+// a budget. Pixel work grows with the square of the scale, so an over or under budget frame moves the scale towards
+// scale * sqrt(target / time), a whole number of steps. Frames between DYNAMIC_RESOLUTION_HEADROOM and 1 times the
+// budget leave the scale alone, and after every change the timer's in-flight measurements, which still show the old
+// scale, are ignored.
+class DynamicResolution
+{
+public:
+    float budgetMs;
+    float minScale, maxScale;
+    float scale; // current fraction of the window size per axis
+    // measured frames since resetStats() and how many of them met the budget
+    unsigned int frames, framesWithinBudget;
+
+    explicit DynamicResolution(float budgetMs = 1000.0f / 60.0f, float minScale = 0.5f, float maxScale = 1.0f)
+        : budgetMs(budgetMs), minScale(minScale), maxScale(maxScale), scale(maxScale), frames(0), framesWithinBudget(0),
+          seen(0), holdFrames(0)
+    {
+    }
+
+    // feeds the newest measurement of timer, if there is one; returns whether the scale changed
+    bool update(const GpuTimer &timer)
+    {
+        if (timer.finished == seen)
+            return false;
+        seen = timer.finished;
+        frames++;
+        if (timer.lastMs <= budgetMs)
+            framesWithinBudget++;
+        if (holdFrames > 0)
+        {
+            holdFrames--;
+            return false;
+        }
+        if (timer.lastMs <= 0.0 || (timer.lastMs <= budgetMs && timer.lastMs >= DYNAMIC_RESOLUTION_HEADROOM * budgetMs))
+            return false;
+
+        // aim for the middle of the band
+        float target = scale * (float)std::sqrt(0.5 * (1.0 + DYNAMIC_RESOLUTION_HEADROOM) * budgetMs / timer.lastMs);
+        target = std::round(target / DYNAMIC_RESOLUTION_STEP) * DYNAMIC_RESOLUTION_STEP;
+        float next = timer.lastMs > budgetMs ? std::min(target, scale - DYNAMIC_RESOLUTION_STEP) : std::max(target, scale + DYNAMIC_RESOLUTION_STEP);
+        next = std::min(std::max(next, minScale), maxScale);
+        if (std::abs(next - scale) < 0.5f * DYNAMIC_RESOLUTION_STEP)
+            return false;
+        scale = next;
+        holdFrames = GpuTimer::RING;
+        return true;
+    }
+
+    // fraction of the measured frames that met the budget
+    float adherence() const
+    {
+        return frames > 0 ? (float)framesWithinBudget / frames : 1.0f;
+    }
+
+    void resetStats()
+    {
+        frames = framesWithinBudget = 0;
+    }
+
+private:
+    unsigned int seen;
+    unsigned int holdFrames;
+};
+#endif
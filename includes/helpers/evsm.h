@@ -0,0 +1,152 @@
+#ifndef EVSM_H
+#define EVSM_H
+
+#include <glad/glad.h>
+
+#include <helpers/shader.h>
+
+#include <iostream>
+
+// Exponential variance shadow map built from a point light's depth cubemap.
+// Every face is converted to the moments (e^(c1 d), e^(2 c1 d), -e^(-c2 d), e^(-2 c2 d)) of the warped depth,
+// blurred with a separable box filter of 2 * blurRadius + 1 texels in two fragment passes and mipmapped, so one
+// trilinear lookup gives a filtered shadow whose softness is chosen by the mip level. Only the faces the caller
+// reports as changed are converted and blurred again; the blur stays inside a face so faces are independent.
+// Moments are RGBA32F: size^2 * 6 * 16 bytes plus a third for mips, and the same again without mips for the
+// intermediate blur target.
+class EvsmCubemap
+{
+public:
+    unsigned int size;
+    int blurRadius;
+    unsigned int moments; // mipmapped RGBA32F cubemap to sample
+
+    // statistics of the last update
+    unsigned int filteredFaces;
+    unsigned int skippedFaces;
+
+    EvsmCubemap(unsigned int size = 512, int blurRadius = 2)
+            : size(size), blurRadius(blurRadius), filteredFaces(0), skippedFaces(0), source(0)
+    {
+        moments = createCubemap(true);
+        blurTarget = createCubemap(false);
+        glGenFramebuffers(1, &FBO);
+        glGenVertexArrays(1, &quadVAO);
+
+        // depth is read as plain values, whatever comparison mode the shadow cubemap uses
+        glGenSamplers(1, &depthSampler);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+    }
+
+    ~EvsmCubemap()
+    {
+        glDeleteSamplers(1, &depthSampler);
+        glDeleteVertexArrays(1, &quadVAO);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteTextures(1, &blurTarget);
+        glDeleteTextures(1, &moments);
+    }
+
+    EvsmCubemap(const EvsmCubemap &) = delete;
+    EvsmCubemap &operator=(const EvsmCubemap &) = delete;
+
+    // video memory of both moment cubemaps
+    unsigned long long memoryBytes() const
+    {
+        unsigned long long face = (unsigned long long)size * size * 6 * 16;
+        return face * 4 / 3 + face;
+    }
+
+    // refilters the changed faces of depthCubemap (bit i for GL_TEXTURE_CUBE_MAP_POSITIVE_X + i) with
+    // evsm_quad_vert.glsl and evsm_blur_frag.glsl
+    void update(unsigned int depthCubemap, unsigned int changedFaces, Shader &blurShader)
+    {
+        // a different source texture invalidates everything
+        if (depthCubemap != source)
+            changedFaces = 0x3F;
+        source = depthCubemap;
+        filteredFaces = skippedFaces = 0;
+        if (changedFaces == 0)
+        {
+            skippedFaces = 6;
+            return;
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, size, size);
+        glDisable(GL_DEPTH_TEST);
+        glBindVertexArray(quadVAO);
+        blurShader.use();
+        blurShader.setInt("source", 0);
+        blurShader.setInt("blurRadius", blurRadius);
+        glActiveTexture(GL_TEXTURE0);
+        for (unsigned int face = 0; face < 6; ++face)
+        {
+            if (!(changedFaces & (1u << face)))
+            {
+                skippedFaces++;
+                continue;
+            }
+            filteredFaces++;
+            blurShader.setInt("face", face);
+
+            // 1. depth to moments, blurred horizontally
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, blurTarget, 0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
+            glBindSampler(0, depthSampler);
+            blurShader.setBool("fromDepth", true);
+            blurShader.setVec2("blurDirection", 1.0f, 0.0f);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glBindSampler(0, 0);
+
+            // 2. moments blurred vertically
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, moments, 0);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, blurTarget);
+            blurShader.setBool("fromDepth", false);
+            blurShader.setVec2("blurDirection", 0.0f, 1.0f);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glBindVertexArray(0);
+        glEnable(GL_DEPTH_TEST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, moments);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    }
+
+    // refilters every face on the next update
+    void invalidate()
+    {
+        source = 0;
+    }
+
+private:
+    unsigned int blurTarget;
+    unsigned int FBO;
+    unsigned int quadVAO;
+    unsigned int depthSampler;
+    unsigned int source;
+
+    unsigned int createCubemap(bool mipmapped) const
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        for (unsigned int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA32F, size, size, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, mipmapped ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        if (mipmapped)
+            glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+        return texture;
+    }
+};
+#endif
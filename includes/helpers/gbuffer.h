@@ -0,0 +1,136 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <iostream>
+
+// Framebuffer for deferred shading:
+//   0 - albedoSpec: SRGB8_ALPHA8, linear diffuse color (sRGB encoded while GL_FRAMEBUFFER_SRGB is on) and specular
+//                   intensity
+//   1 - normal:     RGBA16F, world-space normal
+//   2 - lighting:   RGBA16F, light accumulation; the geometry pass writes emission into it, light volumes add to it
+//   depth/stencil:  DEPTH24_STENCIL8, world positions are reconstructed from it
+// Like HdrTarget it is allocated at the window's size and the scene may cover only the lower left renderWidth x
+// renderHeight pixels (see setRenderSize), so dynamic resolution never reallocates it.
+class GBuffer
+{
+public:
+    unsigned int FBO;
+    unsigned int albedoSpec, normal, lighting, depth;
+    int width, height; // allocated
+    int renderWidth, renderHeight; // covered by the scene
+
+    GBuffer()
+        : FBO(0), albedoSpec(0), normal(0), lighting(0), depth(0), width(0), height(0), renderWidth(0), renderHeight(0)
+    {
+    }
+
+    ~GBuffer()
+    {
+        release();
+    }
+
+    GBuffer(const GBuffer &) = delete;
+    GBuffer &operator=(const GBuffer &) = delete;
+
+    // (re)allocate the attachments, does nothing if the size did not change
+    void resize(int w, int h)
+    {
+        if (w == width && h == height)
+            return;
+        release();
+        width = w;
+        height = h;
+        setRenderSize(w, h);
+        if (width <= 0 || height <= 0) // minimised window
+            return;
+
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        albedoSpec = attach(GL_COLOR_ATTACHMENT0, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        normal = attach(GL_COLOR_ATTACHMENT1, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+        lighting = attach(GL_COLOR_ATTACHMENT2, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+        depth = attach(GL_DEPTH_STENCIL_ATTACHMENT, GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+        unsigned int attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+        glDrawBuffers(3, attachments);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::GBUFFER::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // size of the rectangle the scene is rendered into from the next bindGeometryPass() on, at most the allocated size
+    void setRenderSize(int w, int h)
+    {
+        renderWidth = std::min(w, width);
+        renderHeight = std::min(h, height);
+    }
+
+    // bind for the geometry pass, all three targets are written inside the render rectangle
+    void bindGeometryPass() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        unsigned int attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2};
+        glDrawBuffers(3, attachments);
+        glViewport(0, 0, renderWidth, renderHeight);
+    }
+
+    // bind for the light pass, only the accumulation target is written while depth stays attached for testing
+    void bindLightPass() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glDrawBuffer(GL_COLOR_ATTACHMENT2);
+    }
+
+    // albedoSpec, normal and depth on firstUnit .. firstUnit + 2
+    void bindTextures(unsigned int firstUnit) const
+    {
+        const unsigned int textures[3] = {albedoSpec, normal, depth};
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]);
+        }
+    }
+
+    // copy the accumulated lighting and the depth buffer of the render rectangle into framebuffer target, which is left
+    // bound
+    void resolve(unsigned int target, int dstWidth, int dstHeight) const
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+        glReadBuffer(GL_COLOR_ATTACHMENT2);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+        glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, dstWidth, dstHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        if (dstWidth == renderWidth && dstHeight == renderHeight)
+            glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+    }
+
+private:
+    unsigned int attach(GLenum attachment, GLint internalFormat, GLenum format, GLenum type) const
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, texture, 0);
+        return texture;
+    }
+
+    void release()
+    {
+        if (FBO == 0)
+            return;
+        unsigned int textures[4] = {albedoSpec, normal, lighting, depth};
+        glDeleteTextures(4, textures);
+        glDeleteFramebuffers(1, &FBO);
+        FBO = 0;
+        width = height = renderWidth = renderHeight = 0;
+    }
+};
+#endif
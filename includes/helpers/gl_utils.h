@@ -0,0 +1,18 @@
+#ifndef GL_UTILS_H
+#define GL_UTILS_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// whether the current context lists the extension, for the features core 3.3 lacks
+inline bool hasGlExtension(const char *name)
+{
+    GLint extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+    for (GLint i = 0; i < extensions; ++i)
+        if (std::strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    return false;
+}
+#endif
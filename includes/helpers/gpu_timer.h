@@ -0,0 +1,162 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+// Measures GPU time between begin() and end() with GL_TIME_ELAPSED queries. Queries are kept in a small ring
+// and only read back once the driver reports them available, so timing never stalls the pipeline; results
+// therefore lag a few frames behind.
+class GpuTimer
+{
+public:
+    static const unsigned int RING = 4;
+
+    // most recent finished measurement in milliseconds
+    double lastMs;
+    // measurements read back so far, tells when lastMs is new
+    unsigned int finished;
+
+    GpuTimer() : lastMs(0.0), finished(0), sumMs(0.0), samples(0), head(0), pending(0), active(false)
+    {
+        glGenQueries(RING, queries);
+    }
+
+    ~GpuTimer()
+    {
+        glDeleteQueries(RING, queries);
+    }
+
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer &operator=(const GpuTimer &) = delete;
+
+    void begin()
+    {
+        collect();
+        // all queries still in flight, skip this measurement instead of waiting
+        if (pending == RING)
+            return;
+        glBeginQuery(GL_TIME_ELAPSED, queries[head]);
+        active = true;
+    }
+
+    void end()
+    {
+        if (!active)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        head = (head + 1) % RING;
+        pending++;
+        active = false;
+    }
+
+    // average of the measurements collected since the last reset
+    double averageMs() const
+    {
+        return samples > 0 ? sumMs / samples : 0.0;
+    }
+
+    unsigned int sampleCount() const
+    {
+        return samples;
+    }
+
+    void reset()
+    {
+        sumMs = 0.0;
+        samples = 0;
+    }
+
+private:
+    unsigned int queries[RING];
+    double sumMs;
+    unsigned int samples;
+    unsigned int head;
+    unsigned int pending;
+    bool active;
+
+    // read back every finished query, oldest first
+    void collect()
+    {
+        while (pending > 0)
+        {
+            unsigned int oldest = (head + RING - pending) % RING;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(queries[oldest], GL_QUERY_RESULT, &ns);
+            lastMs = ns / 1.0e6;
+            sumMs += lastMs;
+            samples++;
+            finished++;
+            pending--;
+        }
+    }
+};
+
+// GPU time of one section of a frame from a pair of GL_TIMESTAMP queries. Unlike GL_TIME_ELAPSED these may lie
+// inside a GpuTimer measurement and inside each other. Read back like GpuTimer, without ever waiting.
+class GpuSectionTimer
+{
+public:
+    double lastMs;
+    unsigned int finished;
+
+    GpuSectionTimer() : lastMs(0.0), finished(0), head(0), pending(0), active(false)
+    {
+        glGenQueries(2 * GpuTimer::RING, queries);
+    }
+
+    ~GpuSectionTimer()
+    {
+        glDeleteQueries(2 * GpuTimer::RING, queries);
+    }
+
+    GpuSectionTimer(const GpuSectionTimer &) = delete;
+    GpuSectionTimer &operator=(const GpuSectionTimer &) = delete;
+
+    void begin()
+    {
+        collect();
+        if (pending == GpuTimer::RING)
+            return;
+        glQueryCounter(queries[2 * head], GL_TIMESTAMP);
+        active = true;
+    }
+
+    void end()
+    {
+        if (!active)
+            return;
+        glQueryCounter(queries[2 * head + 1], GL_TIMESTAMP);
+        head = (head + 1) % GpuTimer::RING;
+        pending++;
+        active = false;
+    }
+
+private:
+    unsigned int queries[2 * GpuTimer::RING]; // begin and end of every slot
+    unsigned int head;
+    unsigned int pending;
+    bool active;
+
+    void collect()
+    {
+        while (pending > 0)
+        {
+            unsigned int oldest = (head + GpuTimer::RING - pending) % GpuTimer::RING;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[2 * oldest + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                return;
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(queries[2 * oldest], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[2 * oldest + 1], GL_QUERY_RESULT, &end);
+            lastMs = end > begin ? (end - begin) / 1.0e6 : 0.0;
+            finished++;
+            pending--;
+        }
+    }
+};
+#endif
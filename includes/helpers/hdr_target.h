@@ -0,0 +1,180 @@
+#ifndef HDR_TARGET_H
+#define HDR_TARGET_H
+
+#include <glad/glad.h>
+
+#include <helpers/shader.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+// Floating point framebuffer the scene is lit into, sized to the window every frame:
+//   color:         RGBA16F, linear radiance without any range limit
+//   depth/stencil: DEPTH24_STENCIL8
+// With samples > 1 both are multisampled renderbuffers and present() resolves the color into a single sampled texture
+// first. The scene may cover only the lower left renderWidth x renderHeight pixels (see setRenderScale), so the render
+// scale changes without reallocating anything. present() tonemaps and upscales that rectangle into the default
+// framebuffer in one fullscreen pass; the sRGB encoding happens on write when GL_FRAMEBUFFER_SRGB is enabled and the
+// default framebuffer is sRGB capable.
+class HdrTarget
+{
+public:
+    unsigned int FBO;
+    int width, height; // allocated, the window's framebuffer size
+    int renderWidth, renderHeight; // covered by the scene
+    int samples;
+
+    explicit HdrTarget(int samples = 1)
+        : FBO(0), width(0), height(0), renderWidth(0), renderHeight(0), samples(samples), renderScale(1.0f), colorBuffer(0),
+          depthBuffer(0), resolveFBO(0), color(0)
+    {
+        glGenVertexArrays(1, &quadVAO);
+    }
+
+    ~HdrTarget()
+    {
+        release();
+        glDeleteVertexArrays(1, &quadVAO);
+    }
+
+    HdrTarget(const HdrTarget &) = delete;
+    HdrTarget &operator=(const HdrTarget &) = delete;
+
+    // (re)allocate the attachments, does nothing if the size did not change
+    void resize(int w, int h)
+    {
+        if (w == width && h == height)
+            return;
+        release();
+        width = w;
+        height = h;
+        setRenderScale(renderScale);
+        if (width <= 0 || height <= 0) // minimised window
+            return;
+
+        color = createColorTexture();
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        if (samples > 1)
+        {
+            glGenRenderbuffers(1, &colorBuffer);
+            glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+            glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA16F, width, height);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        }
+        else
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        if (samples > 1)
+            glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH24_STENCIL8, width, height);
+        else
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::HDR_TARGET::FRAMEBUFFER_INCOMPLETE" << std::endl;
+
+        if (samples > 1)
+        {
+            glGenFramebuffers(1, &resolveFBO);
+            glBindFramebuffer(GL_FRAMEBUFFER, resolveFBO);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::HDR_TARGET::RESOLVE_FRAMEBUFFER_INCOMPLETE" << std::endl;
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // reallocates with another sample count, 1 for no multisampling
+    void setSamples(int count)
+    {
+        if (count == samples)
+            return;
+        int w = width, h = height;
+        release();
+        samples = count;
+        resize(w, h);
+    }
+
+    // fraction of width and height the scene is rendered at from the next bind() on
+    void setRenderScale(float scale)
+    {
+        renderScale = scale;
+        renderWidth = std::max((int)(width * scale + 0.5f), 1);
+        renderHeight = std::max((int)(height * scale + 0.5f), 1);
+    }
+
+    // bind for rendering the scene into the render rectangle
+    void bind() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glViewport(0, 0, renderWidth, renderHeight);
+    }
+
+    // tonemaps and upscales the render rectangle into the default framebuffer; tonemapShader samples hdrBuffer, unit
+    // is left bound to it. sharpness (0 to 1) restores some of the detail bilinear upscaling blurs.
+    void present(Shader &tonemapShader, float sharpness = 0.0f, unsigned int unit = 0) const
+    {
+        if (FBO == 0)
+            return;
+        if (samples > 1)
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFBO);
+            glBlitFramebuffer(0, 0, renderWidth, renderHeight, 0, 0, renderWidth, renderHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, width, height);
+        GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+        glDisable(GL_DEPTH_TEST);
+        tonemapShader.use();
+        tonemapShader.setInt("hdrBuffer", unit);
+        tonemapShader.setVec2("renderSize", glm::vec2(renderWidth, renderHeight));
+        tonemapShader.setFloat("sharpness", renderWidth < width ? sharpness : 0.0f);
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, color);
+        glBindVertexArray(quadVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        if (depthTest)
+            glEnable(GL_DEPTH_TEST);
+    }
+
+private:
+    float renderScale;
+    unsigned int colorBuffer, depthBuffer; // multisampled color, depth/stencil
+    unsigned int resolveFBO;
+    unsigned int color; // what present() samples
+    unsigned int quadVAO; // empty, the fullscreen triangle comes from gl_VertexID
+
+    unsigned int createColorTexture() const
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void release()
+    {
+        if (FBO != 0)
+        {
+            glDeleteTextures(1, &color);
+            unsigned int renderbuffers[2] = {colorBuffer, depthBuffer};
+            glDeleteRenderbuffers(2, renderbuffers);
+            glDeleteFramebuffers(1, &FBO);
+            if (resolveFBO != 0)
+                glDeleteFramebuffers(1, &resolveFBO);
+        }
+        FBO = resolveFBO = colorBuffer = depthBuffer = color = 0;
+        width = height = renderWidth = renderHeight = 0;
+    }
+};
+#endif
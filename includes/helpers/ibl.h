@@ -0,0 +1,464 @@
+#ifndef IBL_H
+#define IBL_H
+
+#include <helpers/resource_pack.h>
+#include <helpers/thread_pool.h>
+
+#include <glm/glm.hpp>
+#include <stb_image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define IBL_SSE2
+#endif
+
+// Image based lighting baked on the CPU from a cubemap environment: a cosine convolved irradiance cubemap for
+// diffuse light, a GGX prefiltered cubemap whose mips go from mirror to fully rough for specular light, and the
+// split-sum BRDF lookup table (scale and bias to F0 by n.v and roughness). Everything is linear RGB floats.
+
+// bump whenever the baked result changes, old cache files are then ignored
+const unsigned int IBL_CACHE_VERSION = 1;
+const int IBL_IRRADIANCE_SIZE = 32;
+const int IBL_SPECULAR_SIZE = 128;
+const int IBL_SPECULAR_MIPS = 5; // roughness 0, 0.25, 0.5, 0.75, 1
+const int IBL_SPECULAR_SAMPLES = 128;
+const int IBL_LUT_SIZE = 128;
+const int IBL_LUT_SAMPLES = 256;
+
+// cubemap on the CPU, faces in GL order (+X, -X, +Y, -Y, +Z, -Z), each size * size RGB texels in upload order
+struct CubeImage
+{
+    int size;
+    std::vector<float> faces[6];
+
+    CubeImage(int size = 0) : size(size)
+    {
+        for (int face = 0; face < 6; ++face)
+            faces[face].assign(size * size * 3, 0.0f);
+    }
+};
+
+struct IblMaps
+{
+    CubeImage irradiance;
+    std::vector<CubeImage> specular; // mip chain
+    int lutSize;
+    std::vector<float> lut; // RG
+};
+
+// direction through (u, v) in [-1, 1] of face, the inverse of the GL cubemap face selection
+inline glm::vec3 cubeDirection(int face, float u, float v)
+{
+    switch (face)
+    {
+    case 0: return glm::normalize(glm::vec3(1.0f, -v, -u));
+    case 1: return glm::normalize(glm::vec3(-1.0f, -v, u));
+    case 2: return glm::normalize(glm::vec3(u, 1.0f, v));
+    case 3: return glm::normalize(glm::vec3(u, -1.0f, -v));
+    case 4: return glm::normalize(glm::vec3(u, -v, 1.0f));
+    default: return glm::normalize(glm::vec3(-u, -v, -1.0f));
+    }
+}
+
+// direction through the centre of texel (x, y)
+inline glm::vec3 cubeTexelDirection(int face, int x, int y, int size)
+{
+    return cubeDirection(face, 2.0f * (x + 0.5f) / size - 1.0f, 2.0f * (y + 0.5f) / size - 1.0f);
+}
+
+// face and (u, v) in [0, 1] a direction hits, as GL selects them
+inline int cubeFace(const glm::vec3 &d, float &u, float &v)
+{
+    glm::vec3 a = glm::abs(d);
+    int face;
+    float sc, tc, ma;
+    if (a.x >= a.y && a.x >= a.z)
+    {
+        face = d.x > 0.0f ? 0 : 1;
+        sc = d.x > 0.0f ? -d.z : d.z;
+        tc = -d.y;
+        ma = a.x;
+    }
+    else if (a.y >= a.z)
+    {
+        face = d.y > 0.0f ? 2 : 3;
+        sc = d.x;
+        tc = d.y > 0.0f ? d.z : -d.z;
+        ma = a.y;
+    }
+    else
+    {
+        face = d.z > 0.0f ? 4 : 5;
+        sc = d.z > 0.0f ? d.x : -d.x;
+        tc = -d.y;
+        ma = a.z;
+    }
+    u = 0.5f * (sc / ma + 1.0f);
+    v = 0.5f * (tc / ma + 1.0f);
+    return face;
+}
+
+// solid angle of texel (x, y) of a face
+inline float cubeTexelSolidAngle(int x, int y, int size)
+{
+    float x0 = 2.0f * x / size - 1.0f, x1 = 2.0f * (x + 1) / size - 1.0f;
+    float y0 = 2.0f * y / size - 1.0f, y1 = 2.0f * (y + 1) / size - 1.0f;
+    auto area = [](float a, float b) { return std::atan2(a * b, std::sqrt(a * a + b * b + 1.0f)); };
+    return area(x0, y0) - area(x0, y1) - area(x1, y0) + area(x1, y1);
+}
+
+// bilinear lookup, clamped to the face
+inline glm::vec3 sampleCube(const CubeImage &cube, const glm::vec3 &direction)
+{
+    float u, v;
+    int face = cubeFace(direction, u, v);
+    float x = u * cube.size - 0.5f, y = v * cube.size - 0.5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    float fx = x - x0, fy = y - y0;
+    const float *texels = cube.faces[face].data();
+    glm::vec3 value[2][2];
+    for (int j = 0; j < 2; ++j)
+        for (int i = 0; i < 2; ++i)
+        {
+            int sx = std::min(std::max(x0 + i, 0), cube.size - 1);
+            int sy = std::min(std::max(y0 + j, 0), cube.size - 1);
+            const float *texel = texels + (sy * cube.size + sx) * 3;
+            value[j][i] = glm::vec3(texel[0], texel[1], texel[2]);
+        }
+    return glm::mix(glm::mix(value[0][0], value[0][1], fx), glm::mix(value[1][0], value[1][1], fx), fy);
+}
+
+// trilinear lookup into a mip chain
+inline glm::vec3 sampleCubeLod(const std::vector<CubeImage> &chain, const glm::vec3 &direction, float lod)
+{
+    lod = std::min(std::max(lod, 0.0f), (float)(chain.size() - 1));
+    int level = (int)lod;
+    if (level + 1 >= (int)chain.size())
+        return sampleCube(chain[level], direction);
+    return glm::mix(sampleCube(chain[level], direction), sampleCube(chain[level + 1], direction), lod - level);
+}
+
+// 2x2 box filtered half size cube
+inline CubeImage downsampleCube(const CubeImage &cube)
+{
+    CubeImage half(cube.size / 2);
+    for (int face = 0; face < 6; ++face)
+        for (int y = 0; y < half.size; ++y)
+            for (int x = 0; x < half.size; ++x)
+                for (int c = 0; c < 3; ++c)
+                {
+                    const std::vector<float> &src = cube.faces[face];
+                    int row0 = (2 * y) * cube.size, row1 = (2 * y + 1) * cube.size;
+                    half.faces[face][(y * half.size + x) * 3 + c] = 0.25f *
+                            (src[(row0 + 2 * x) * 3 + c] + src[(row0 + 2 * x + 1) * 3 + c]
+                             + src[(row1 + 2 * x) * 3 + c] + src[(row1 + 2 * x + 1) * 3 + c]);
+                }
+    return half;
+}
+
+// 64 bit FNV-1a over the content of the files, 0 if one cannot be read
+inline unsigned long long hashFiles(const std::vector<std::string> &paths, unsigned long long hash = 14695981039346656037ull)
+{
+    for (const std::string &path : paths)
+    {
+        Resource resource;
+        if (!readResource(path, resource))
+            return 0;
+        hash = fnv1a(resource.data(), resource.size(), hash);
+    }
+    return hash;
+}
+
+// loads 8 bit sRGB faces (in GL order) into linear floats, box filtered down to at most maxSize
+inline bool loadCubeImage(const std::vector<std::string> &faces, int maxSize, CubeImage &cube)
+{
+    float toLinear[256];
+    for (int i = 0; i < 256; ++i)
+        toLinear[i] = std::pow(i / 255.0f, 2.2f);
+    for (int face = 0; face < 6; ++face)
+    {
+        int width, height, nrComponents;
+        unsigned char *data = loadImage(faces[face], &width, &height, &nrComponents, 3);
+        if (!data || width != height || (face > 0 && width != cube.size))
+        {
+            stbi_image_free(data);
+            return false;
+        }
+        if (face == 0)
+            cube = CubeImage(width);
+        for (int i = 0; i < width * height * 3; ++i)
+            cube.faces[face][i] = toLinear[data[i]];
+        stbi_image_free(data);
+    }
+    while (cube.size > maxSize)
+        cube = downsampleCube(cube);
+    return true;
+}
+
+// E(n) / pi for every texel, the integral of the environment against the clamped cosine
+inline CubeImage convolveIrradiance(const CubeImage &environment, int size, ThreadPool &pool)
+{
+    // the source as structure of arrays, direction scaled by solid angle, padded to whole SSE registers
+    int count = environment.size * environment.size * 6;
+    int padded = (count + 3) & ~3;
+    std::vector<float> dx(padded, 0.0f), dy(padded, 0.0f), dz(padded, 0.0f), r(padded, 0.0f), g(padded, 0.0f), b(padded, 0.0f);
+    for (int face = 0, i = 0; face < 6; ++face)
+        for (int y = 0; y < environment.size; ++y)
+            for (int x = 0; x < environment.size; ++x, ++i)
+            {
+                glm::vec3 d = cubeTexelDirection(face, x, y, environment.size) * cubeTexelSolidAngle(x, y, environment.size);
+                dx[i] = d.x;
+                dy[i] = d.y;
+                dz[i] = d.z;
+                const float *texel = &environment.faces[face][(y * environment.size + x) * 3];
+                r[i] = texel[0];
+                g[i] = texel[1];
+                b[i] = texel[2];
+            }
+
+    CubeImage irradiance(size);
+    pool.parallelFor(0, 6 * size, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int row = begin; row < end; ++row)
+        {
+            int face = row / size, y = row % size;
+            for (int x = 0; x < size; ++x)
+            {
+                glm::vec3 n = cubeTexelDirection(face, x, y, size);
+                float sum[3];
+#ifdef IBL_SSE2
+                __m128 nx = _mm_set1_ps(n.x), ny = _mm_set1_ps(n.y), nz = _mm_set1_ps(n.z), zero = _mm_setzero_ps();
+                __m128 sr = zero, sg = zero, sb = zero;
+                for (int i = 0; i < padded; i += 4)
+                {
+                    __m128 cosine = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(&dx[i])), _mm_mul_ps(ny, _mm_loadu_ps(&dy[i]))),
+                                               _mm_mul_ps(nz, _mm_loadu_ps(&dz[i])));
+                    cosine = _mm_max_ps(cosine, zero);
+                    sr = _mm_add_ps(sr, _mm_mul_ps(cosine, _mm_loadu_ps(&r[i])));
+                    sg = _mm_add_ps(sg, _mm_mul_ps(cosine, _mm_loadu_ps(&g[i])));
+                    sb = _mm_add_ps(sb, _mm_mul_ps(cosine, _mm_loadu_ps(&b[i])));
+                }
+                float lanes[3][4];
+                _mm_storeu_ps(lanes[0], sr);
+                _mm_storeu_ps(lanes[1], sg);
+                _mm_storeu_ps(lanes[2], sb);
+                for (int c = 0; c < 3; ++c)
+                    sum[c] = lanes[c][0] + lanes[c][1] + lanes[c][2] + lanes[c][3];
+#else
+                sum[0] = sum[1] = sum[2] = 0.0f;
+                for (int i = 0; i < padded; ++i)
+                {
+                    float cosine = std::max(n.x * dx[i] + n.y * dy[i] + n.z * dz[i], 0.0f);
+                    sum[0] += cosine * r[i];
+                    sum[1] += cosine * g[i];
+                    sum[2] += cosine * b[i];
+                }
+#endif
+                for (int c = 0; c < 3; ++c)
+                    irradiance.faces[face][(y * size + x) * 3 + c] = sum[c] / 3.14159265f;
+            }
+        }
+    });
+    return irradiance;
+}
+
+inline glm::vec2 hammersley(unsigned int i, unsigned int count)
+{
+    unsigned int bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return glm::vec2((float)i / count, bits * 2.3283064365386963e-10f);
+}
+
+// GGX distributed half vector around +Z
+inline glm::vec3 importanceSampleGGX(const glm::vec2 &xi, float roughness)
+{
+    float a = roughness * roughness;
+    float phi = 2.0f * 3.14159265f * xi.x;
+    float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+    float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+    return glm::vec3(std::cos(phi) * sinTheta, std::sin(phi) * sinTheta, cosTheta);
+}
+
+// GGX prefiltered mip chain of the environment, with n = v = r as in the split sum approximation. Samples read a
+// box filtered chain of the source at the level whose texels cover the sample's solid angle (filtered importance
+// sampling), which keeps few samples free of fireflies.
+inline std::vector<CubeImage> prefilterSpecular(const CubeImage &environment, int mips, ThreadPool &pool)
+{
+    std::vector<CubeImage> source(1, environment);
+    while (source.back().size > 1)
+        source.push_back(downsampleCube(source.back()));
+    float texelSolidAngle = 4.0f * 3.14159265f / (6.0f * environment.size * environment.size);
+
+    std::vector<CubeImage> chain(1, environment);
+    for (int mip = 1; mip < mips; ++mip)
+    {
+        float roughness = (float)mip / (mips - 1);
+        float a2 = roughness * roughness * roughness * roughness;
+        // sample directions and source levels are the same in every texel's tangent frame
+        std::vector<glm::vec3> directions;
+        std::vector<float> lods;
+        for (int i = 0; i < IBL_SPECULAR_SAMPLES; ++i)
+        {
+            glm::vec3 h = importanceSampleGGX(hammersley(i, IBL_SPECULAR_SAMPLES), roughness);
+            glm::vec3 l = 2.0f * h.z * h - glm::vec3(0.0f, 0.0f, 1.0f);
+            if (l.z <= 0.0f)
+                continue;
+            float denominator = h.z * h.z * (a2 - 1.0f) + 1.0f;
+            float pdf = a2 / (3.14159265f * denominator * denominator) / 4.0f;
+            float sampleSolidAngle = 1.0f / (IBL_SPECULAR_SAMPLES * pdf + 1e-4f);
+            directions.push_back(l);
+            lods.push_back(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f);
+        }
+
+        int size = std::max(environment.size >> mip, 1);
+        CubeImage level(size);
+        pool.parallelFor(0, 6 * size, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int row = begin; row < end; ++row)
+            {
+                int face = row / size, y = row % size;
+                for (int x = 0; x < size; ++x)
+                {
+                    glm::vec3 n = cubeTexelDirection(face, x, y, size);
+                    glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                    glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+                    glm::vec3 bitangent = glm::cross(n, tangent);
+                    glm::vec3 sum(0.0f);
+                    float weight = 0.0f;
+                    for (size_t i = 0; i < directions.size(); ++i)
+                    {
+                        const glm::vec3 &l = directions[i];
+                        sum += sampleCubeLod(source, tangent * l.x + bitangent * l.y + n * l.z, lods[i]) * l.z;
+                        weight += l.z;
+                    }
+                    sum /= weight;
+                    float *texel = &level.faces[face][(y * size + x) * 3];
+                    texel[0] = sum.x;
+                    texel[1] = sum.y;
+                    texel[2] = sum.z;
+                }
+            }
+        });
+        chain.push_back(level);
+    }
+    return chain;
+}
+
+// split-sum scale and bias to F0, by n.v along x and roughness along y
+inline std::vector<float> integrateBrdf(int size, ThreadPool &pool)
+{
+    std::vector<float> lut(size * size * 2);
+    pool.parallelFor(0, size, [&](unsigned int begin, unsigned int end) {
+        for (unsigned int y = begin; y < end; ++y)
+            for (int x = 0; x < size; ++x)
+            {
+                float NdotV = (x + 0.5f) / size, roughness = (y + 0.5f) / size;
+                glm::vec3 v(std::sqrt(1.0f - NdotV * NdotV), 0.0f, NdotV);
+                float k = roughness * roughness / 2.0f;
+                float scale = 0.0f, bias = 0.0f;
+                for (int i = 0; i < IBL_LUT_SAMPLES; ++i)
+                {
+                    glm::vec3 h = importanceSampleGGX(hammersley(i, IBL_LUT_SAMPLES), roughness);
+                    glm::vec3 l = 2.0f * glm::dot(v, h) * h - v;
+                    float NdotL = l.z, NdotH = std::max(h.z, 0.0f), VdotH = std::max(glm::dot(v, h), 0.0f);
+                    if (NdotL <= 0.0f)
+                        continue;
+                    float G = NdotV / (NdotV * (1.0f - k) + k) * NdotL / (NdotL * (1.0f - k) + k);
+                    float visibility = G * VdotH / (NdotH * NdotV);
+                    float fresnel = std::pow(1.0f - VdotH, 5.0f);
+                    scale += (1.0f - fresnel) * visibility;
+                    bias += fresnel * visibility;
+                }
+                lut[(y * size + x) * 2] = scale / IBL_LUT_SAMPLES;
+                lut[(y * size + x) * 2 + 1] = bias / IBL_LUT_SAMPLES;
+            }
+    });
+    return lut;
+}
+
+inline IblMaps bakeIbl(const CubeImage &environment, ThreadPool &pool)
+{
+    IblMaps maps;
+    CubeImage irradianceSource = environment;
+    while (irradianceSource.size > IBL_IRRADIANCE_SIZE)
+        irradianceSource = downsampleCube(irradianceSource);
+    maps.irradiance = convolveIrradiance(irradianceSource, IBL_IRRADIANCE_SIZE, pool);
+    CubeImage specularSource = environment;
+    while (specularSource.size > IBL_SPECULAR_SIZE)
+        specularSource = downsampleCube(specularSource);
+    maps.specular = prefilterSpecular(specularSource, IBL_SPECULAR_MIPS, pool);
+    maps.lutSize = IBL_LUT_SIZE;
+    maps.lut = integrateBrdf(IBL_LUT_SIZE, pool);
+    return maps;
+}
+
+// cache file next to the environment named after the hash of its faces and of the bake settings
+inline std::string iblCachePath(const std::vector<std::string> &faces)
+{
+    unsigned long long settings[] = {IBL_CACHE_VERSION, IBL_IRRADIANCE_SIZE, IBL_SPECULAR_SIZE, IBL_SPECULAR_MIPS,
+                                     IBL_SPECULAR_SAMPLES, IBL_LUT_SIZE, IBL_LUT_SAMPLES};
+    unsigned long long hash = hashFiles(faces);
+    for (unsigned long long setting : settings)
+        hash = (hash ^ setting) * 1099511628211ull;
+    char name[32];
+    std::snprintf(name, sizeof(name), "ibl_%016llx.bin", hash);
+    return faces[0].substr(0, faces[0].find_last_of("/\\") + 1) + name;
+}
+
+// the file is "IBL1", irradiance size, mip count, base specular size, LUT size and the floats, native byte order
+inline bool saveIbl(const std::string &path, const IblMaps &maps)
+{
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    int header[4] = {maps.irradiance.size, (int)maps.specular.size(), maps.specular[0].size, maps.lutSize};
+    bool written = std::fwrite("IBL1", 1, 4, file) == 4 && std::fwrite(header, sizeof(int), 4, file) == 4;
+    for (int face = 0; face < 6 && written; ++face)
+        written = std::fwrite(maps.irradiance.faces[face].data(), sizeof(float), maps.irradiance.faces[face].size(), file) == maps.irradiance.faces[face].size();
+    for (size_t mip = 0; mip < maps.specular.size(); ++mip)
+        for (int face = 0; face < 6 && written; ++face)
+            written = std::fwrite(maps.specular[mip].faces[face].data(), sizeof(float), maps.specular[mip].faces[face].size(), file) == maps.specular[mip].faces[face].size();
+    written = written && std::fwrite(maps.lut.data(), sizeof(float), maps.lut.size(), file) == maps.lut.size();
+    std::fclose(file);
+    return written;
+}
+
+inline bool loadIbl(const std::string &path, IblMaps &maps)
+{
+    Resource resource;
+    if (!readResource(path, resource))
+        return false;
+    ResourceReader file(resource);
+    char magic[4];
+    int header[4];
+    bool read = file.read(magic, 4) && std::memcmp(magic, "IBL1", 4) == 0
+                && file.read(header, sizeof(header)) && header[0] > 0 && header[1] > 0 && header[1] <= 16
+                && header[2] > 0 && header[3] > 0;
+    if (read)
+    {
+        maps.irradiance = CubeImage(header[0]);
+        for (int face = 0; face < 6 && read; ++face)
+            read = file.read(maps.irradiance.faces[face].data(), sizeof(float) * maps.irradiance.faces[face].size());
+        maps.specular.clear();
+        for (int mip = 0; mip < header[1]; ++mip)
+        {
+            maps.specular.push_back(CubeImage(std::max(header[2] >> mip, 1)));
+            for (int face = 0; face < 6 && read; ++face)
+                read = file.read(maps.specular[mip].faces[face].data(), sizeof(float) * maps.specular[mip].faces[face].size());
+        }
+        maps.lutSize = header[3];
+        maps.lut.resize(header[3] * header[3] * 2);
+        read = read && file.read(maps.lut.data(), sizeof(float) * maps.lut.size());
+    }
+    return read;
+}
+#endif
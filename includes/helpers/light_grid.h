@@ -0,0 +1,325 @@
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <helpers/lights.h>
+#include <helpers/shader.h>
+#include <helpers/thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// Clustered (froxel) light assignment. The view frustum is split into dimX * dimY screen tiles and dimZ
+// exponentially spaced depth slices; every cluster gets the list of lights whose sphere of influence touches it.
+// The result lives in three texture buffers the lighting shaders read with texelFetch:
+//   lightData    - RGBA32F, 3 texels per light: (position, radius), (color, ambient), (constant, linear, quadratic, 0)
+//   clusterGrid  - RG32UI, one texel per cluster: (offset into lightIndices, light count)
+//   lightIndices - R32UI, concatenated per-cluster light lists
+class LightGrid
+{
+public:
+    unsigned int dimX, dimY, dimZ;
+    unsigned int maxLightsPerCluster;
+
+    // statistics of the last update
+    unsigned int lightCount;
+    unsigned int indexCount;
+    unsigned int busiestCluster;
+    unsigned int overflowedClusters; // clusters reached by more than maxLightsPerCluster lights
+    unsigned int droppedLights; // cluster entries left out by the cap, summed over the clusters
+
+    LightGrid(ThreadPool &pool, unsigned int dimX = 16, unsigned int dimY = 9, unsigned int dimZ = 24,
+              unsigned int maxLightsPerCluster = 128)
+            : dimX(dimX), dimY(dimY), dimZ(dimZ), maxLightsPerCluster(maxLightsPerCluster),
+              lightCount(0), indexCount(0), busiestCluster(0), overflowedClusters(0), droppedLights(0),
+              pool(pool), clusterLights(dimX * dimY * dimZ), clusterDropped(dimX * dimY * dimZ), grid(dimX * dimY * dimZ * 2),
+              nearPlane(0.0f), farPlane(0.0f), tanHalfFovY(0.0f), aspect(0.0f)
+    {
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        for (int i = 0; i < 3; ++i)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+
+    ~LightGrid()
+    {
+        glDeleteTextures(3, textures);
+        glDeleteBuffers(3, buffers);
+    }
+
+    LightGrid(const LightGrid &) = delete;
+    LightGrid &operator=(const LightGrid &) = delete;
+
+    // assign lights to clusters for the given camera and upload the result
+    void update(const std::vector<PointLight> &lights, const glm::mat4 &view, float fovY, float aspectRatio,
+                float zNear, float zFar)
+    {
+        if (zNear != nearPlane || zFar != farPlane || std::tan(fovY * 0.5f) != tanHalfFovY || aspectRatio != aspect)
+            buildClusterBounds(fovY, aspectRatio, zNear, zFar);
+
+        lightCount = (unsigned int)lights.size();
+        viewLights.resize(lights.size());
+        lightData.resize(lights.size() * 12);
+
+        // 1. view-space bounds of every light and its conservative cluster range
+        pool.parallelFor(0, lightCount, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int i = begin; i < end; ++i)
+                prepareLight(lights[i], view, viewLights[i], &lightData[i * 12]);
+        }, 64);
+
+        // 2. each job owns whole depth slices, so cluster lists are written without locking
+        pool.parallelFor(0, dimZ, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int z = begin; z < end; ++z)
+                assignSlice(z);
+        });
+
+        // 3. flatten the per-cluster lists
+        indices.clear();
+        busiestCluster = 0;
+        unsigned int overflowedBefore = overflowedClusters;
+        overflowedClusters = droppedLights = 0;
+        for (unsigned int c = 0; c < clusterLights.size(); ++c)
+        {
+            grid[c * 2] = (uint32_t)indices.size();
+            grid[c * 2 + 1] = (uint32_t)clusterLights[c].size();
+            busiestCluster = std::max(busiestCluster, (unsigned int)clusterLights[c].size() + clusterDropped[c]);
+            indices.insert(indices.end(), clusterLights[c].begin(), clusterLights[c].end());
+            overflowedClusters += clusterDropped[c] > 0;
+            droppedLights += clusterDropped[c];
+        }
+        indexCount = (unsigned int)indices.size();
+        // dropped lights pop in and out of the clusters they should light, say so once when it starts
+        if (overflowedClusters > 0 && overflowedBefore == 0)
+            std::cout << "Light grid: " << overflowedClusters << " clusters over "
+                      << maxLightsPerCluster << " lights, " << droppedLights << " lights dropped, busiest "
+                      << busiestCluster << std::endl;
+
+        upload(buffers[0], lightData.data(), lightData.size() * sizeof(float));
+        upload(buffers[1], grid.data(), grid.size() * sizeof(uint32_t));
+        upload(buffers[2], indices.data(), indices.size() * sizeof(uint32_t));
+    }
+
+    // upload only the light data, for renderers that do not need the cluster lists
+    void uploadLightData(const std::vector<PointLight> &lights)
+    {
+        lightCount = (unsigned int)lights.size();
+        lightData.resize(lights.size() * 12);
+        for (unsigned int i = 0; i < lightCount; ++i)
+            packLight(lights[i], &lightData[i * 12]);
+        upload(buffers[0], lightData.data(), lightData.size() * sizeof(float));
+    }
+
+    // bind only the light data buffer texture
+    void bindLightData(unsigned int unit) const
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, textures[0]);
+    }
+
+    // bind the three buffer textures to firstUnit, firstUnit + 1 and firstUnit + 2
+    void bind(unsigned int firstUnit) const
+    {
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+    }
+
+    // uniforms consumed by the cluster lookup in the lighting shaders, shader must be in use
+    void setUniforms(const Shader &shader, unsigned int firstUnit, const glm::vec2 &viewportSize) const
+    {
+        shader.setInt("lightData", firstUnit);
+        shader.setInt("clusterGrid", firstUnit + 1);
+        shader.setInt("lightIndices", firstUnit + 2);
+        glUniform3i(glGetUniformLocation(shader.ID, "clusterDims"), dimX, dimY, dimZ);
+        // slice = log(depth) * scale - bias
+        float scale = dimZ / std::log(farPlane / nearPlane);
+        shader.setVec2("clusterZParams", scale, std::log(nearPlane) * scale);
+        shader.setVec2("viewportSize", viewportSize);
+        shader.setFloat("nearPlane", nearPlane);
+        shader.setFloat("farPlane", farPlane);
+    }
+
+private:
+    struct ViewLight
+    {
+        glm::vec3 center;
+        float radius;
+        int x0, x1, y0, y1, z0, z1;
+    };
+
+    struct Box
+    {
+        glm::vec3 min, max;
+    };
+
+    ThreadPool &pool;
+    unsigned int buffers[3];
+    unsigned int textures[3];
+
+    std::vector<Box> clusterBounds;
+    std::vector<std::vector<uint32_t>> clusterLights;
+    std::vector<unsigned int> clusterDropped; // lights past the cap, per cluster
+    std::vector<ViewLight> viewLights;
+    std::vector<float> lightData;
+    std::vector<uint32_t> grid;
+    std::vector<uint32_t> indices;
+
+    float nearPlane, farPlane, tanHalfFovY, aspect;
+
+    float sliceDepth(unsigned int z) const
+    {
+        return nearPlane * std::pow(farPlane / nearPlane, (float)z / dimZ);
+    }
+
+    int depthSlice(float depth) const
+    {
+        int z = (int)std::floor(std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * dimZ);
+        return glm::clamp(z, 0, (int)dimZ - 1);
+    }
+
+    // view-space AABBs of every froxel, only rebuilt when the projection changes
+    void buildClusterBounds(float fovY, float aspectRatio, float zNear, float zFar)
+    {
+        nearPlane = zNear;
+        farPlane = zFar;
+        tanHalfFovY = std::tan(fovY * 0.5f);
+        aspect = aspectRatio;
+        float tanHalfFovX = tanHalfFovY * aspect;
+
+        clusterBounds.resize(dimX * dimY * dimZ);
+        for (unsigned int z = 0; z < dimZ; ++z)
+        {
+            float d0 = sliceDepth(z), d1 = sliceDepth(z + 1);
+            for (unsigned int y = 0; y < dimY; ++y)
+            {
+                float ny0 = -1.0f + 2.0f * y / dimY, ny1 = -1.0f + 2.0f * (y + 1) / dimY;
+                for (unsigned int x = 0; x < dimX; ++x)
+                {
+                    float nx0 = -1.0f + 2.0f * x / dimX, nx1 = -1.0f + 2.0f * (x + 1) / dimX;
+                    Box &box = clusterBounds[clusterIndex(x, y, z)];
+                    box.min = glm::vec3(std::min(nx0 * d0, nx0 * d1) * tanHalfFovX,
+                                        std::min(ny0 * d0, ny0 * d1) * tanHalfFovY, -d1);
+                    box.max = glm::vec3(std::max(nx1 * d0, nx1 * d1) * tanHalfFovX,
+                                        std::max(ny1 * d0, ny1 * d1) * tanHalfFovY, -d0);
+                }
+            }
+        }
+    }
+
+    unsigned int clusterIndex(unsigned int x, unsigned int y, unsigned int z) const
+    {
+        return x + dimX * (y + dimY * z);
+    }
+
+    static void packLight(const PointLight &light, float *data)
+    {
+        data[0] = light.position.x; data[1] = light.position.y; data[2] = light.position.z; data[3] = light.radius;
+        data[4] = light.color.r; data[5] = light.color.g; data[6] = light.color.b; data[7] = light.ambient;
+        data[8] = light.constant; data[9] = light.linear; data[10] = light.quadratic; data[11] = 0.0f;
+    }
+
+    void prepareLight(const PointLight &light, const glm::mat4 &view, ViewLight &out, float *data) const
+    {
+        packLight(light, data);
+
+        out.center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        out.radius = light.radius;
+        float depth = -out.center.z;
+        float dMin = depth - light.radius, dMax = depth + light.radius;
+        if (light.radius <= 0.0f || dMax < nearPlane || dMin > farPlane)
+        {
+            out.z0 = 1;
+            out.z1 = 0;
+            return;
+        }
+        dMin = std::max(dMin, nearPlane);
+        dMax = std::min(dMax, farPlane);
+        out.z0 = depthSlice(dMin);
+        out.z1 = depthSlice(dMax);
+
+        // NDC extent of the light's view-space box, x/d is extremal at the box corners
+        float tanHalfFovX = tanHalfFovY * aspect;
+        float xs[2] = {out.center.x - light.radius, out.center.x + light.radius};
+        float ys[2] = {out.center.y - light.radius, out.center.y + light.radius};
+        float ds[2] = {dMin, dMax};
+        float nx0 = 1e30f, nx1 = -1e30f, ny0 = 1e30f, ny1 = -1e30f;
+        for (int i = 0; i < 2; ++i)
+        {
+            for (int j = 0; j < 2; ++j)
+            {
+                nx0 = std::min(nx0, xs[i] / (ds[j] * tanHalfFovX));
+                nx1 = std::max(nx1, xs[i] / (ds[j] * tanHalfFovX));
+                ny0 = std::min(ny0, ys[i] / (ds[j] * tanHalfFovY));
+                ny1 = std::max(ny1, ys[i] / (ds[j] * tanHalfFovY));
+            }
+        }
+        out.x0 = glm::clamp((int)std::floor((nx0 * 0.5f + 0.5f) * dimX), 0, (int)dimX - 1);
+        out.x1 = glm::clamp((int)std::floor((nx1 * 0.5f + 0.5f) * dimX), 0, (int)dimX - 1);
+        out.y0 = glm::clamp((int)std::floor((ny0 * 0.5f + 0.5f) * dimY), 0, (int)dimY - 1);
+        out.y1 = glm::clamp((int)std::floor((ny1 * 0.5f + 0.5f) * dimY), 0, (int)dimY - 1);
+        if (nx1 < -1.0f || nx0 > 1.0f || ny1 < -1.0f || ny0 > 1.0f)
+        {
+            out.z0 = 1;
+            out.z1 = 0;
+        }
+    }
+
+    void assignSlice(unsigned int z)
+    {
+        for (unsigned int c = clusterIndex(0, 0, z); c < clusterIndex(0, 0, z + 1); ++c)
+        {
+            clusterLights[c].clear();
+            clusterDropped[c] = 0;
+        }
+
+        for (unsigned int i = 0; i < viewLights.size(); ++i)
+        {
+            const ViewLight &light = viewLights[i];
+            if ((int)z < light.z0 || (int)z > light.z1)
+                continue;
+            float radius2 = light.radius * light.radius;
+            for (int y = light.y0; y <= light.y1; ++y)
+            {
+                for (int x = light.x0; x <= light.x1; ++x)
+                {
+                    unsigned int c = clusterIndex(x, y, z);
+                    const Box &box = clusterBounds[c];
+                    glm::vec3 closest = glm::clamp(light.center, box.min, box.max);
+                    glm::vec3 delta = closest - light.center;
+                    if (glm::dot(delta, delta) > radius2)
+                        continue;
+                    if (clusterLights[c].size() < maxLightsPerCluster)
+                        clusterLights[c].push_back(i);
+                    else
+                        clusterDropped[c]++;
+                }
+            }
+        }
+    }
+
+    static void upload(unsigned int buffer, const void *data, size_t size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        // orphan the old storage so the driver does not wait for last frame's draws
+        glBufferData(GL_TEXTURE_BUFFER, std::max(size, (size_t)16), nullptr, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+#endif
@@ -0,0 +1,96 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <glm/glm.hpp>
+
+#include <helpers/culling.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// A point light as the lighting shaders see it. The Phong shaders use ambient/diffuse/specular derived from
+// color, the PBR shader treats color as radiant intensity. Attenuation is 1 / (constant + linear*d + quadratic*d^2),
+// multiplied by a window that brings it smoothly to zero at radius.
+struct PointLight
+{
+    glm::vec3 position;
+    glm::vec3 color;
+    float ambient;
+    float constant;
+    float linear;
+    float quadratic;
+    // distance beyond which the light is ignored (see lightRadius)
+    float radius;
+
+    PointLight(glm::vec3 position = glm::vec3(0.0f), glm::vec3 color = glm::vec3(1.0f), float ambient = 0.1f,
+               float constant = 1.0f, float linear = 0.09f, float quadratic = 0.032f)
+            : position(position), color(color), ambient(ambient),
+              constant(constant), linear(linear), quadratic(quadratic), radius(0.0f)
+    {
+    }
+};
+
+// distance at which the brightest channel of the light falls below threshold
+inline float lightRadius(const PointLight &light, float threshold = 5.0f / 256.0f)
+{
+    float intensity = std::max(std::max(light.color.r, light.color.g), light.color.b);
+    // solve quadratic*d^2 + linear*d + constant = intensity / threshold
+    float c = light.constant - intensity / threshold;
+    if (c >= 0.0f)
+        return 0.0f;
+    if (light.quadratic <= 0.0f)
+        return light.linear > 0.0f ? -c / light.linear : std::numeric_limits<float>::max();
+    return (-light.linear + std::sqrt(light.linear * light.linear - 4.0f * light.quadratic * c)) / (2.0f * light.quadratic);
+}
+
+// smooth falloff that brings a light's attenuation to exactly zero at its radius, matches RadiusWindow in the lighting
+// shaders
+inline float radiusWindow(float d, float radius)
+{
+    if (d >= radius)
+        return 0.0f;
+    float x = d / radius;
+    float window = 1.0f - x * x * x * x;
+    return window * window;
+}
+
+// windowed attenuation at distance d
+inline float lightAttenuation(const PointLight &light, float d)
+{
+    return radiusWindow(d, light.radius) / (light.constant + light.linear * d + light.quadratic * d * d);
+}
+
+// lights whose sphere of influence intersects the view frustum
+inline void cullLights(const std::vector<PointLight> &lights, const Frustum &frustum, std::vector<PointLight> &visible)
+{
+    visible.clear();
+    for (const PointLight &light : lights)
+        if (light.radius > 0.0f && frustum.intersectsSphere(light.position, light.radius))
+            visible.push_back(light);
+}
+
+// indices of at most maxCount lights reaching the box, strongest first
+inline std::vector<unsigned int> lightsAffecting(const std::vector<PointLight> &lights, const BoundingBox &bounds,
+                                                 unsigned int maxCount)
+{
+    std::vector<std::pair<float, unsigned int>> candidates;
+    for (unsigned int i = 0; i < lights.size(); ++i)
+    {
+        const PointLight &light = lights[i];
+        if (!bounds.intersectsSphere(light.position, light.radius))
+            continue;
+        float intensity = std::max(std::max(light.color.r, light.color.g), light.color.b);
+        float strength = intensity * lightAttenuation(light, std::sqrt(bounds.distanceSquared(light.position)));
+        candidates.push_back(std::make_pair(-strength, i));
+    }
+    unsigned int count = std::min(maxCount, (unsigned int)candidates.size());
+    std::partial_sort(candidates.begin(), candidates.begin() + count, candidates.end());
+    std::vector<unsigned int> result;
+    for (unsigned int i = 0; i < count; ++i)
+        result.push_back(candidates[i].second);
+    return result;
+}
+#endif
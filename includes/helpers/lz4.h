@@ -0,0 +1,143 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// The LZ4 block format: sequences of a token, literals and a match copied from up to 64 KB back, see
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md. Decompression is a few copies per sequence, cheap enough
+// to run on every load; the compressor is the plain greedy one, which is all an offline packer needs.
+namespace lz4_detail
+{
+const size_t MIN_MATCH = 4;
+const size_t LAST_LITERALS = 5; // a block ends with at least this many literals
+const size_t MATCH_LIMIT = 12; // and no match starts this close to its end
+const size_t MAX_OFFSET = 65535;
+const unsigned int HASH_BITS = 16;
+const size_t NO_POSITION = (size_t)-1;
+
+inline uint32_t read32(const unsigned char *bytes)
+{
+    uint32_t value;
+    std::memcpy(&value, bytes, 4);
+    return value;
+}
+
+inline uint32_t hash(uint32_t sequence)
+{
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// the part of a length that does not fit the 4 bits of the token, in bytes of 255 and a remainder
+inline void putLength(std::vector<unsigned char> &out, size_t length)
+{
+    for (; length >= 255; length -= 255)
+        out.push_back(255);
+    out.push_back((unsigned char)length);
+}
+
+inline bool getLength(const unsigned char *&in, const unsigned char *end, size_t &length)
+{
+    unsigned char byte;
+    do
+    {
+        if (in >= end)
+            return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+}
+
+// size bytes as one LZ4 block; incompressible data grows by a 255th at most
+inline std::vector<unsigned char> lz4Compress(const unsigned char *data, size_t size)
+{
+    using namespace lz4_detail;
+    std::vector<unsigned char> out;
+    out.reserve(size + size / 255 + 16);
+    std::vector<size_t> table(1u << HASH_BITS, NO_POSITION); // last position of every hashed 4 byte sequence
+    size_t anchor = 0, position = 0;
+    while (position + MATCH_LIMIT <= size)
+    {
+        uint32_t sequence = read32(data + position);
+        size_t candidate = table[hash(sequence)];
+        table[hash(sequence)] = position;
+        if (candidate == NO_POSITION || position - candidate > MAX_OFFSET || read32(data + candidate) != sequence)
+        {
+            // the longer nothing matched the bigger the steps, so JPEG and PNG data passes quickly
+            position += 1 + ((position - anchor) >> 6);
+            continue;
+        }
+        size_t length = MIN_MATCH;
+        while (position + length < size - LAST_LITERALS && data[candidate + length] == data[position + length])
+            length++;
+
+        size_t literals = position - anchor;
+        out.push_back((unsigned char)(std::min<size_t>(literals, 15) << 4 | std::min<size_t>(length - MIN_MATCH, 15)));
+        if (literals >= 15)
+            putLength(out, literals - 15);
+        out.insert(out.end(), data + anchor, data + position);
+        size_t offset = position - candidate;
+        out.push_back((unsigned char)offset);
+        out.push_back((unsigned char)(offset >> 8));
+        if (length - MIN_MATCH >= 15)
+            putLength(out, length - MIN_MATCH - 15);
+        position += length;
+        anchor = position;
+    }
+
+    // the last sequence is literals only
+    size_t literals = size - anchor;
+    out.push_back((unsigned char)(std::min<size_t>(literals, 15) << 4));
+    if (literals >= 15)
+        putLength(out, literals - 15);
+    out.insert(out.end(), data + anchor, data + size);
+    return out;
+}
+
+// decompresses a block into exactly size bytes; false on a malformed block, which never writes past the output
+inline bool lz4Decompress(const unsigned char *block, size_t blockSize, unsigned char *output, size_t size)
+{
+    using namespace lz4_detail;
+    const unsigned char *in = block, *end = block + blockSize;
+    size_t written = 0;
+    while (in < end)
+    {
+        unsigned int token = *in++;
+        size_t literals = token >> 4;
+        if (literals == 15 && !getLength(in, end, literals))
+            return false;
+        if (literals > (size_t)(end - in) || literals > size - written)
+            return false;
+        std::memcpy(output + written, in, literals);
+        in += literals;
+        written += literals;
+        if (in == end)
+            break;
+
+        if (end - in < 2)
+            return false;
+        size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !getLength(in, end, length))
+            return false;
+        length += MIN_MATCH;
+        if (offset == 0 || offset > written || length > size - written)
+            return false;
+        const unsigned char *match = output + written - offset;
+        if (offset >= length)
+            std::memcpy(output + written, match, length);
+        else
+            // the match overlaps what it writes and repeats its last offset bytes
+            for (size_t i = 0; i < length; ++i)
+                output[written + i] = match[i];
+        written += length;
+    }
+    return written == size;
+}
+#endif
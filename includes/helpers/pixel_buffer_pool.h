@@ -0,0 +1,142 @@
+#ifndef PIXEL_BUFFER_POOL_H
+#define PIXEL_BUFFER_POOL_H
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+// staging buffers in flight at once; each grows to the largest image written into it
+const unsigned int PIXEL_BUFFER_SLOTS = 4;
+
+// A pool of pixel unpack buffers for streaming texture data. map() hands out a free buffer mapped for writing; the
+// pointer may be filled from any thread while the GL thread goes on. bind() unmaps it for the glTex(Sub)Image calls,
+// which then read from offsets into the buffer and return without copying from client memory, and release() fences
+// them. A buffer is only mapped again once its fence has signaled, so writing never waits for the GPU.
+// All calls but the writes through the pointer belong to the GL thread.
+class PixelBufferPool
+{
+public:
+    explicit PixelBufferPool(unsigned int count = PIXEL_BUFFER_SLOTS) : slots(count)
+    {
+        for (Slot &slot : slots)
+        {
+            glGenBuffers(1, &slot.buffer);
+            slot.capacity = 0;
+            slot.fence = 0;
+            slot.mapped = false;
+        }
+    }
+
+    ~PixelBufferPool()
+    {
+        for (Slot &slot : slots)
+        {
+            if (slot.fence)
+                glDeleteSync(slot.fence);
+            glDeleteBuffers(1, &slot.buffer);
+        }
+    }
+
+    PixelBufferPool(const PixelBufferPool &) = delete;
+    PixelBufferPool &operator=(const PixelBufferPool &) = delete;
+
+    // a free buffer of at least size bytes mapped for writing, -1 while every buffer is mapped or in flight
+    int map(size_t size, unsigned char *&data)
+    {
+        reclaim();
+        int free = -1;
+        for (unsigned int i = 0; i < slots.size() && free < 0; ++i)
+            if (!slots[i].mapped && !slots[i].fence)
+                free = i;
+        if (free < 0)
+            return -1;
+        Slot &slot = slots[free];
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+        if (slot.capacity < size)
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+            slot.capacity = size;
+        }
+        // the fence has signaled, the previous contents are no longer read
+        data = (unsigned char *)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!data)
+        {
+            std::cout << "ERROR::PIXEL_BUFFER_POOL::MAP_FAILED " << size << " bytes" << std::endl;
+            return -1;
+        }
+        slot.mapped = true;
+        return free;
+    }
+
+    // unmaps the written buffer and binds it as the unpack source, texture data pointers are offsets from here on
+    void bind(int slot)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[slot].buffer);
+        if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+            std::cout << "ERROR::PIXEL_BUFFER_POOL::CONTENTS_LOST" << std::endl;
+        slots[slot].mapped = false;
+    }
+
+    // fences the uploads issued since bind() and unbinds, so later uploads read client memory again
+    void release(int slot)
+    {
+        slots[slot].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    // blocks until an upload in flight is done, for callers that cannot go on without a free buffer
+    void wait()
+    {
+        for (Slot &slot : slots)
+            if (slot.fence)
+            {
+                glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+                break;
+            }
+        reclaim();
+    }
+
+    // a buffer is mapped or its uploads are in flight, map() may succeed later
+    bool inFlight() const
+    {
+        for (const Slot &slot : slots)
+            if (slot.mapped || slot.fence)
+                return true;
+        return false;
+    }
+
+    // staging memory held by the buffers
+    size_t capacityBytes() const
+    {
+        size_t bytes = 0;
+        for (const Slot &slot : slots)
+            bytes += slot.capacity;
+        return bytes;
+    }
+
+private:
+    struct Slot
+    {
+        unsigned int buffer;
+        size_t capacity;
+        GLsync fence; // uploads from the buffer in flight, 0 when none
+        bool mapped;
+    };
+
+    std::vector<Slot> slots;
+
+    // buffers whose uploads completed become free
+    void reclaim()
+    {
+        for (Slot &slot : slots)
+            if (slot.fence && glClientWaitSync(slot.fence, 0, 0) != GL_TIMEOUT_EXPIRED)
+            {
+                glDeleteSync(slot.fence);
+                slot.fence = 0;
+            }
+    }
+};
+#endif
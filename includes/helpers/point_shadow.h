@@ -0,0 +1,331 @@
+#ifndef POINT_SHADOW_H
+#define POINT_SHADOW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <helpers/culling.h>
+#include <helpers/gl_utils.h>
+#include <helpers/shader.h>
+
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// How casters reach the six cube faces:
+//   SHADOW_GEOMETRY_SHADER - one draw per caster, the geometry shader copies every triangle into all faces
+//   SHADOW_PER_FACE        - casters are culled against each face frustum and drawn once per face they touch
+//   SHADOW_LAYERED         - same culling, one instanced draw per caster writing gl_Layer from the vertex shader
+//                            (needs ARB_shader_viewport_layer_array or AMD_vertex_shader_layer)
+enum PointShadowMode { SHADOW_GEOMETRY_SHADER, SHADOW_PER_FACE, SHADOW_LAYERED };
+
+// Object drawn into a shadow map; draw renders its mesh the given number of instances
+struct ShadowCaster
+{
+    glm::mat4 model;
+    BoundingBox bounds; // world space
+    unsigned int triangles;
+    std::function<void(unsigned int instances)> draw;
+};
+
+// view-projection of the six cube faces around lightPos in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+inline std::vector<glm::mat4> pointShadowTransforms(const glm::vec3 &lightPos, float nearPlane, float farPlane)
+{
+    glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
+    std::vector<glm::mat4> shadowTransforms;
+    shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
+    shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
+    shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
+    shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)));
+    shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
+    shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
+    return shadowTransforms;
+}
+
+// Omnidirectional shadow map of one point light with caching of static casters.
+// Static casters go into staticCubemap, which is only re-rendered when the light moves or the static scene
+// changes. Every frame with dynamic casters the cached depth is copied into cubemap and only the dynamic
+// casters are drawn on top of it; without dynamic casters the cache is sampled directly.
+// Casters can be culled against the six face frusta so that each one only reaches the faces it touches.
+// The cubemaps store distance / farPlane in a compact depth format and are set up for samplerCubeShadow:
+// depth comparison and linear filtering make every tap return a bilinear PCF result.
+class PointShadowMap
+{
+public:
+    unsigned int size;
+    float nearPlane, farPlane;
+    GLenum depthFormat; // GL_DEPTH_COMPONENT16 or GL_DEPTH_COMPONENT24
+    unsigned int staticCubemap, cubemap;
+
+    // cache statistics
+    unsigned int frames;
+    unsigned int staticUpdates;
+    unsigned int skippedUpdates;
+
+    // triangles sent to every cube face since the frame started, and the triangles of all casters passed in;
+    // the geometry shader path always costs 6 * casterTriangles
+    unsigned int faceTriangles[6];
+    unsigned int casterTriangles;
+
+    PointShadowMap(unsigned int size, float nearPlane, float farPlane, GLenum depthFormat = GL_DEPTH_COMPONENT24)
+            : size(size), nearPlane(nearPlane), farPlane(farPlane), depthFormat(depthFormat), frames(0), staticUpdates(0), skippedUpdates(0),
+              cachedVersion(0), cacheValid(false), composed(false), staticChanged(0), dynamicFaces(0), previousDynamicFaces(0)
+    {
+        staticCubemap = createCubemap();
+        cubemap = createCubemap();
+        glGenFramebuffers(1, &staticFBO);
+        glGenFramebuffers(1, &FBO);
+        attach(staticFBO, staticCubemap);
+        attach(FBO, cubemap);
+        glGenFramebuffers(2, copyFBOs);
+        glGenFramebuffers(1, &faceFBO);
+        target = staticCubemap;
+        std::memset(faceTriangles, 0, sizeof(faceTriangles));
+        casterTriangles = 0;
+    }
+
+    ~PointShadowMap()
+    {
+        glDeleteFramebuffers(1, &faceFBO);
+        glDeleteFramebuffers(2, copyFBOs);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteFramebuffers(1, &staticFBO);
+        glDeleteTextures(1, &cubemap);
+        glDeleteTextures(1, &staticCubemap);
+    }
+
+    PointShadowMap(const PointShadowMap &) = delete;
+    PointShadowMap &operator=(const PointShadowMap &) = delete;
+
+    // reallocates both cubemaps at a new face size, the static casters are re-rendered next frame
+    void resize(unsigned int newSize)
+    {
+        if (newSize == size)
+            return;
+        size = newSize;
+        glDeleteTextures(1, &cubemap);
+        glDeleteTextures(1, &staticCubemap);
+        staticCubemap = createCubemap();
+        cubemap = createCubemap();
+        attach(staticFBO, staticCubemap);
+        attach(FBO, cubemap);
+        target = staticCubemap;
+        cacheValid = false;
+    }
+
+    std::vector<glm::mat4> faceTransforms(const glm::vec3 &lightPos) const
+    {
+        return pointShadowTransforms(lightPos, nearPlane, farPlane);
+    }
+
+    // starts a frame; returns true if the static casters have to be re-rendered, in which case the static
+    // cubemap is bound and cleared. staticVersion must change whenever static geometry changes.
+    bool beginStaticPass(const glm::vec3 &lightPos, unsigned int staticVersion)
+    {
+        frames++;
+        composed = false;
+        std::memset(faceTriangles, 0, sizeof(faceTriangles));
+        casterTriangles = 0;
+        previousDynamicFaces = dynamicFaces;
+        dynamicFaces = 0;
+        staticChanged = 0;
+        if (cacheValid && lightPos == cachedLightPos && staticVersion == cachedVersion)
+        {
+            skippedUpdates++;
+            return false;
+        }
+        staticChanged = ALL_FACES;
+        cacheValid = true;
+        cachedLightPos = lightPos;
+        cachedVersion = staticVersion;
+        staticUpdates++;
+        target = staticCubemap;
+        glViewport(0, 0, size, size);
+        glBindFramebuffer(GL_FRAMEBUFFER, staticFBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        return true;
+    }
+
+    // copies the cached static depth into the per-frame cubemap and binds it for drawing the dynamic casters
+    void beginDynamicPass()
+    {
+        composed = true;
+        target = cubemap;
+        if (GLAD_GL_VERSION_4_3)
+        {
+            glCopyImageSubData(staticCubemap, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0,
+                               cubemap, GL_TEXTURE_CUBE_MAP, 0, 0, 0, 0, size, size, 6);
+        }
+        else
+        {
+            for (unsigned int face = 0; face < 6; ++face)
+            {
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, copyFBOs[0]);
+                glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, staticCubemap, 0);
+                glBindFramebuffer(GL_DRAW_FRAMEBUFFER, copyFBOs[1]);
+                glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubemap, 0);
+                glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            }
+        }
+        glViewport(0, 0, size, size);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    }
+
+    // draws casters into the cubemap bound by beginStaticPass or beginDynamicPass. The shader has to match the
+    // mode: shadow_mapping_depth_geom.glsl, shadow_mapping_face_vert.glsl or shadow_mapping_layer_vert.glsl.
+    void renderCasters(const std::vector<ShadowCaster> &casters, const glm::vec3 &lightPos, PointShadowMode mode, Shader &shader)
+    {
+        std::vector<glm::mat4> shadowTransforms = faceTransforms(lightPos);
+        shader.use();
+        shader.setFloat("far_plane", farPlane);
+        shader.setVec3("lightPos", lightPos);
+        if (mode != SHADOW_PER_FACE)
+            for (unsigned int i = 0; i < 6; ++i)
+                shader.setMat4("shadowMatrices[" + std::to_string(i) + "]", shadowTransforms[i]);
+        for (const ShadowCaster &caster : casters)
+            casterTriangles += caster.triangles;
+
+        if (mode == SHADOW_GEOMETRY_SHADER)
+        {
+            if (target == cubemap && !casters.empty())
+                dynamicFaces = ALL_FACES;
+            for (const ShadowCaster &caster : casters)
+            {
+                shader.setMat4("model", caster.model);
+                caster.draw(1);
+                for (unsigned int face = 0; face < 6; ++face)
+                    faceTriangles[face] += caster.triangles;
+            }
+            return;
+        }
+
+        // faces every caster touches, bit i for GL_TEXTURE_CUBE_MAP_POSITIVE_X + i
+        std::vector<unsigned int> faceMasks(casters.size(), 0);
+        for (unsigned int face = 0; face < 6; ++face)
+        {
+            Frustum frustum(shadowTransforms[face]);
+            for (unsigned int i = 0; i < casters.size(); ++i)
+                if (frustum.intersectsBox(casters[i].bounds))
+                {
+                    faceMasks[i] |= 1u << face;
+                    faceTriangles[face] += casters[i].triangles;
+                }
+        }
+        if (target == cubemap)
+            for (unsigned int mask : faceMasks)
+                dynamicFaces |= mask;
+
+        if (mode == SHADOW_LAYERED)
+        {
+            for (unsigned int i = 0; i < casters.size(); ++i)
+            {
+                unsigned int count = 0;
+                for (unsigned int face = 0; face < 6; ++face)
+                    if (faceMasks[i] & (1u << face))
+                        shader.setInt("faces[" + std::to_string(count++) + "]", face);
+                if (count == 0)
+                    continue;
+                shader.setMat4("model", casters[i].model);
+                casters[i].draw(count);
+            }
+            return;
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, faceFBO);
+        for (unsigned int face = 0; face < 6; ++face)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, target, 0);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+            shader.setMat4("shadowMatrix", shadowTransforms[face]);
+            for (unsigned int i = 0; i < casters.size(); ++i)
+            {
+                if (!(faceMasks[i] & (1u << face)))
+                    continue;
+                shader.setMat4("model", casters[i].model);
+                casters[i].draw(1);
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, target == cubemap ? FBO : staticFBO);
+    }
+
+    // total of faceTriangles
+    unsigned int triangles() const
+    {
+        unsigned int total = 0;
+        for (unsigned int face = 0; face < 6; ++face)
+            total += faceTriangles[face];
+        return total;
+    }
+
+    // whether the vertex shader may write gl_Layer, required by SHADOW_LAYERED
+    static bool vertexLayerSupported()
+    {
+        return hasGlExtension("GL_ARB_shader_viewport_layer_array") || hasGlExtension("GL_AMD_vertex_shader_layer");
+    }
+
+    // faces of texture() that may differ from the previous frame, bit i for GL_TEXTURE_CUBE_MAP_POSITIVE_X + i:
+    // all after a static update, otherwise those the dynamic casters reach now or reached last frame
+    unsigned int changedFaces() const
+    {
+        return staticChanged | dynamicFaces | previousDynamicFaces;
+    }
+
+    // the cubemap to sample this frame
+    unsigned int texture() const
+    {
+        return composed ? cubemap : staticCubemap;
+    }
+
+    // forces the static casters to be re-rendered next frame
+    void invalidate()
+    {
+        cacheValid = false;
+    }
+
+private:
+    unsigned int staticFBO, FBO;
+    unsigned int copyFBOs[2];
+    unsigned int faceFBO;
+    unsigned int target; // cubemap the current pass renders into
+    glm::vec3 cachedLightPos;
+    unsigned int cachedVersion;
+    bool cacheValid;
+    bool composed;
+    unsigned int staticChanged, dynamicFaces, previousDynamicFaces;
+    static const unsigned int ALL_FACES = 0x3F;
+
+    unsigned int createCubemap() const
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        for (unsigned int i = 0; i < 6; ++i)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, depthFormat, size, size, 0, GL_DEPTH_COMPONENT,
+                         depthFormat == GL_DEPTH_COMPONENT16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    static void attach(unsigned int fbo, unsigned int texture)
+    {
+        // attach depth texture as FBO's depth buffer
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+#endif
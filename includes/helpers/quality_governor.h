@@ -0,0 +1,277 @@
+#ifndef QUALITY_GOVERNOR_H
+#define QUALITY_GOVERNOR_H
+
+#include <helpers/gpu_timer.h>
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// frames under this fraction of the budget may raise a setting, as long as its predicted cost keeps them there
+const float QUALITY_GOVERNOR_HEADROOM = 0.7f;
+// lowering a setting has to save at least this fraction of the budget, cheaper passes keep their quality
+const float QUALITY_GOVERNOR_MIN_SAVING = 0.02f;
+// weight of a new pass measurement in the running cost of a level
+const double QUALITY_COST_SMOOTHING = 0.25;
+
+// Quality settings with a few discrete levels each, cheapest first, switched between named presets or by a closed
+// loop. Every setting times the pass it affects with a GpuSectionTimer (begin/end around the pass) and remembers the
+// smoothed cost of every level it was measured at. When a frame is over budget the closed loop lowers the setting
+// whose next level down saves the most; when a frame is well under budget it raises the one whose next level up
+// costs the least, if that still fits. Levels not measured yet are predicted from the current one by the relative
+// weights given with the setting. After every change the in-flight measurements, which still show the old levels,
+// are skipped. Decisions are appended to a CSV file for offline tuning.
+// Switching has to be cheap: settings that pick a shader should pick one of several compiled up front (see the
+// defines argument of Shader).
+class QualityGovernor
+{
+public:
+    struct Setting
+    {
+        std::string name;
+        std::vector<int> values; // what every level means to the application
+        std::vector<float> weights; // relative cost of every level, only until it is measured
+        std::vector<double> levelMs; // smoothed GPU time of the pass at every level, 0 until measured
+        unsigned int level;
+        unsigned int measuredAt; // frame measurement count when the pass was last timed
+        unsigned int skip; // pass measurements still showing the previous level
+        unsigned int seen;
+        std::unique_ptr<GpuSectionTimer> timer;
+    };
+
+    struct Preset
+    {
+        std::string name;
+        std::vector<unsigned int> levels; // one per setting
+    };
+
+    float budgetMs;
+    bool adaptive; // closed loop, otherwise the levels of the last preset or setLevel stay
+    std::vector<Setting> settings;
+    std::vector<Preset> presets;
+
+    explicit QualityGovernor(float budgetMs = 1000.0f / 60.0f, const std::string &logPath = "quality_governor.csv")
+        : budgetMs(budgetMs), adaptive(false), logPath(logPath), seen(0), frames(0), holdFrames(0)
+    {
+    }
+
+    QualityGovernor(const QualityGovernor &) = delete;
+    QualityGovernor &operator=(const QualityGovernor &) = delete;
+
+    // returns the index of the new setting, which starts at its best level
+    unsigned int addSetting(const std::string &name, const std::vector<int> &values, const std::vector<float> &weights)
+    {
+        Setting setting;
+        setting.name = name;
+        setting.values = values;
+        setting.weights = weights;
+        setting.levelMs.assign(values.size(), 0.0);
+        setting.level = values.size() - 1;
+        setting.measuredAt = 0;
+        setting.skip = 0;
+        setting.seen = 0;
+        setting.timer.reset(new GpuSectionTimer());
+        settings.push_back(std::move(setting));
+        return settings.size() - 1;
+    }
+
+    void addPreset(const std::string &name, const std::vector<unsigned int> &levels)
+    {
+        Preset preset;
+        preset.name = name;
+        preset.levels = levels;
+        presets.push_back(preset);
+    }
+
+    // a preset, or the closed loop for mode == presets.size(); the closed loop starts from the current levels
+    void setMode(unsigned int mode)
+    {
+        adaptive = mode >= presets.size();
+        if (adaptive)
+        {
+            writeLog("adaptive", 0, 0, 0, 0.0, 0.0);
+            return;
+        }
+        for (unsigned int i = 0; i < settings.size() && i < presets[mode].levels.size(); ++i)
+            setLevel(i, presets[mode].levels[i]);
+        writeLog("preset " + presets[mode].name, 0, 0, 0, 0.0, 0.0);
+    }
+
+    std::string modeName() const
+    {
+        if (adaptive)
+            return "adaptive";
+        for (const Preset &preset : presets)
+        {
+            bool matches = true;
+            for (unsigned int i = 0; i < settings.size() && i < preset.levels.size(); ++i)
+                matches = matches && settings[i].level == preset.levels[i];
+            if (matches)
+                return preset.name;
+        }
+        return "custom";
+    }
+
+    unsigned int level(unsigned int setting) const
+    {
+        return settings[setting].level;
+    }
+
+    int value(unsigned int setting) const
+    {
+        return settings[setting].values[settings[setting].level];
+    }
+
+    void setLevel(unsigned int setting, unsigned int level)
+    {
+        Setting &s = settings[setting];
+        if (level >= s.values.size() || level == s.level)
+            return;
+        s.level = level;
+        s.skip = GpuTimer::RING;
+        holdFrames = GpuTimer::RING;
+    }
+
+    // time the pass a setting affects
+    void begin(unsigned int setting)
+    {
+        settings[setting].timer->begin();
+    }
+
+    void end(unsigned int setting)
+    {
+        settings[setting].timer->end();
+    }
+
+    // feeds the newest measurements; in the closed loop lowers a setting only if mayLower and raises one only if
+    // mayRaise, so another controller (dynamic resolution) can act first. Returns whether a level changed.
+    bool update(const GpuTimer &frame, bool mayLower = true, bool mayRaise = true)
+    {
+        for (Setting &s : settings)
+        {
+            if (s.timer->finished == s.seen)
+                continue;
+            s.seen = s.timer->finished;
+            if (s.skip > 0)
+            {
+                s.skip--;
+                continue;
+            }
+            double &cost = s.levelMs[s.level];
+            cost = cost > 0.0 ? cost + QUALITY_COST_SMOOTHING * (s.timer->lastMs - cost) : s.timer->lastMs;
+            s.measuredAt = frames;
+        }
+        if (frame.finished == seen)
+            return false;
+        seen = frame.finished;
+        frames++;
+        if (holdFrames > 0)
+        {
+            holdFrames--;
+            return false;
+        }
+        if (!adaptive || frame.lastMs <= 0.0)
+            return false;
+
+        // only passes that ran recently tell what a change would do now
+        int best = -1;
+        double bestDelta = 0.0;
+        if (frame.lastMs > budgetMs && mayLower)
+        {
+            bestDelta = QUALITY_GOVERNOR_MIN_SAVING * budgetMs;
+            for (unsigned int i = 0; i < settings.size(); ++i)
+            {
+                const Setting &s = settings[i];
+                if (s.level == 0 || !measured(s))
+                    continue;
+                double saving = s.levelMs[s.level] - predictedMs(s, s.level - 1);
+                if (saving > bestDelta)
+                {
+                    best = i;
+                    bestDelta = saving;
+                }
+            }
+            if (best < 0)
+                return false;
+            changeLevel(best, settings[best].level - 1, "lower", frame.lastMs, bestDelta);
+            return true;
+        }
+        if (frame.lastMs < QUALITY_GOVERNOR_HEADROOM * budgetMs && mayRaise)
+        {
+            // stay in the middle of the band between the headroom and the budget
+            double room = 0.5 * (1.0 + QUALITY_GOVERNOR_HEADROOM) * budgetMs - frame.lastMs;
+            for (unsigned int i = 0; i < settings.size(); ++i)
+            {
+                const Setting &s = settings[i];
+                if (s.level + 1 == s.values.size() || !measured(s))
+                    continue;
+                double increase = predictedMs(s, s.level + 1) - s.levelMs[s.level];
+                if (increase <= room && (best < 0 || increase < bestDelta))
+                {
+                    best = i;
+                    bestDelta = increase;
+                }
+            }
+            if (best < 0)
+                return false;
+            changeLevel(best, settings[best].level + 1, "raise", frame.lastMs, bestDelta);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    std::string logPath;
+    std::ofstream log;
+    unsigned int seen; // frame measurements, like DynamicResolution
+    unsigned int frames;
+    unsigned int holdFrames;
+
+    bool measured(const Setting &s) const
+    {
+        return s.levelMs[s.level] > 0.0 && s.measuredAt + 2 * GpuTimer::RING >= frames;
+    }
+
+    double predictedMs(const Setting &s, unsigned int level) const
+    {
+        if (s.levelMs[level] > 0.0)
+            return s.levelMs[level];
+        return s.levelMs[s.level] * s.weights[level] / s.weights[s.level];
+    }
+
+    void changeLevel(unsigned int setting, unsigned int level, const std::string &action, double frameMs, double deltaMs)
+    {
+        unsigned int from = settings[setting].level;
+        double passMs = settings[setting].levelMs[from];
+        setLevel(setting, level);
+        writeLog(action, setting, from, level, frameMs, passMs, deltaMs);
+    }
+
+    // frame,frame_ms,budget_ms,action,setting,from,to,pass_ms,predicted_change_ms; opened on the first decision
+    void writeLog(const std::string &action, unsigned int setting, unsigned int from, unsigned int to,
+                  double frameMs, double passMs, double deltaMs = 0.0)
+    {
+        if (logPath.empty())
+            return;
+        if (!log.is_open())
+        {
+            log.open(logPath.c_str(), std::ios::out | std::ios::trunc);
+            if (!log)
+            {
+                std::cout << "ERROR::QUALITY_GOVERNOR::LOG_NOT_OPENED " << logPath << std::endl;
+                logPath.clear();
+                return;
+            }
+            log << "frame,frame_ms,budget_ms,action,setting,from,to,pass_ms,predicted_change_ms" << std::endl;
+        }
+        bool change = action == "lower" || action == "raise";
+        log << frames << "," << frameMs << "," << budgetMs << "," << action << ","
+            << (change ? settings[setting].name : std::string()) << ","
+            << (change ? std::to_string(settings[setting].values[from]) : std::string()) << ","
+            << (change ? std::to_string(settings[setting].values[to]) : std::string()) << ","
+            << passMs << "," << deltaMs << std::endl;
+    }
+};
+#endif
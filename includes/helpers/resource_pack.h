@@ -0,0 +1,436 @@
+#ifndef RESOURCE_PACK_H
+#define RESOURCE_PACK_H
+
+#include <stb_image.h>
+
+#include <helpers/filesystem.h>
+#include <helpers/lz4.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// where builds configured with USE_RESOURCE_PACK look for the pack the resource_pack target writes, relative to their
+// working directory bin/<chapter>
+const char *const RESOURCE_PACK_PATH = "../resources.pack";
+// entry data starts on this boundary in the file
+const size_t RESOURCE_PACK_ALIGNMENT = 16;
+// entry flag: stored as an LZ4 block
+const uint32_t RESOURCE_PACK_LZ4 = 1;
+
+struct PackEntry
+{
+    std::string name; // relative to the repository root
+    uint64_t offset; // of the stored bytes from the start of the pack
+    uint64_t storedSize;
+    uint64_t size; // once decompressed
+    uint64_t hash; // FNV-1a of the decompressed bytes
+    uint32_t flags;
+};
+
+// 64 bit FNV-1a, continued from hash
+inline unsigned long long fnv1a(const unsigned char *data, size_t size, unsigned long long hash = 14695981039346656037ull)
+{
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+namespace resource_pack_detail
+{
+// "OGLPACK1", the entry count, then per entry the name length, name, offset, stored size, size, hash and flags, then
+// the data; counts, lengths and flags are 32 bit, the rest 64 bit, all little endian
+const char MAGIC[8] = {'O', 'G', 'L', 'P', 'A', 'C', 'K', '1'};
+
+inline void put(std::vector<unsigned char> &bytes, uint64_t value, unsigned int size)
+{
+    for (unsigned int i = 0; i < size; ++i)
+        bytes.push_back((unsigned char)(value >> (8 * i)));
+}
+
+inline bool get(const unsigned char *&bytes, const unsigned char *end, uint64_t &value, unsigned int size)
+{
+    if ((size_t)(end - bytes) < size)
+        return false;
+    value = 0;
+    for (unsigned int i = 0; i < size; ++i)
+        value |= (uint64_t)bytes[i] << (8 * i);
+    bytes += size;
+    return true;
+}
+}
+
+// writes a pack of the entries; their offsets count from the start of data and become offsets into the file
+inline bool saveResourcePack(const std::string &path, std::vector<PackEntry> &entries, const std::vector<unsigned char> &data)
+{
+    using namespace resource_pack_detail;
+    size_t indexSize = sizeof(MAGIC) + 4;
+    for (const PackEntry &entry : entries)
+        indexSize += 4 + entry.name.size() + 4 * 8 + 4;
+    size_t dataStart = (indexSize + RESOURCE_PACK_ALIGNMENT - 1) / RESOURCE_PACK_ALIGNMENT * RESOURCE_PACK_ALIGNMENT;
+
+    std::vector<unsigned char> index(MAGIC, MAGIC + sizeof(MAGIC));
+    put(index, entries.size(), 4);
+    for (PackEntry &entry : entries)
+    {
+        entry.offset += dataStart;
+        put(index, entry.name.size(), 4);
+        index.insert(index.end(), entry.name.begin(), entry.name.end());
+        put(index, entry.offset, 8);
+        put(index, entry.storedSize, 8);
+        put(index, entry.size, 8);
+        put(index, entry.hash, 8);
+        put(index, entry.flags, 4);
+    }
+    index.resize(dataStart, 0);
+
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = std::fwrite(index.data(), 1, index.size(), file) == index.size()
+                   && std::fwrite(data.data(), 1, data.size(), file) == data.size();
+    std::fclose(file);
+    return written;
+}
+
+// The bytes of a resource: a view into the mapped pack when stored as is, otherwise a buffer of its own (decompressed,
+// or read from a file). Views stay valid while the pack is open, which for the global pack is the whole run.
+class Resource
+{
+public:
+    Resource() : bytes(NULL), length(0)
+    {
+    }
+
+    // moving keeps the buffer and so the pointer into it
+    Resource(Resource &&) = default;
+    Resource &operator=(Resource &&) = default;
+    Resource(const Resource &) = delete;
+    Resource &operator=(const Resource &) = delete;
+
+    const unsigned char *data() const
+    {
+        return bytes;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+    void view(const unsigned char *data, size_t size)
+    {
+        owned.clear();
+        bytes = data;
+        length = size;
+    }
+
+    unsigned char *allocate(size_t size)
+    {
+        owned.resize(size);
+        bytes = owned.data();
+        length = size;
+        return owned.data();
+    }
+
+private:
+    const unsigned char *bytes;
+    size_t length;
+    std::vector<unsigned char> owned;
+};
+
+// reads a resource front to back, like fread and fseek on its file
+class ResourceReader
+{
+public:
+    explicit ResourceReader(const Resource &resource) : position(resource.data()), end(resource.data() + resource.size())
+    {
+    }
+
+    bool read(void *destination, size_t size)
+    {
+        if ((size_t)(end - position) < size)
+            return false;
+        std::memcpy(destination, position, size);
+        position += size;
+        return true;
+    }
+
+    bool skip(size_t size)
+    {
+        if ((size_t)(end - position) < size)
+            return false;
+        position += size;
+        return true;
+    }
+
+private:
+    const unsigned char *position, *end;
+};
+
+// A pack file mapped read only, with its index by name. Entries stored as is are read in place, nothing is copied
+// until a loader asks for the bytes and the pages come in as they are touched; LZ4 entries are decompressed per read.
+// Reading is safe from any thread.
+class ResourcePack
+{
+public:
+    // an empty path opens nothing
+    explicit ResourcePack(const std::string &path) : mapping(NULL), mappingSize(0)
+    {
+        if (!path.empty() && map(path) && !readIndex())
+        {
+            std::cout << "ERROR::RESOURCE_PACK::INVALID_INDEX " << path << std::endl;
+            unmap();
+        }
+        if (mapping)
+            std::cout << "Resource pack " << path << ": " << entries.size() << " entries, " << mappingSize / 1024 << " KB" << std::endl;
+    }
+
+    ~ResourcePack()
+    {
+        unmap();
+    }
+
+    ResourcePack(const ResourcePack &) = delete;
+    ResourcePack &operator=(const ResourcePack &) = delete;
+
+    // The pack the loaders read from, opened on first use; empty without one, and everything is read from files.
+    // A pack takes precedence over the loose files, so it is opt in and an old one never hides edits while developing:
+    // the environment variable LOGL_RESOURCE_PACK names one, and deployed builds (configured with USE_RESOURCE_PACK)
+    // open RESOURCE_PACK_PATH otherwise.
+    static const ResourcePack &global()
+    {
+        static ResourcePack pack(globalPath());
+        return pack;
+    }
+
+    bool isOpen() const
+    {
+        return mapping != NULL;
+    }
+
+    // NULL when the pack has no such entry
+    const PackEntry *find(const std::string &name) const
+    {
+        auto found = entries.find(name);
+        return found == entries.end() ? NULL : &found->second;
+    }
+
+    bool read(const PackEntry &entry, Resource &resource) const
+    {
+        const unsigned char *stored = mapping + entry.offset;
+        if (!(entry.flags & RESOURCE_PACK_LZ4))
+        {
+            resource.view(stored, (size_t)entry.size);
+            return true;
+        }
+        // decompressed entries are checked against their hash, which costs little next to decompressing them
+        if (!lz4Decompress(stored, (size_t)entry.storedSize, resource.allocate((size_t)entry.size), (size_t)entry.size) ||
+            fnv1a(resource.data(), resource.size()) != entry.hash)
+        {
+            std::cout << "ERROR::RESOURCE_PACK::CORRUPT_ENTRY " << entry.name << std::endl;
+            resource.view(NULL, 0);
+            return false;
+        }
+        return true;
+    }
+
+    // reads every entry and compares its hash, prints the ones that differ; touches the whole file
+    bool verify() const
+    {
+        bool valid = true;
+        for (const auto &entry : entries)
+        {
+            Resource resource;
+            if (read(entry.second, resource) && fnv1a(resource.data(), resource.size()) == entry.second.hash)
+                continue;
+            std::cout << "ERROR::RESOURCE_PACK::HASH_MISMATCH " << entry.first << std::endl;
+            valid = false;
+        }
+        return valid;
+    }
+
+    const std::map<std::string, PackEntry> &index() const
+    {
+        return entries;
+    }
+
+private:
+    const unsigned char *mapping;
+    size_t mappingSize;
+    std::map<std::string, PackEntry> entries;
+
+    static std::string globalPath()
+    {
+        const char *path = std::getenv("LOGL_RESOURCE_PACK");
+        if (path)
+            return path;
+#ifdef USE_RESOURCE_PACK
+        return RESOURCE_PACK_PATH;
+#else
+        return std::string();
+#endif
+    }
+
+    bool map(const std::string &path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return false;
+        LARGE_INTEGER size;
+        HANDLE view = NULL;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+            view = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (view)
+        {
+            mapping = (const unsigned char *)MapViewOfFile(view, FILE_MAP_READ, 0, 0, 0);
+            mappingSize = mapping ? (size_t)size.QuadPart : 0;
+            // the view keeps the mapping alive
+            CloseHandle(view);
+        }
+#else
+        int file = ::open(path.c_str(), O_RDONLY);
+        if (file < 0)
+        {
+            // no pack is the normal case while developing
+            if (errno != ENOENT)
+                std::cout << "ERROR::RESOURCE_PACK::OPEN_FAILED " << path << std::endl;
+            return false;
+        }
+        struct stat info;
+        if (fstat(file, &info) == 0 && info.st_size > 0)
+        {
+            void *view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (view != MAP_FAILED)
+            {
+                mapping = (const unsigned char *)view;
+                mappingSize = (size_t)info.st_size;
+            }
+        }
+        // the mapping keeps the file open
+        ::close(file);
+#endif
+        if (!mapping)
+            std::cout << "ERROR::RESOURCE_PACK::MAP_FAILED " << path << std::endl;
+        return mapping != NULL;
+    }
+
+    void unmap()
+    {
+        if (!mapping)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap((void *)mapping, mappingSize);
+#endif
+        mapping = NULL;
+        mappingSize = 0;
+        entries.clear();
+    }
+
+    bool readIndex()
+    {
+        using namespace resource_pack_detail;
+        const unsigned char *position = mapping + sizeof(MAGIC), *end = mapping + mappingSize;
+        uint64_t count;
+        if (mappingSize < sizeof(MAGIC) || std::memcmp(mapping, MAGIC, sizeof(MAGIC)) != 0 || !get(position, end, count, 4))
+            return false;
+        for (uint64_t i = 0; i < count; ++i)
+        {
+            PackEntry entry;
+            uint64_t nameLength, flags;
+            if (!get(position, end, nameLength, 4) || (size_t)(end - position) < nameLength)
+                return false;
+            entry.name.assign((const char *)position, (size_t)nameLength);
+            position += nameLength;
+            if (!get(position, end, entry.offset, 8) || !get(position, end, entry.storedSize, 8) ||
+                !get(position, end, entry.size, 8) || !get(position, end, entry.hash, 8) || !get(position, end, flags, 4))
+                return false;
+            entry.flags = (uint32_t)flags;
+            if (entry.offset > mappingSize || entry.storedSize > mappingSize - entry.offset ||
+                (!(entry.flags & RESOURCE_PACK_LZ4) && entry.size != entry.storedSize))
+                return false;
+            entries[entry.name] = entry;
+        }
+        return true;
+    }
+};
+
+// the name a file is packed under, relative to the repository root: paths from FileSystem::getPath lose the root, and
+// the shaders an app opens by file name from its working directory are in src/<chapter> (LOGL_CHAPTER, set by CMake)
+inline std::string resourceName(const std::string &path)
+{
+    static const std::string root = FileSystem::getPath("");
+    if (path.compare(0, root.size(), root) == 0)
+        return path.substr(root.size());
+#ifdef LOGL_CHAPTER
+    if (path.find_first_of("/\\") == std::string::npos)
+        return std::string("src/") + LOGL_CHAPTER + "/" + path;
+#endif
+    return path;
+}
+
+// the pack holds the file, which is then never looked for on disk
+inline bool resourcePacked(const std::string &path)
+{
+    return ResourcePack::global().find(resourceName(path)) != NULL;
+}
+
+// the content of a file, from the pack when it holds it and from the disk otherwise
+inline bool readResource(const std::string &path, Resource &resource)
+{
+    const ResourcePack &pack = ResourcePack::global();
+    const PackEntry *entry = pack.find(resourceName(path));
+    if (entry)
+        return pack.read(*entry, resource);
+
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    bool read = std::fseek(file, 0, SEEK_END) == 0;
+    long size = read ? std::ftell(file) : -1;
+    read = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+    if (read)
+        read = std::fread(resource.allocate((size_t)size), 1, (size_t)size, file) == (size_t)size;
+    std::fclose(file);
+    return read;
+}
+
+// stbi_load of a packed image decodes straight from the mapping, or from its decompressed bytes
+inline unsigned char *loadImage(const std::string &path, int *width, int *height, int *components, int desiredComponents)
+{
+    const ResourcePack &pack = ResourcePack::global();
+    const PackEntry *entry = pack.find(resourceName(path));
+    if (!entry)
+        return stbi_load(path.c_str(), width, height, components, desiredComponents);
+    Resource resource;
+    if (!pack.read(*entry, resource) || resource.size() > INT_MAX)
+        return NULL;
+    return stbi_load_from_memory(resource.data(), (int)resource.size(), width, height, components, desiredComponents);
+}
+#endif
@@ -4,57 +4,31 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <helpers/resource_pack.h>
+
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <iostream>
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    // constructor generates the shader; defines (e.g. "#define SAMPLES 4\n") are inserted after the #version line of
+    // every stage, so one source compiles to several permutations
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const std::string &defines = std::string())
     {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
+        // 1. retrieve the vertex/fragment source code from the resource pack, or from the files without one
+        std::string vertexCode = readSource(vertexPath);
+        std::string fragmentCode = readSource(fragmentPath);
         std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read each file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-            // if geometry shader path is present, also load a geometry shader
-            if(geometryPath != nullptr)
-            {
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
-        }
-        catch (std::ifstream::failure e)
+        // if geometry shader path is present, also load a geometry shader
+        if(geometryPath != nullptr)
+            geometryCode = readSource(geometryPath);
+        if (!defines.empty())
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            vertexCode = insertDefines(vertexCode, defines);
+            fragmentCode = insertDefines(fragmentCode, defines);
+            geometryCode = insertDefines(geometryCode, defines);
         }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
@@ -161,6 +135,30 @@ public:
     }
 
 private:
+    // the preamble has to follow #version, which must come first
+    static std::string insertDefines(const std::string &code, const std::string &defines)
+    {
+        size_t version = code.find("#version");
+        if (version == std::string::npos)
+            return defines + code;
+        size_t lineEnd = code.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return code + "\n" + defines;
+        return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+    }
+
+    // one copy from the mapped pack or the file into the string
+    static std::string readSource(const char *path)
+    {
+        Resource source;
+        if (!readResource(path, source))
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+            return std::string();
+        }
+        return std::string((const char *)source.data(), source.size());
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     static void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,311 @@
+#ifndef SHADOW_ATLAS_H
+#define SHADOW_ATLAS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <helpers/culling.h>
+#include <helpers/lights.h>
+#include <helpers/point_shadow.h>
+#include <helpers/shader.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Omnidirectional projection of an atlas tile: six cube faces, or four wide perspective views through the faces
+// of a tetrahedron. Tetrahedral tiles need two thirds of the passes but spread the same texels over a 141 degree
+// view, so near the view centres a texel covers about three times the area. OMNI_AUTO picks tetrahedral for tiles
+// of at most tetrahedralMaxFaceSize.
+enum OmniProjection { OMNI_AUTO, OMNI_CUBE, OMNI_TETRAHEDRAL };
+
+// tangent of the half field of view of the tetrahedral views, must match TETRAHEDRAL_TAN in shadow_mapping_frag.glsl;
+// 2.83 would just cover the 70.5 degree regions, the rest is margin for filtering
+const float TETRAHEDRAL_TAN = 3.0f;
+
+// view-projection of the four tetrahedral views around lightPos
+inline std::vector<glm::mat4> tetrahedralShadowTransforms(const glm::vec3 &lightPos, float nearPlane, float farPlane)
+{
+    const glm::vec3 axes[4] = {glm::vec3(1.0f, 1.0f, 1.0f), glm::vec3(1.0f, -1.0f, -1.0f),
+                               glm::vec3(-1.0f, 1.0f, -1.0f), glm::vec3(-1.0f, -1.0f, 1.0f)};
+    glm::mat4 shadowProj = glm::perspective(2.0f * std::atan(TETRAHEDRAL_TAN), 1.0f, nearPlane, farPlane);
+    std::vector<glm::mat4> shadowTransforms;
+    for (const glm::vec3 &axis : axes)
+        shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::normalize(axis), glm::vec3(0.0f, 1.0f, 0.0f)));
+    return shadowTransforms;
+}
+
+// Shadow maps of many point lights packed into one depth texture.
+// Every light gets a tile of 3 x 2 square faces laid out in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order, tetrahedral
+// tiles use the first four. Face sizes are powers of two between minFaceSize and maxFaceSize picked from the
+// light's screen coverage; when the tiles do not fit into the budget the least important lights are demoted first. Tiles are packed as squares in a
+// faceUnits x faceUnits space that is stretched 3 x 2 to the texture. Only maxUpdatesPerFrame tiles are
+// re-rendered each frame, new and moved tiles first, then the stalest ones.
+class ShadowAtlas
+{
+public:
+    struct Tile
+    {
+        unsigned int faceSize; // 0 if the light got no tile
+        unsigned int x, y;     // in face units
+        bool valid;            // holds a rendered shadow map
+        unsigned int lastUpdate;
+        float importance;
+        glm::vec3 lightPos;
+        float farPlane;
+        OmniProjection projection; // OMNI_CUBE or OMNI_TETRAHEDRAL
+    };
+
+    unsigned int faceUnits;
+    unsigned int maxFaceSize, minFaceSize;
+    unsigned int maxUpdatesPerFrame;
+    unsigned int tetrahedralMaxFaceSize;
+    float nearPlane, maxRange;
+    unsigned int texture;
+    std::vector<Tile> tiles; // one per light passed to update()
+
+    // statistics of the last update and of the views rendered since
+    unsigned int updated;
+    unsigned int skipped;
+    unsigned int views;
+
+    ShadowAtlas(unsigned int faceUnits = 1024, unsigned int maxFaceSize = 512, unsigned int minFaceSize = 64,
+                unsigned int maxUpdatesPerFrame = 2, float maxRange = 25.0f)
+            : faceUnits(faceUnits), maxFaceSize(maxFaceSize), minFaceSize(minFaceSize), maxUpdatesPerFrame(maxUpdatesPerFrame),
+              tetrahedralMaxFaceSize(128), nearPlane(0.1f), maxRange(maxRange), updated(0), skipped(0), views(0), frame(0)
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width(), height(), 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW_ATLAS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    ~ShadowAtlas()
+    {
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteTextures(1, &texture);
+    }
+
+    ShadowAtlas(const ShadowAtlas &) = delete;
+    ShadowAtlas &operator=(const ShadowAtlas &) = delete;
+
+    unsigned int width() const
+    {
+        return 3 * faceUnits;
+    }
+
+    unsigned int height() const
+    {
+        return 2 * faceUnits;
+    }
+
+    // video memory of the depth texture, assuming 24 bit depth is padded to 32
+    unsigned long long memoryBytes() const
+    {
+        return (unsigned long long)width() * height() * 4;
+    }
+
+    // projection of one light, OMNI_AUTO by default
+    void setProjection(unsigned int light, OmniProjection projection)
+    {
+        if (requested.size() <= light)
+            requested.resize(light + 1, OMNI_AUTO);
+        requested[light] = projection;
+    }
+
+    // assigns tiles to the lights and returns the ones to re-render this frame, most urgent first
+    std::vector<unsigned int> update(const std::vector<PointLight> &lights, const glm::vec3 &viewPos,
+                                     const Frustum &viewFrustum, float fovY)
+    {
+        frame++;
+        views = 0;
+        tiles.resize(lights.size(), Tile{0, 0, 0, false, 0, 0.0f, glm::vec3(0.0f), 0.0f, OMNI_CUBE});
+        requested.resize(lights.size(), OMNI_AUTO);
+
+        // desired face size from the screen coverage of the light's shadow range
+        float tanHalfFov = std::tan(fovY * 0.5f);
+        std::vector<unsigned int> sizes(lights.size(), 0);
+        unsigned int levels = 0;
+        while ((maxFaceSize >> (levels + 1)) >= minFaceSize)
+            levels++;
+        for (unsigned int i = 0; i < lights.size(); ++i)
+        {
+            float range = shadowRange(lights[i]);
+            Tile &tile = tiles[i];
+            tile.importance = 0.0f;
+            if (!viewFrustum.intersectsSphere(lights[i].position, range))
+                continue;
+            float distance = glm::length(lights[i].position - viewPos);
+            float coverage = distance <= range ? 1.0f : std::min(1.0f, range / (distance * tanHalfFov));
+            // the distance breaks ties between lights that all fill the screen
+            tile.importance = coverage / (1.0f + distance / range);
+            unsigned int level = 0;
+            while (level < levels && coverage < 0.5f / (1u << level))
+                level++;
+            sizes[i] = maxFaceSize >> level;
+        }
+
+        // until the tiles fit, halve the least important of the largest tiles; smallest tiles are dropped
+        std::vector<unsigned int> order(lights.size());
+        for (unsigned int i = 0; i < order.size(); ++i)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) {
+            return tiles[a].importance > tiles[b].importance;
+        });
+        unsigned long long budget = (unsigned long long)faceUnits * faceUnits;
+        while (area(sizes) > budget)
+        {
+            unsigned int largest = *std::max_element(sizes.begin(), sizes.end());
+            for (unsigned int k = order.size(); k-- > 0;)
+            {
+                unsigned int i = order[k];
+                if (sizes[i] != largest)
+                    continue;
+                sizes[i] = sizes[i] > minFaceSize ? sizes[i] / 2 : 0;
+                break;
+            }
+        }
+
+        // pack the squares largest first along a Z-order curve, which keeps power of two squares aligned
+        std::vector<unsigned int> packOrder = order;
+        std::stable_sort(packOrder.begin(), packOrder.end(), [&sizes](unsigned int a, unsigned int b) {
+            return sizes[a] > sizes[b];
+        });
+        unsigned int cell = 0;
+        for (unsigned int i : packOrder)
+        {
+            Tile &tile = tiles[i];
+            unsigned int x = 0, y = 0;
+            if (sizes[i] > 0)
+            {
+                unsigned int cells = (sizes[i] / minFaceSize) * (sizes[i] / minFaceSize);
+                mortonDecode(cell, x, y);
+                x *= minFaceSize;
+                y *= minFaceSize;
+                cell += cells;
+            }
+            float range = shadowRange(lights[i]);
+            OmniProjection projection = requested[i];
+            if (projection == OMNI_AUTO)
+                projection = sizes[i] <= tetrahedralMaxFaceSize ? OMNI_TETRAHEDRAL : OMNI_CUBE;
+            if (tile.faceSize != sizes[i] || tile.x != x || tile.y != y || tile.lightPos != lights[i].position || tile.farPlane != range
+                || tile.projection != projection)
+                tile.valid = false;
+            tile.projection = projection;
+            tile.faceSize = sizes[i];
+            tile.x = x;
+            tile.y = y;
+            tile.lightPos = lights[i].position;
+            tile.farPlane = range;
+        }
+
+        // new tiles first, then the stalest weighted by importance
+        std::vector<unsigned int> candidates;
+        for (unsigned int i : order)
+            if (tiles[i].faceSize > 0)
+                candidates.push_back(i);
+        std::stable_sort(candidates.begin(), candidates.end(), [this](unsigned int a, unsigned int b) {
+            if (tiles[a].valid != tiles[b].valid)
+                return !tiles[a].valid;
+            return (frame - tiles[a].lastUpdate) * tiles[a].importance > (frame - tiles[b].lastUpdate) * tiles[b].importance;
+        });
+        if (candidates.size() > maxUpdatesPerFrame)
+        {
+            skipped = candidates.size() - maxUpdatesPerFrame;
+            candidates.resize(maxUpdatesPerFrame);
+        }
+        else
+            skipped = 0;
+        updated = candidates.size();
+        return candidates;
+    }
+
+    // renders the faces of a light's tile with shadow_mapping_face_vert.glsl, culling casters per face
+    void render(unsigned int light, const std::vector<ShadowCaster> &casters, Shader &faceShader)
+    {
+        Tile &tile = tiles[light];
+        unsigned int s = tile.faceSize;
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(3 * tile.x, 2 * tile.y, 3 * s, 2 * s);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDisable(GL_SCISSOR_TEST);
+
+        std::vector<glm::mat4> shadowTransforms = tile.projection == OMNI_TETRAHEDRAL
+                ? tetrahedralShadowTransforms(tile.lightPos, nearPlane, tile.farPlane)
+                : pointShadowTransforms(tile.lightPos, nearPlane, tile.farPlane);
+        faceShader.use();
+        faceShader.setFloat("far_plane", tile.farPlane);
+        faceShader.setVec3("lightPos", tile.lightPos);
+        for (unsigned int face = 0; face < shadowTransforms.size(); ++face)
+        {
+            glViewport(3 * tile.x + (face % 3) * s, 2 * tile.y + (face / 3) * s, s, s);
+            faceShader.setMat4("shadowMatrix", shadowTransforms[face]);
+            Frustum frustum(shadowTransforms[face]);
+            for (const ShadowCaster &caster : casters)
+            {
+                if (!frustum.intersectsBox(caster.bounds))
+                    continue;
+                faceShader.setMat4("model", caster.model);
+                caster.draw(1);
+            }
+        }
+        views += shadowTransforms.size();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        tile.valid = true;
+        tile.lastUpdate = frame;
+    }
+
+    // origin of the tile and size of one face in texture coordinates, zero size while the tile holds no shadow map
+    glm::vec4 tileTransform(unsigned int light) const
+    {
+        const Tile &tile = tiles[light];
+        if (!tile.valid || tile.faceSize == 0)
+            return glm::vec4(0.0f);
+        float units = (float)faceUnits;
+        return glm::vec4(tile.x / units, tile.y / units, tile.faceSize / (3.0f * units), tile.faceSize / (2.0f * units));
+    }
+
+    // distance the light's shadow map covers
+    float shadowRange(const PointLight &light) const
+    {
+        return std::min(light.radius, maxRange);
+    }
+
+private:
+    unsigned int FBO;
+    unsigned int frame;
+    std::vector<OmniProjection> requested;
+
+    static unsigned long long area(const std::vector<unsigned int> &sizes)
+    {
+        unsigned long long total = 0;
+        for (unsigned int size : sizes)
+            total += (unsigned long long)size * size;
+        return total;
+    }
+
+    static void mortonDecode(unsigned int code, unsigned int &x, unsigned int &y)
+    {
+        x = y = 0;
+        for (unsigned int bit = 0; bit < 16; ++bit)
+        {
+            x |= ((code >> (2 * bit)) & 1u) << bit;
+            y |= ((code >> (2 * bit + 1)) & 1u) << bit;
+        }
+    }
+};
+#endif
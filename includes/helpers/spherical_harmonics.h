@@ -0,0 +1,220 @@
+#ifndef SPHERICAL_HARMONICS_H
+#define SPHERICAL_HARMONICS_H
+
+#include <glad/glad.h>
+
+#include <helpers/ibl.h>
+#include <helpers/shader.h>
+#include <helpers/thread_pool.h>
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// Ambient light as the second order (9 coefficient) spherical harmonics of an environment's irradiance.
+// The environment is projected on the CPU, four texels per SSE2 register and rows spread over the pool; the
+// projection of every face is kept so only faces whose texels changed are projected again. The coefficients are
+// convolved with the clamped cosine, divided by pi and premultiplied by the squared basis constants, so a shader gets
+// E(n) / pi from the uniform block AmbientSH as
+//   c0 + c1 y + c2 z + c3 x + c4 xy + c5 yz + c6 (3z^2 - 1) + c7 xz + c8 (x^2 - y^2)
+// with no texture fetches.
+class ShAmbient
+{
+public:
+    glm::vec3 coefficients[9]; // as uploaded, see above
+    unsigned int projectedFaces; // faces projected by the last update
+
+    explicit ShAmbient(unsigned int bindingPoint = 1) : projectedFaces(0), binding(bindingPoint), size(0)
+    {
+        std::memset(faceSums, 0, sizeof(faceSums));
+        std::memset(faceHashes, 0, sizeof(faceHashes));
+        glGenBuffers(1, &UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, 9 * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, UBO);
+        for (int i = 0; i < 9; ++i)
+            coefficients[i] = glm::vec3(0.0f);
+    }
+
+    ~ShAmbient()
+    {
+        glDeleteBuffers(1, &UBO);
+    }
+
+    ShAmbient(const ShAmbient &) = delete;
+    ShAmbient &operator=(const ShAmbient &) = delete;
+
+    // connects the shader's AmbientSH block to the buffer
+    void bind(const Shader &shader) const
+    {
+        unsigned int index = glGetUniformBlockIndex(shader.ID, "AmbientSH");
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(shader.ID, index, binding);
+    }
+
+    // projects the faces that changed since the last call and uploads the result, returns whether anything changed
+    bool update(const CubeImage &environment, ThreadPool &pool)
+    {
+        if (environment.size != size)
+        {
+            size = environment.size;
+            buildTexels();
+            std::memset(faceHashes, 0, sizeof(faceHashes));
+        }
+        std::vector<int> changed;
+        for (int face = 0; face < 6; ++face)
+        {
+            unsigned long long hash = hashFace(environment.faces[face]);
+            if (hash != faceHashes[face])
+            {
+                faceHashes[face] = hash;
+                changed.push_back(face);
+            }
+        }
+        projectedFaces = changed.size();
+        if (changed.empty())
+            return false;
+
+        // one partial sum per row keeps the result independent of how rows are split over the threads
+        std::vector<float> rowSums(changed.size() * size * 27, 0.0f);
+        pool.parallelFor(0, changed.size() * size, [&](unsigned int begin, unsigned int end) {
+            for (unsigned int row = begin; row < end; ++row)
+                projectRow(changed[row / size], environment.faces[changed[row / size]], row % size, &rowSums[row * 27]);
+        });
+        for (size_t i = 0; i < changed.size(); ++i)
+        {
+            float *sum = faceSums[changed[i]];
+            std::memset(sum, 0, 27 * sizeof(float));
+            for (int y = 0; y < size; ++y)
+                for (int k = 0; k < 27; ++k)
+                    sum[k] += rowSums[(i * size + y) * 27 + k];
+        }
+
+        // the sums are against the bare polynomials, which the shaders evaluate again, so each takes its basis
+        // constant squared, times the clamped cosine convolution (pi, 2pi/3, pi/4 per band) / pi
+        const float K0 = 0.282095f, K1 = 0.488603f, K2 = 1.092548f, K20 = 0.315392f, K22 = 0.546274f;
+        const float scale[9] = {K0 * K0, K1 * K1 * 2.0f / 3.0f, K1 * K1 * 2.0f / 3.0f, K1 * K1 * 2.0f / 3.0f,
+                                K2 * K2 * 0.25f, K2 * K2 * 0.25f, K20 * K20 * 0.25f, K2 * K2 * 0.25f, K22 * K22 * 0.25f};
+        glm::vec4 packed[9];
+        for (int i = 0; i < 9; ++i)
+        {
+            glm::vec3 sum(0.0f);
+            for (int face = 0; face < 6; ++face)
+                sum += glm::vec3(faceSums[face][i], faceSums[face][9 + i], faceSums[face][18 + i]);
+            coefficients[i] = sum * scale[i];
+            packed[i] = glm::vec4(coefficients[i], 0.0f);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(packed), packed);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        return true;
+    }
+
+    // E(n) / pi, what the shaders compute
+    glm::vec3 irradiance(const glm::vec3 &n) const
+    {
+        return coefficients[0] + coefficients[1] * n.y + coefficients[2] * n.z + coefficients[3] * n.x
+               + coefficients[4] * (n.x * n.y) + coefficients[5] * (n.y * n.z) + coefficients[6] * (3.0f * n.z * n.z - 1.0f)
+               + coefficients[7] * (n.x * n.z) + coefficients[8] * (n.x * n.x - n.y * n.y);
+    }
+
+private:
+    unsigned int UBO;
+    unsigned int binding;
+    int size;
+    // per face: 9 red, 9 green, 9 blue projections onto the (unscaled) basis
+    float faceSums[6][27];
+    unsigned long long faceHashes[6];
+    // normalised (u, v, 1) and solid angle of every texel of a face as structure of arrays, rows padded to 4 with
+    // zero weight; projectRow maps them to the axes of each face
+    std::vector<float> texelU, texelV, texelW, texelSolidAngle;
+    int paddedRow;
+
+    static unsigned long long hashFace(const std::vector<float> &texels)
+    {
+        unsigned long long hash = 14695981039346656037ull;
+        const unsigned char *bytes = (const unsigned char *)texels.data();
+        for (size_t i = 0; i < texels.size() * sizeof(float); ++i)
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        return hash ? hash : 1;
+    }
+
+    void buildTexels()
+    {
+        paddedRow = (size + 3) & ~3;
+        texelU.assign(size * paddedRow, 0.0f);
+        texelV.assign(size * paddedRow, 0.0f);
+        texelW.assign(size * paddedRow, 0.0f);
+        texelSolidAngle.assign(size * paddedRow, 0.0f);
+        for (int y = 0; y < size; ++y)
+            for (int x = 0; x < size; ++x)
+            {
+                float u = 2.0f * (x + 0.5f) / size - 1.0f, v = 2.0f * (y + 0.5f) / size - 1.0f;
+                float length = std::sqrt(1.0f + u * u + v * v);
+                texelU[y * paddedRow + x] = u / length;
+                texelV[y * paddedRow + x] = v / length;
+                texelW[y * paddedRow + x] = 1.0f / length;
+                texelSolidAngle[y * paddedRow + x] = cubeTexelSolidAngle(x, y, size);
+            }
+    }
+
+    // adds row y of a face (RGB texels) projected onto the 9 basis functions to sums
+    void projectRow(int face, const std::vector<float> &texels, int y, float *sums) const
+    {
+        // which of u, v, w each of x, y, z is and its sign, after cubeDirection
+        static const int axes[6][3] = {{2, 1, 0}, {2, 1, 0}, {0, 2, 1}, {0, 2, 1}, {0, 1, 2}, {0, 1, 2}};
+        static const float signs[6][3] = {{1, -1, -1}, {-1, -1, 1}, {1, 1, 1}, {1, -1, -1}, {1, -1, 1}, {-1, -1, -1}};
+        const float *components[3] = {&texelU[y * paddedRow], &texelV[y * paddedRow], &texelW[y * paddedRow]};
+        const float *dx = components[axes[face][0]], *dy = components[axes[face][1]], *dz = components[axes[face][2]];
+        const float *solidAngle = &texelSolidAngle[y * paddedRow];
+        const float *row = &texels[y * size * 3];
+#ifdef IBL_SSE2
+        __m128 accumulators[27];
+        for (int k = 0; k < 27; ++k)
+            accumulators[k] = _mm_setzero_ps();
+#endif
+        for (int x0 = 0; x0 < paddedRow; x0 += 4)
+        {
+            float rgb[3][4] = {{0.0f}};
+            for (int lane = 0; lane < 4 && x0 + lane < size; ++lane)
+                for (int c = 0; c < 3; ++c)
+                    rgb[c][lane] = row[(x0 + lane) * 3 + c];
+#ifdef IBL_SSE2
+            __m128 x = _mm_mul_ps(_mm_set1_ps(signs[face][0]), _mm_loadu_ps(dx + x0));
+            __m128 yy = _mm_mul_ps(_mm_set1_ps(signs[face][1]), _mm_loadu_ps(dy + x0));
+            __m128 z = _mm_mul_ps(_mm_set1_ps(signs[face][2]), _mm_loadu_ps(dz + x0));
+            __m128 weight = _mm_loadu_ps(solidAngle + x0);
+            __m128 basis[9] = {_mm_set1_ps(1.0f), yy, z, x, _mm_mul_ps(x, yy), _mm_mul_ps(yy, z),
+                               _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(z, z)), _mm_set1_ps(1.0f)),
+                               _mm_mul_ps(x, z), _mm_sub_ps(_mm_mul_ps(x, x), _mm_mul_ps(yy, yy))};
+            for (int c = 0; c < 3; ++c)
+            {
+                __m128 radiance = _mm_mul_ps(_mm_loadu_ps(rgb[c]), weight);
+                for (int i = 0; i < 9; ++i)
+                    accumulators[c * 9 + i] = _mm_add_ps(accumulators[c * 9 + i], _mm_mul_ps(radiance, basis[i]));
+            }
+#else
+            for (int lane = 0; lane < 4; ++lane)
+            {
+                float x = signs[face][0] * dx[x0 + lane], yy = signs[face][1] * dy[x0 + lane], z = signs[face][2] * dz[x0 + lane];
+                float basis[9] = {1.0f, yy, z, x, x * yy, yy * z, 3.0f * z * z - 1.0f, x * z, x * x - yy * yy};
+                for (int c = 0; c < 3; ++c)
+                    for (int i = 0; i < 9; ++i)
+                        sums[c * 9 + i] += rgb[c][lane] * solidAngle[x0 + lane] * basis[i];
+            }
+#endif
+        }
+#ifdef IBL_SSE2
+        for (int k = 0; k < 27; ++k)
+        {
+            float lanes[4];
+            _mm_storeu_ps(lanes, accumulators[k]);
+            sums[k] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+        }
+#endif
+    }
+};
+#endif
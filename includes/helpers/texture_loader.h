@@ -0,0 +1,458 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <helpers/channel_packing.h>
+#include <helpers/dds.h>
+#include <helpers/gl_utils.h>
+#include <helpers/pixel_buffer_pool.h>
+#include <helpers/thread_pool.h>
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// texture data poll() uploads at most, so textures loaded while rendering stream in over several frames
+const size_t TEXTURE_UPLOAD_BUDGET = 8u * 1024 * 1024;
+
+// How a 2D texture is stored and sampled; a bool converts to the srgb flag
+struct TextureOptions
+{
+    bool srgb; // color data sampled as linear values
+    GLenum wrap;
+    bool mipmaps; // trilinear filtering, otherwise bilinear from the base level
+
+    TextureOptions(bool srgb = false, GLenum wrap = GL_REPEAT, bool mipmaps = true)
+        : srgb(srgb), wrap(wrap), mipmaps(mipmaps)
+    {
+    }
+};
+
+// the internal format of a decoded image with that many channels
+inline GLenum sizedInternalFormat(int components, bool srgb)
+{
+    if (components == 1)
+        return GL_R8;
+    if (components == 2)
+        return GL_RG8;
+    if (components == 3)
+        return srgb ? GL_SRGB8 : GL_RGB8;
+    return srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+}
+
+// the internal format of a cooked DXGI format
+inline GLenum cookedInternalFormat(uint32_t format, bool srgb)
+{
+    if (format == DXGI_FORMAT_BC4_UNORM)
+        return GL_COMPRESSED_RED_RGTC1;
+    if (format == DXGI_FORMAT_BC5_UNORM)
+        return GL_COMPRESSED_RG_RGTC2;
+    return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+}
+
+// Loads a batch of textures with the image decoding spread over a ThreadPool. add() and addCubemap() create the
+// texture names right away and queue the files; decoding starts at once, so the caller can compile shaders or do
+// other GL work meanwhile. poll() uploads the images decoded so far and finish() waits for and uploads the rest,
+// each in the order the decodes complete; GL is only called from the thread that calls them.
+// Decoded data goes through a PixelBufferPool: poll() maps a free buffer, a worker copies the image into it and a
+// later poll() issues the upload from the buffer, up to a budget of bytes per call, so the GL thread neither decodes
+// nor copies and waits for nothing.
+// 2D textures follow their TextureOptions; cubemaps clamp and filter linearly, without mips.
+// An image cooked by texture_cooker (a current .dds next to it) is read instead and its block compressed levels are
+// uploaded as they are, without glGenerateMipmap; BC4 maps read as grey RGB, BC5 normals leave z to the shader.
+// BC7 needs GL 4.2 or ARB_texture_compression_bptc, without it the source image is decoded.
+// addPacked() decodes up to three single channel maps and packs them into the RGB channels of one texture.
+// Textures get sized internal formats, sRGB ones GL_SRGB8(_ALPHA8), in immutable storage (glTexStorage2D) when the
+// context has GL 4.2 or ARB_texture_storage.
+class TextureBatch
+{
+public:
+    explicit TextureBatch(ThreadPool &pool)
+        : pool(pool), copying(0), uploaded(0), bptc(GLAD_GL_VERSION_4_2 || hasGlExtension("GL_ARB_texture_compression_bptc")),
+          storage(GLAD_GL_VERSION_4_2 || hasGlExtension("GL_ARB_texture_storage"))
+    {
+    }
+
+    // waits for the decodes still running, they write into this batch
+    ~TextureBatch()
+    {
+        finish();
+    }
+
+    TextureBatch(const TextureBatch &) = delete;
+    TextureBatch &operator=(const TextureBatch &) = delete;
+
+    unsigned int add(const std::string &path, const TextureOptions &options = TextureOptions())
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        queue(path, texture, GL_TEXTURE_2D, options);
+        return texture;
+    }
+
+    // channel i of the texture is the first channel of image i, missing images read as 0; a current cooked
+    // packedTexturePath(channels) is used instead. Stored as RGB8, never sRGB.
+    unsigned int addPacked(const std::vector<std::string> &channels, const TextureOptions &options = TextureOptions())
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        queue(packedTexturePath(channels), texture, GL_TEXTURE_2D, TextureOptions(false, options.wrap, options.mipmaps), channels);
+        return texture;
+    }
+
+    // six faces in GL order, +X -X +Y -Y +Z -Z
+    unsigned int addCubemap(const std::vector<std::string> &faces, bool srgb = false)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        // the first face uploaded allocates the storage of all six
+        std::shared_ptr<bool> allocated(new bool(false));
+        for (unsigned int i = 0; i < faces.size() && i < 6; ++i)
+            queue(faces[i], texture, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, TextureOptions(srgb, GL_CLAMP_TO_EDGE, false),
+                  std::vector<std::string>(), allocated);
+        return texture;
+    }
+
+    // uploads the images staged so far, up to budgetBytes of them but at least one, and stages the images decoded
+    // since in free pixel buffers; returns how many are not uploaded yet
+    unsigned int poll(size_t budgetBytes = TEXTURE_UPLOAD_BUDGET)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            waiting.insert(waiting.end(), decoded.begin(), decoded.end());
+            filled.insert(filled.end(), staged.begin(), staged.end());
+            copying -= staged.size();
+            decoded.clear();
+            staged.clear();
+        }
+        size_t sent = 0;
+        while (!filled.empty() && (sent == 0 || sent + images[filled.front()]->stagedBytes <= budgetBytes))
+        {
+            Image &image = *images[filled.front()];
+            filled.pop_front();
+            sent += image.stagedBytes;
+            upload(image);
+            uploaded++;
+        }
+        while (!waiting.empty())
+        {
+            unsigned int index = waiting.front();
+            Image &image = *images[index];
+            size_t bytes = stagingBytes(image);
+            unsigned char *data = NULL;
+            if (bytes > 0 && (image.slot = buffers.map(bytes, data)) < 0 && buffers.inFlight())
+                break;
+            waiting.pop_front();
+            if (image.slot < 0)
+            {
+                // failed to load or to map, reported either way
+                upload(image);
+                uploaded++;
+                continue;
+            }
+            image.stagedBytes = bytes;
+            copying++;
+            pool.submit([this, &image, data, index] {
+                stage(image, data);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    staged.push_back(index);
+                }
+                done.notify_one();
+            });
+        }
+        return images.size() - uploaded;
+    }
+
+    // uploads everything, waiting for the decodes still running
+    void finish()
+    {
+        while (poll(SIZE_MAX) > 0)
+        {
+            // nothing is being copied, every pixel buffer waits for its upload
+            if (copying == 0 && !waiting.empty())
+            {
+                buffers.wait();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return !decoded.empty() || !staged.empty(); });
+        }
+    }
+
+    unsigned int size() const
+    {
+        return images.size();
+    }
+
+private:
+    struct Image
+    {
+        std::string path;
+        unsigned int texture;
+        GLenum target; // GL_TEXTURE_2D or a cubemap face
+        TextureOptions options;
+        int width, height, components;
+        unsigned char *data;
+        DdsImage cooked; // used instead of data when it has a format
+        std::vector<std::string> channels; // sources of a packed image, path is its cooked asset then
+        std::vector<unsigned char> packed; // RGBA data of a packed image
+        int slot; // pixel buffer holding the data, -1 before staging
+        size_t stagedBytes; // copied into the pixel buffer, kept for the upload budget once the decoded data is freed
+        std::shared_ptr<bool> allocated; // shared by the faces of a cubemap, whether its immutable storage exists
+    };
+
+    ThreadPool &pool;
+    std::vector<std::unique_ptr<Image>> images;
+    std::vector<unsigned int> decoded; // indices into images, waiting for a pixel buffer
+    std::vector<unsigned int> staged; // copied into their pixel buffer, waiting for upload
+    std::deque<unsigned int> waiting, filled; // decoded and staged as poll() last saw them
+    unsigned int copying; // staging copies submitted and not collected by poll()
+    unsigned int uploaded;
+    PixelBufferPool buffers;
+    std::mutex mutex;
+    std::condition_variable done;
+    bool bptc; // BC7 can be uploaded
+    bool storage; // glTexStorage2D
+
+    void queue(const std::string &path, unsigned int texture, GLenum target, const TextureOptions &options,
+               const std::vector<std::string> &channels = std::vector<std::string>(),
+               const std::shared_ptr<bool> &allocated = std::shared_ptr<bool>())
+    {
+        std::unique_ptr<Image> image(new Image());
+        image->path = path;
+        image->texture = texture;
+        image->target = target;
+        image->options = options;
+        image->channels = channels;
+        image->width = image->height = image->components = 0;
+        image->data = NULL;
+        image->slot = -1;
+        image->stagedBytes = 0;
+        image->allocated = allocated;
+        Image *slot = image.get();
+        unsigned int index = images.size();
+        images.push_back(std::move(image));
+        pool.submit([this, slot, index] {
+            decode(*slot);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                decoded.push_back(index);
+            }
+            done.notify_one();
+        });
+    }
+
+    // on a worker
+    void decode(Image &image)
+    {
+        bool packed = !image.channels.empty();
+        std::string cooked = packed ? image.path : cookedTexturePath(image.path);
+        // a cooked texture in an opted in resource pack is current, the packer leaves stale ones out
+        bool current = resourcePacked(cooked);
+        if (!current && packed)
+        {
+            current = true;
+            for (const std::string &channel : image.channels)
+                current = current && cookedTextureCurrent(channel, cooked);
+        }
+        else if (!current)
+            current = cookedTextureCurrent(image.path, cooked);
+        if (current && loadDds(cooked, image.cooked) &&
+            (bptc || image.cooked.format == DXGI_FORMAT_BC4_UNORM || image.cooked.format == DXGI_FORMAT_BC5_UNORM))
+        {
+            image.width = image.cooked.width;
+            image.height = image.cooked.height;
+            return;
+        }
+        image.cooked = DdsImage();
+        if (!packed)
+        {
+            image.data = loadImage(image.path, &image.width, &image.height, &image.components, 0);
+            return;
+        }
+
+        std::vector<unsigned char *> planes(3, (unsigned char *)NULL);
+        for (unsigned int i = 0; i < image.channels.size() && i < 3; ++i)
+        {
+            int width, height, components;
+            planes[i] = loadImage(image.channels[i], &width, &height, &components, 1);
+            if (!planes[i])
+                std::cout << "Texture failed to load at path: " << image.channels[i] << std::endl;
+            else if (image.width == 0)
+            {
+                image.width = width;
+                image.height = height;
+            }
+            else if (width != image.width || height != image.height)
+            {
+                std::cout << "ERROR::TEXTURE_BATCH::PACKED_SIZE_MISMATCH " << image.channels[i] << std::endl;
+                stbi_image_free(planes[i]);
+                planes[i] = NULL;
+            }
+        }
+        if (image.width > 0)
+        {
+            size_t texels = (size_t)image.width * image.height;
+            std::vector<unsigned char> zero;
+            for (unsigned char *&plane : planes)
+                if (!plane)
+                {
+                    zero.resize(texels, 0);
+                    plane = zero.data();
+                }
+            image.packed.resize(4 * texels);
+            interleaveChannels(planes[0], planes[1], planes[2], image.packed.data(), texels);
+            image.components = 4;
+            image.data = image.packed.data();
+            for (unsigned char *plane : planes)
+                if (zero.empty() || plane != zero.data())
+                    stbi_image_free(plane);
+        }
+    }
+
+    void upload(Image &image)
+    {
+        const DdsImage &dds = image.cooked;
+        if (!dds.format && !image.data && image.slot < 0)
+        {
+            std::cout << (image.target == GL_TEXTURE_2D ? "Texture" : "Cubemap texture") << " failed to load at path: " << image.path << std::endl;
+            return;
+        }
+        const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+        GLenum format = formats[std::min(std::max(image.components, 1), 4) - 1];
+        GLenum internalFormat = dds.format ? cookedInternalFormat(dds.format, image.options.srgb)
+                                : !image.channels.empty() ? GL_RGB8 // packed maps have no alpha
+                                : sizedInternalFormat(image.components, image.options.srgb);
+
+        bool mipmaps = image.target == GL_TEXTURE_2D && image.options.mipmaps;
+        unsigned int levels = dds.format ? uploadLevels(image) : mipmaps ? mipLevels(image.width, image.height) : 1;
+        GLenum bindTarget = image.target == GL_TEXTURE_2D ? GL_TEXTURE_2D : GL_TEXTURE_CUBE_MAP;
+        glBindTexture(bindTarget, image.texture);
+        // immutable storage for every level at once, for a cubemap with its first face
+        if (storage && (bindTarget == GL_TEXTURE_2D || !*image.allocated))
+        {
+            glTexStorage2D(bindTarget, levels, internalFormat, image.width, image.height);
+            if (image.allocated)
+                *image.allocated = true;
+        }
+        // from the pixel buffer the data is staged in, pointers become offsets into it
+        if (image.slot >= 0)
+            buffers.bind(image.slot);
+        if (dds.format)
+        {
+            size_t offset = 0;
+            for (unsigned int level = 0; level < levels; ++level)
+            {
+                int width = DdsImage::levelSize(dds.width, level), height = DdsImage::levelSize(dds.height, level);
+                const std::vector<unsigned char> &blocks = dds.levels[level];
+                const void *data = image.slot >= 0 ? (const void *)offset : blocks.data();
+                if (storage)
+                    glCompressedTexSubImage2D(image.target, level, 0, 0, width, height, internalFormat, blocks.size(), data);
+                else
+                    glCompressedTexImage2D(image.target, level, internalFormat, width, height, 0, blocks.size(), data);
+                offset += blocks.size();
+            }
+            image.cooked = DdsImage();
+        }
+        else
+        {
+            const void *data = image.slot >= 0 ? NULL : image.data;
+            // rows of 1 and 3 channel images are not 4 byte aligned in general
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            if (storage)
+                glTexSubImage2D(image.target, 0, 0, 0, image.width, image.height, format, GL_UNSIGNED_BYTE, data);
+            else
+                glTexImage2D(image.target, 0, internalFormat, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, data);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            if (mipmaps)
+                glGenerateMipmap(GL_TEXTURE_2D);
+            freeDecoded(image);
+        }
+        if (image.slot >= 0)
+            buffers.release(image.slot);
+        image.slot = -1;
+        if (bindTarget != GL_TEXTURE_2D)
+            return;
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        if (internalFormat == GL_COMPRESSED_RED_RGTC1)
+        {
+            // like the grey RGB image it was cooked from
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+        }
+        // the state TextureManager's shared samplers hold, for binding without one
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, image.options.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, image.options.wrap);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    // on a worker: copies what upload() reads into the mapped pixel buffer
+    void stage(Image &image, unsigned char *buffer)
+    {
+        if (image.cooked.format)
+        {
+            for (unsigned int level = 0; level < uploadLevels(image); ++level)
+            {
+                std::memcpy(buffer, image.cooked.levels[level].data(), image.cooked.levels[level].size());
+                buffer += image.cooked.levels[level].size();
+            }
+            return;
+        }
+        std::memcpy(buffer, image.data, image.stagedBytes);
+        freeDecoded(image);
+    }
+
+    // bytes upload() reads, 0 when the image failed to load
+    static size_t stagingBytes(const Image &image)
+    {
+        if (!image.cooked.format)
+            return image.data ? (size_t)image.width * image.height * image.components : 0;
+        size_t bytes = 0;
+        for (unsigned int level = 0; level < uploadLevels(image); ++level)
+            bytes += image.cooked.levels[level].size();
+        return bytes;
+    }
+
+    // cooked levels uploaded, cubemap faces have no mips
+    static unsigned int uploadLevels(const Image &image)
+    {
+        return image.target == GL_TEXTURE_2D && image.options.mipmaps ? image.cooked.levels.size() : 1;
+    }
+
+    static void freeDecoded(Image &image)
+    {
+        if (image.packed.empty())
+            stbi_image_free(image.data);
+        else
+            std::vector<unsigned char>().swap(image.packed);
+        image.data = NULL;
+    }
+
+    // the full chain down to 1x1
+    static unsigned int mipLevels(int width, int height)
+    {
+        unsigned int levels = 1;
+        while ((width | height) >> levels)
+            levels++;
+        return levels;
+    }
+};
+#endif
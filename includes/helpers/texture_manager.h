@@ -0,0 +1,306 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <glad/glad.h>
+
+#include <helpers/texture_loader.h>
+#include <helpers/thread_pool.h>
+
+#include <climits>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// unused textures stay cached until the resident ones pass this
+const size_t TEXTURE_MANAGER_BUDGET = 256u * 1024 * 1024;
+
+struct ManagedTexture
+{
+    unsigned int id;
+    GLenum target; // GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+    std::string key;
+    size_t bytes; // every level and face, as stored by the driver; 0 until uploaded
+    unsigned int sampler; // shared by the textures loaded with the same options
+};
+
+// shared by everyone who loaded the same file with the same options, the texture lives at least as long
+typedef std::shared_ptr<const ManagedTexture> TextureHandle;
+
+// binds the texture and its sampler to a texture unit
+inline void bindTexture(unsigned int unit, const TextureHandle &texture)
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(texture->target, texture->id);
+    glBindSampler(unit, texture->sampler);
+}
+
+// units bound with bindTexture go back to the filtering of the textures themselves, for code that binds without one
+inline void unbindSamplers(unsigned int first, unsigned int count)
+{
+    for (unsigned int unit = first; unit < first + count; ++unit)
+        glBindSampler(unit, 0);
+}
+
+// Textures shared by canonical path and options. load() returns the cached texture when there is one, otherwise it
+// queues the file on a TextureBatch, so new textures still decode on the pool and upload in poll() or finish().
+// A texture nobody holds a handle to stays cached for the next load() until the resident textures pass the budget;
+// then the least recently requested unused ones are deleted. Textures in use are never evicted, they may exceed it.
+// Filtering and wrapping live in one sampler object per distinct options rather than in every texture; bind with
+// bindTexture() and reset the units with unbindSamplers() before binding textures the manager does not own.
+class TextureManager
+{
+public:
+    explicit TextureManager(ThreadPool &pool, size_t budgetBytes = TEXTURE_MANAGER_BUDGET)
+        : budgetBytes(budgetBytes), batch(pool), requests(0), resident(0)
+    {
+    }
+
+    // handles must not outlive the manager
+    ~TextureManager()
+    {
+        batch.finish();
+        for (auto &entry : entries)
+            glDeleteTextures(1, &entry.second.texture->id);
+        for (auto &sampler : samplers)
+            glDeleteSamplers(1, &sampler.second);
+    }
+
+    TextureManager(const TextureManager &) = delete;
+    TextureManager &operator=(const TextureManager &) = delete;
+
+    TextureHandle load(const std::string &path, const TextureOptions &options = TextureOptions())
+    {
+        std::string key = canonicalPath(path) + optionsKey(options, GL_TEXTURE_2D);
+        auto found = entries.find(key);
+        if (found != entries.end())
+            return use(found->second);
+        return insert(key, GL_TEXTURE_2D, batch.add(path, options), options);
+    }
+
+    // single channel maps packed into R, G and B of one texture, see TextureBatch::addPacked
+    TextureHandle loadPacked(const std::vector<std::string> &channels, const TextureOptions &options = TextureOptions())
+    {
+        std::string key;
+        for (const std::string &channel : channels)
+            key += canonicalPath(channel) + ";";
+        key += optionsKey(TextureOptions(false, options.wrap, options.mipmaps), GL_TEXTURE_2D) + ",packed";
+        auto found = entries.find(key);
+        if (found != entries.end())
+            return use(found->second);
+        return insert(key, GL_TEXTURE_2D, batch.addPacked(channels, options), options);
+    }
+
+    // six faces in GL order, +X -X +Y -Y +Z -Z; cubemaps only use the srgb option
+    TextureHandle loadCubemap(const std::vector<std::string> &faces, const TextureOptions &options = TextureOptions())
+    {
+        std::string key;
+        for (const std::string &face : faces)
+            key += canonicalPath(face) + ";";
+        TextureOptions cubemap(options.srgb, GL_CLAMP_TO_EDGE, false);
+        key += optionsKey(cubemap, GL_TEXTURE_CUBE_MAP);
+        auto found = entries.find(key);
+        if (found != entries.end())
+            return use(found->second);
+        return insert(key, GL_TEXTURE_CUBE_MAP, batch.addCubemap(faces, options.srgb), cubemap);
+    }
+
+    // uploads up to budgetBytes of the images decoded so far, returns how many are not uploaded yet
+    unsigned int poll(size_t budgetBytes = TEXTURE_UPLOAD_BUDGET)
+    {
+        unsigned int loading = batch.poll(budgetBytes);
+        if (loading == 0)
+            measure();
+        return loading;
+    }
+
+    // uploads everything still loading
+    void finish()
+    {
+        batch.finish();
+        measure();
+    }
+
+    // evicts unused textures while over budget, least recently requested first
+    void trim()
+    {
+        while (resident > budgetBytes)
+        {
+            auto oldest = entries.end();
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                const Entry &entry = it->second;
+                // only the manager holds it, and no decode will upload into it any more
+                if (entry.texture.use_count() == 1 && entry.measured &&
+                    (oldest == entries.end() || entry.lastUse < oldest->second.lastUse))
+                    oldest = it;
+            }
+            if (oldest == entries.end())
+                return;
+            resident -= oldest->second.texture->bytes;
+            glDeleteTextures(1, &oldest->second.texture->id);
+            entries.erase(oldest);
+        }
+    }
+
+    size_t residentBytes() const
+    {
+        return resident;
+    }
+
+    // distinct textures, cached ones included
+    unsigned int size() const
+    {
+        return entries.size();
+    }
+
+    // images queued for decoding so far, cubemap faces counted separately
+    unsigned int decodedImages() const
+    {
+        return batch.size();
+    }
+
+    // one line per texture: resident size, handles held outside the manager, key
+    void report(std::ostream &out) const
+    {
+        out << "Textures: " << entries.size() << ", " << std::fixed << std::setprecision(1)
+            << resident / (1024.0 * 1024.0) << " of " << budgetBytes / (1024.0 * 1024.0) << " MB resident" << std::endl;
+        for (const auto &entry : entries)
+            out << std::setw(10) << entry.second.texture->bytes / 1024.0 << " KB  refs " << entry.second.texture.use_count() - 1
+                << "  " << entry.first << std::endl;
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6);
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<ManagedTexture> texture;
+        unsigned long long lastUse; // request count at the last load()
+        bool measured; // uploaded, bytes is known
+    };
+
+    size_t budgetBytes;
+    TextureBatch batch;
+    std::map<std::string, Entry> entries;
+    std::map<std::string, unsigned int> samplers; // by wrap and filtering
+    unsigned long long requests;
+    size_t resident;
+
+    TextureHandle use(Entry &entry)
+    {
+        entry.lastUse = ++requests;
+        return entry.texture;
+    }
+
+    TextureHandle insert(const std::string &key, GLenum target, unsigned int id, const TextureOptions &options)
+    {
+        Entry &entry = entries[key];
+        entry.texture = std::make_shared<ManagedTexture>();
+        entry.texture->id = id;
+        entry.texture->target = target;
+        entry.texture->key = key;
+        entry.texture->bytes = 0;
+        entry.texture->sampler = sampler(options);
+        entry.measured = false;
+        TextureHandle handle = use(entry);
+        trim();
+        return handle;
+    }
+
+    // sRGB decoding is part of the texture format, the sampler only filters and wraps
+    unsigned int sampler(const TextureOptions &options)
+    {
+        std::string key = optionsKey(TextureOptions(false, options.wrap, options.mipmaps), GL_TEXTURE_2D);
+        auto found = samplers.find(key);
+        if (found != samplers.end())
+            return found->second;
+        unsigned int sampler;
+        glGenSamplers(1, &sampler);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, options.wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, options.wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_WRAP_R, options.wrap);
+        glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, options.mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        samplers[key] = sampler;
+        return sampler;
+    }
+
+    // sizes of the textures uploaded since the last call, as the driver reports them
+    void measure()
+    {
+        for (auto &entry : entries)
+        {
+            if (entry.second.measured)
+                continue;
+            entry.second.measured = true;
+            entry.second.texture->bytes = storedBytes(*entry.second.texture);
+            resident += entry.second.texture->bytes;
+        }
+        trim();
+    }
+
+    static size_t storedBytes(const ManagedTexture &texture)
+    {
+        GLenum face = texture.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X : GL_TEXTURE_2D;
+        glBindTexture(texture.target, texture.id);
+        size_t bytes = 0;
+        for (int level = 0;; ++level)
+        {
+            GLint width = 0, height = 0, compressed = GL_FALSE;
+            glGetTexLevelParameteriv(face, level, GL_TEXTURE_WIDTH, &width);
+            glGetTexLevelParameteriv(face, level, GL_TEXTURE_HEIGHT, &height);
+            if (width == 0 || height == 0)
+                break;
+            glGetTexLevelParameteriv(face, level, GL_TEXTURE_COMPRESSED, &compressed);
+            if (compressed)
+            {
+                GLint size = 0;
+                glGetTexLevelParameteriv(face, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+                bytes += size;
+                continue;
+            }
+            GLint bits = 0;
+            const GLenum channels[] = {GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE,
+                                       GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_DEPTH_SIZE};
+            for (GLenum channel : channels)
+            {
+                GLint channelBits = 0;
+                glGetTexLevelParameteriv(face, level, channel, &channelBits);
+                bits += channelBits;
+            }
+            bytes += (size_t)width * height * bits / 8;
+        }
+        return texture.target == GL_TEXTURE_CUBE_MAP ? 6 * bytes : bytes;
+    }
+
+    static std::string optionsKey(const TextureOptions &options, GLenum target)
+    {
+        return std::string("|") + (target == GL_TEXTURE_CUBE_MAP ? "cube" : "2d") + (options.srgb ? ",srgb" : ",linear") +
+               (options.wrap == GL_REPEAT ? ",repeat" : options.wrap == GL_MIRRORED_REPEAT ? ",mirror" : ",clamp") +
+               (options.mipmaps ? ",mips" : "");
+    }
+
+    // the same file reached by different relative paths shares one texture; missing files keep their path
+    static std::string canonicalPath(const std::string &path)
+    {
+#ifdef _WIN32
+        char resolved[_MAX_PATH];
+        if (_fullpath(resolved, path.c_str(), _MAX_PATH))
+            return resolved;
+#else
+        char *resolved = realpath(path.c_str(), NULL);
+        if (resolved)
+        {
+            std::string canonical(resolved);
+            free(resolved);
+            return canonical;
+        }
+#endif
+        return path;
+    }
+};
+#endif
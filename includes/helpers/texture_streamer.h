@@ -0,0 +1,515 @@
+#ifndef TEXTURE_STREAMER_H
+#define TEXTURE_STREAMER_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <helpers/block_compression.h>
+#include <helpers/channel_packing.h>
+#include <helpers/dds.h>
+#include <helpers/texture_loader.h>
+#include <helpers/texture_manager.h>
+#include <helpers/thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// resident levels of all streamed textures; the finest levels requested least are left out to stay below it
+const size_t TEXTURE_STREAMING_BUDGET = 24u * 1024 * 1024;
+// levels no larger than this are loaded up front and never evicted
+const int TEXTURE_STREAMING_TAIL_SIZE = 128;
+// frames a finer level stays resident after the last frame that needed it, unless the budget needs the memory
+const unsigned int TEXTURE_STREAMING_LINGER_FRAMES = 120;
+
+// pixels one world unit covers on screen facing the camera at that distance
+inline float screenPixelsPerUnit(float distance, float fovY, int viewportHeight)
+{
+    return viewportHeight / (2.0f * distance * std::tan(0.5f * fovY));
+}
+
+// 2D textures whose finer mip levels are only resident while the screen needs them. load() queues the coarse tail of
+// the mip chain on the pool; every frame the draws tell require() how densely they map the texture onto the screen,
+// and update() streams the levels needed in and evicts the rest, finest first, within a budget. The finest resident
+// level is GL_TEXTURE_BASE_LEVEL: the levels are defined one by one in a mutable texture and evicted ones are
+// redefined empty, so only resident levels take memory.
+// A cooked .dds is read from its finest needed level on. Otherwise the source image is decoded again and its mip
+// chain built on the worker for every load, so streaming from cooked textures is far cheaper.
+class TextureStreamer
+{
+public:
+    explicit TextureStreamer(ThreadPool &pool, size_t budgetBytes = TEXTURE_STREAMING_BUDGET)
+        : pool(pool), budgetBytes(budgetBytes), bptc(GLAD_GL_VERSION_4_2 || hasGlExtension("GL_ARB_texture_compression_bptc")),
+          loading(0), resident(0), streamedIn(0), evicted(0)
+    {
+    }
+
+    // handles must not outlive the streamer
+    ~TextureStreamer()
+    {
+        finish();
+        for (const Streamed &texture : textures)
+            glDeleteTextures(1, &texture.texture->id);
+    }
+
+    TextureStreamer(const TextureStreamer &) = delete;
+    TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+    // the texture has no levels until its tail is uploaded by update() or finish()
+    TextureHandle load(const std::string &path, const TextureOptions &options = TextureOptions())
+    {
+        return add(path, std::vector<std::string>(), options);
+    }
+
+    // single channel maps packed into R, G and B of one texture, see TextureBatch::addPacked
+    TextureHandle loadPacked(const std::vector<std::string> &channels, const TextureOptions &options = TextureOptions())
+    {
+        return add(packedTexturePath(channels), channels, TextureOptions(false, options.wrap, options.mipmaps));
+    }
+
+    // a draw maps uvPerUnit texture repeats onto every world unit of its surface, which covers pixelsPerUnit pixels
+    void require(const TextureHandle &handle, float uvPerUnit, float pixelsPerUnit)
+    {
+        auto found = indices.find(handle->id);
+        if (found == indices.end() || textures[found->second].levels == 0)
+            return;
+        Streamed &texture = textures[found->second];
+        // the finest level whose texels are still no smaller than a pixel
+        float texelsPerPixel = std::max(texture.width, texture.height) * uvPerUnit / std::max(pixelsPerUnit, 1e-6f);
+        unsigned int level = texelsPerPixel <= 1.0f ? 0 : (unsigned int)std::floor(std::log2(texelsPerPixel));
+        texture.required = std::min(texture.required, std::min(level, texture.levels - 1));
+    }
+
+    // once a frame after the draws: uploads the loads that finished, up to TEXTURE_UPLOAD_BUDGET, then picks the
+    // levels to keep from this frame's requirements and starts the loads and evictions that gets there
+    void update()
+    {
+        collect();
+        size_t sent = 0;
+        while (!arrived.empty() && (sent == 0 || sent + arrived.front()->bytes <= TEXTURE_UPLOAD_BUDGET))
+        {
+            sent += arrived.front()->bytes;
+            apply(*arrived.front());
+            arrived.pop_front();
+        }
+
+        // the required levels, coarsened largest level first while they do not fit
+        std::vector<unsigned int> targets(textures.size());
+        size_t wanted = 0;
+        for (unsigned int i = 0; i < textures.size(); ++i)
+        {
+            targets[i] = std::max(std::min(textures[i].required, textures[i].tail), textures[i].finest);
+            wanted += rangeBytes(textures[i], targets[i], textures[i].levels);
+        }
+        while (wanted > budgetBytes)
+        {
+            int largest = -1;
+            for (unsigned int i = 0; i < textures.size(); ++i)
+                if (targets[i] < textures[i].tail &&
+                    (largest < 0 || levelBytes(textures[i], targets[i]) > levelBytes(textures[largest], targets[largest])))
+                    largest = i;
+            if (largest < 0)
+                break;
+            wanted -= levelBytes(textures[largest], targets[largest]);
+            targets[largest]++;
+        }
+
+        size_t incoming = 0;
+        for (unsigned int i = 0; i < textures.size(); ++i)
+            if (targets[i] < textures[i].resident)
+                incoming += rangeBytes(textures[i], targets[i], textures[i].resident);
+        bool pressure = resident + incoming > budgetBytes;
+        for (unsigned int i = 0; i < textures.size(); ++i)
+        {
+            Streamed &texture = textures[i];
+            texture.lastRequired = texture.required;
+            texture.required = texture.levels;
+            if (texture.levels == 0 || texture.loading)
+                continue;
+            if (targets[i] > texture.resident)
+            {
+                if (++texture.idleFrames >= TEXTURE_STREAMING_LINGER_FRAMES || pressure)
+                    evict(texture, targets[i]);
+                continue;
+            }
+            texture.idleFrames = 0;
+            if (targets[i] < texture.resident)
+                submit(i, targets[i], texture.resident - 1);
+        }
+    }
+
+    // uploads every load in flight, waiting for them; after the loads, the tails of all textures are resident
+    void finish()
+    {
+        for (;;)
+        {
+            collect();
+            while (!arrived.empty())
+            {
+                apply(*arrived.front());
+                arrived.pop_front();
+            }
+            if (loading == 0)
+                return;
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return !finished.empty(); });
+        }
+    }
+
+    size_t residentBytes() const
+    {
+        return resident;
+    }
+
+    size_t budget() const
+    {
+        return budgetBytes;
+    }
+
+    unsigned int size() const
+    {
+        return textures.size();
+    }
+
+    // totals, then one line per texture: resident size, finest resident level of the chain, level required last
+    void report(std::ostream &out) const
+    {
+        out << "Texture streaming: " << textures.size() << " textures, " << std::fixed << std::setprecision(1)
+            << resident / (1024.0 * 1024.0) << " of " << budgetBytes / (1024.0 * 1024.0) << " MB resident, "
+            << streamedIn / (1024.0 * 1024.0) << " MB streamed in, " << evicted / (1024.0 * 1024.0) << " MB evicted, "
+            << loading << " loads in flight" << std::endl;
+        for (const Streamed &texture : textures)
+        {
+            out << std::setw(10) << texture.texture->bytes / 1024.0 << " KB  ";
+            if (texture.levels == 0)
+                out << "not loaded";
+            else
+                out << texture.width << "x" << texture.height << " from level " << texture.resident << " of "
+                    << texture.levels << ", tail " << texture.tail << ", required " << texture.lastRequired;
+            out << "  " << texture.texture->key << std::endl;
+        }
+        out.unsetf(std::ios::floatfield);
+        out << std::setprecision(6);
+    }
+
+private:
+    struct Streamed
+    {
+        std::shared_ptr<ManagedTexture> texture;
+        std::string path; // the source, or the cooked asset of packed channels
+        std::vector<std::string> channels;
+        TextureOptions options;
+        // known once the tail is uploaded
+        uint32_t cooked; // DXGI format of the .dds the levels come from, 0 when decoded from the source
+        GLenum internalFormat;
+        int width, height, texelBytes;
+        unsigned int levels; // 0 until the tail is uploaded
+        unsigned int tail; // first level of the tail
+        unsigned int resident; // finest resident level, the base level
+        unsigned int required; // finest level required this frame, levels when none
+        unsigned int lastRequired; // required last frame, for the report
+        unsigned int finest; // finest level that loads, raised when a load fails
+        unsigned int idleFrames; // since a level finer than required was last needed
+        bool loading;
+    };
+
+    // levels first to last of one texture, decoded on a worker
+    struct Load
+    {
+        unsigned int index;
+        unsigned int first, last; // the tail when levels is 0
+        std::string path;
+        std::vector<std::string> channels;
+        TextureOptions options;
+        uint32_t cooked; // the format to read, 0 to decode the source; any when loading the tail
+        bool tail;
+        DdsImage image; // levels first to last, the others empty; format 0 for RGBA8 decoded from the source
+        int components;
+        size_t bytes; // uploaded by apply()
+    };
+
+    ThreadPool &pool;
+    size_t budgetBytes;
+    bool bptc; // BC7 can be uploaded
+    std::vector<Streamed> textures;
+    std::map<unsigned int, unsigned int> indices; // by texture name
+    std::vector<std::shared_ptr<Load>> finished; // by the workers, under mutex
+    std::deque<std::shared_ptr<Load>> arrived; // finished, waiting for upload
+    unsigned int loading; // submitted and not collected
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t resident, streamedIn, evicted;
+
+    TextureHandle add(const std::string &path, const std::vector<std::string> &channels, const TextureOptions &options)
+    {
+        Streamed texture;
+        texture.texture = std::make_shared<ManagedTexture>();
+        glGenTextures(1, &texture.texture->id);
+        texture.texture->target = GL_TEXTURE_2D;
+        texture.texture->bytes = 0;
+        texture.texture->sampler = 0; // filtering and wrapping are set on the texture
+        texture.texture->key = path;
+        if (!channels.empty())
+        {
+            texture.texture->key.clear();
+            for (const std::string &channel : channels)
+                texture.texture->key += channel + ";";
+        }
+        texture.path = path;
+        texture.channels = channels;
+        texture.options = options;
+        texture.cooked = 0;
+        texture.internalFormat = 0;
+        texture.width = texture.height = texture.texelBytes = 0;
+        texture.levels = texture.tail = texture.resident = texture.required = texture.lastRequired = texture.finest = 0;
+        texture.idleFrames = 0;
+        texture.loading = false;
+        indices[texture.texture->id] = textures.size();
+        textures.push_back(texture);
+        submit(textures.size() - 1, 0, 0);
+        return texture.texture;
+    }
+
+    void submit(unsigned int index, unsigned int first, unsigned int last)
+    {
+        Streamed &texture = textures[index];
+        std::shared_ptr<Load> load = std::make_shared<Load>();
+        load->index = index;
+        load->first = first;
+        load->last = last;
+        load->path = texture.path;
+        load->channels = texture.channels;
+        load->options = texture.options;
+        load->cooked = texture.cooked;
+        load->tail = texture.levels == 0;
+        load->components = 0;
+        load->bytes = 0;
+        texture.loading = true;
+        loading++;
+        pool.submit([this, load] {
+            decode(*load);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back(load);
+            }
+            done.notify_one();
+        });
+    }
+
+    void collect()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        arrived.insert(arrived.end(), finished.begin(), finished.end());
+        loading -= finished.size();
+        finished.clear();
+    }
+
+    // on a worker
+    void decode(Load &load)
+    {
+        bool packed = !load.channels.empty();
+        std::string cookedPath = packed ? load.path : cookedTexturePath(load.path);
+        bool current = load.tail || load.cooked != 0;
+        // a cooked texture in an opted in resource pack is current, the packer leaves stale ones out
+        if (current && !resourcePacked(cookedPath))
+        {
+            if (packed)
+                for (const std::string &channel : load.channels)
+                    current = current && cookedTextureCurrent(channel, cookedPath);
+            else
+                current = cookedTextureCurrent(load.path, cookedPath);
+        }
+        if (current && loadDds(cookedPath, load.image, load.tail ? 0 : load.first) &&
+            (load.tail ? bptc || (load.image.format != DXGI_FORMAT_BC7_UNORM && load.image.format != DXGI_FORMAT_BC7_UNORM_SRGB)
+                       : load.image.format == load.cooked))
+        {
+            finishDecode(load);
+            return;
+        }
+        load.image = DdsImage();
+        if (!load.tail && load.cooked != 0)
+        {
+            std::cout << "ERROR::TEXTURE_STREAMER::COOKED_TEXTURE_CHANGED " << cookedPath << std::endl;
+            return;
+        }
+
+        int width = 0, height = 0;
+        unsigned char *rgba = NULL;
+        std::vector<unsigned char> interleaved;
+        if (!packed)
+        {
+            rgba = loadImage(load.path, &width, &height, &load.components, 4);
+            // grey and alpha is expanded to RGBA, not kept as red and green
+            if (load.components == 2)
+                load.components = 4;
+        }
+        else
+        {
+            unsigned char *planes[3] = {NULL, NULL, NULL};
+            for (unsigned int i = 0; i < load.channels.size() && i < 3; ++i)
+            {
+                int w, h, components;
+                planes[i] = loadImage(load.channels[i], &w, &h, &components, 1);
+                if (planes[i] && width == 0)
+                {
+                    width = w;
+                    height = h;
+                }
+                else if (planes[i] && (w != width || h != height))
+                {
+                    std::cout << "ERROR::TEXTURE_STREAMER::PACKED_SIZE_MISMATCH " << load.channels[i] << std::endl;
+                    stbi_image_free(planes[i]);
+                    planes[i] = NULL;
+                }
+            }
+            if (width > 0)
+            {
+                std::vector<unsigned char> zero((size_t)width * height, 0);
+                interleaved.resize(4 * (size_t)width * height);
+                interleaveChannels(planes[0] ? planes[0] : zero.data(), planes[1] ? planes[1] : zero.data(),
+                                   planes[2] ? planes[2] : zero.data(), interleaved.data(), (size_t)width * height);
+                rgba = interleaved.data();
+                load.components = 3;
+            }
+            for (unsigned char *plane : planes)
+                if (plane)
+                    stbi_image_free(plane);
+        }
+        if (!rgba)
+        {
+            std::cout << "Texture failed to load at path: " << load.path << std::endl;
+            return;
+        }
+        load.image.width = width;
+        load.image.height = height;
+        load.image.levels = buildMipChain(rgba, width, height, load.options.srgb ? MIP_SRGB : MIP_LINEAR);
+        if (!packed)
+            stbi_image_free(rgba);
+        finishDecode(load);
+    }
+
+    // picks the tail of a first load and drops the levels not asked for
+    static void finishDecode(Load &load)
+    {
+        unsigned int levels = load.options.mipmaps ? load.image.levels.size() : 1;
+        if (load.tail)
+        {
+            load.first = 0;
+            while (load.first + 1 < levels && std::max(DdsImage::levelSize(load.image.width, load.first),
+                                                       DdsImage::levelSize(load.image.height, load.first)) > TEXTURE_STREAMING_TAIL_SIZE)
+                load.first++;
+            load.last = levels - 1;
+        }
+        load.last = std::min(load.last, levels - 1);
+        for (unsigned int level = 0; level < load.image.levels.size(); ++level)
+            if (level < load.first || level > load.last)
+                std::vector<unsigned char>().swap(load.image.levels[level]);
+            else
+                load.bytes += load.image.levels[level].size();
+        load.image.levels.resize(levels);
+    }
+
+    // the levels of a load become resident and the new base level
+    void apply(const Load &load)
+    {
+        Streamed &texture = textures[load.index];
+        texture.loading = false;
+        if (load.image.levels.empty())
+        {
+            // reported by the worker, not tried again
+            texture.finest = std::max(texture.finest, texture.resident);
+            return;
+        }
+        glBindTexture(GL_TEXTURE_2D, texture.texture->id);
+        if (load.tail)
+        {
+            texture.cooked = load.image.format;
+            texture.internalFormat = texture.cooked ? cookedInternalFormat(texture.cooked, texture.options.srgb)
+                                     : !texture.channels.empty() ? GL_RGB8 // packed maps have no alpha
+                                     : sizedInternalFormat(load.components, texture.options.srgb);
+            texture.texelBytes = texture.channels.empty() ? load.components : 3;
+            texture.width = load.image.width;
+            texture.height = load.image.height;
+            texture.levels = load.image.levels.size();
+            texture.tail = load.first;
+            texture.resident = texture.required = texture.lastRequired = texture.levels;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels - 1);
+            if (texture.internalFormat == GL_COMPRESSED_RED_RGTC1)
+            {
+                // like the grey RGB image it was cooked from
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, GL_RED);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, GL_RED);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture.options.wrap);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture.options.wrap);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (unsigned int level = load.first; level <= load.last && level < texture.resident; ++level)
+        {
+            const std::vector<unsigned char> &data = load.image.levels[level];
+            int width = DdsImage::levelSize(texture.width, level), height = DdsImage::levelSize(texture.height, level);
+            if (texture.cooked)
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, width, height, 0, data.size(), data.data());
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        size_t bytes = rangeBytes(texture, load.first, texture.resident);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, std::min(load.first, texture.resident));
+        texture.resident = std::min(load.first, texture.resident);
+        setResident(texture, rangeBytes(texture, texture.resident, texture.levels));
+        if (!load.tail)
+            streamedIn += bytes;
+    }
+
+    // drops the levels finer than level
+    void evict(Streamed &texture, unsigned int level)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture.texture->id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+        for (unsigned int finer = texture.resident; finer < level; ++finer)
+        {
+            if (texture.cooked)
+                glCompressedTexImage2D(GL_TEXTURE_2D, finer, texture.internalFormat, 0, 0, 0, 0, NULL);
+            else
+                glTexImage2D(GL_TEXTURE_2D, finer, texture.internalFormat, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        }
+        evicted += rangeBytes(texture, texture.resident, level);
+        texture.resident = level;
+        texture.idleFrames = 0;
+        setResident(texture, rangeBytes(texture, texture.resident, texture.levels));
+    }
+
+    void setResident(Streamed &texture, size_t bytes)
+    {
+        resident = resident - texture.texture->bytes + bytes;
+        texture.texture->bytes = bytes;
+    }
+
+    // bytes of one level as uploaded
+    static size_t levelBytes(const Streamed &texture, unsigned int level)
+    {
+        int width = DdsImage::levelSize(texture.width, level), height = DdsImage::levelSize(texture.height, level);
+        return texture.cooked ? DdsImage::levelBytes(texture.cooked, width, height) : (size_t)width * height * texture.texelBytes;
+    }
+
+    // levels first up to end, not including end
+    static size_t rangeBytes(const Streamed &texture, unsigned int first, unsigned int end)
+    {
+        size_t bytes = 0;
+        for (unsigned int level = first; level < end; ++level)
+            bytes += levelBytes(texture, level);
+        return bytes;
+    }
+};
+#endif
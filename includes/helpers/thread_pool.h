@@ -0,0 +1,114 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A small fixed-size worker pool. Tasks are plain std::function objects; parallelFor splits an index
+// range into chunks and blocks until every chunk has been processed (the calling thread helps out).
+class ThreadPool
+{
+public:
+    // constructor spawns the workers; 0 means "one per hardware thread minus the caller"
+    explicit ThreadPool(unsigned int threadCount = 0) : stopping(false)
+    {
+        if (threadCount == 0)
+        {
+            unsigned int hw = std::thread::hardware_concurrency();
+            threadCount = hw > 1 ? hw - 1 : 1;
+        }
+        for (unsigned int i = 0; i < threadCount; ++i)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned int size() const
+    {
+        return (unsigned int)workers.size();
+    }
+
+    // queue a single task, the returned future becomes ready once it has run
+    template <typename F>
+    std::future<void> submit(F task)
+    {
+        std::shared_ptr<std::packaged_task<void()>> packaged = std::make_shared<std::packaged_task<void()>>(task);
+        std::future<void> result = packaged->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push([packaged] { (*packaged)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    // run body(begin, end) over [first, last) split into roughly equal chunks, blocks until done
+    void parallelFor(unsigned int first, unsigned int last, const std::function<void(unsigned int, unsigned int)> &body,
+                     unsigned int minChunk = 1)
+    {
+        if (last <= first)
+            return;
+        unsigned int count = last - first;
+        unsigned int chunks = std::min(count / std::max(minChunk, 1u), size() + 1);
+        if (chunks <= 1)
+        {
+            body(first, last);
+            return;
+        }
+        unsigned int step = (count + chunks - 1) / chunks;
+        std::vector<std::future<void>> pending;
+        for (unsigned int begin = first + step; begin < last; begin += step)
+        {
+            unsigned int end = std::min(begin + step, last);
+            pending.push_back(submit([&body, begin, end] { body(begin, end); }));
+        }
+        // the caller takes the first chunk instead of idling
+        body(first, std::min(first + step, last));
+        for (std::future<void> &f : pending)
+            f.get();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+};
+#endif
@@ -12,16 +12,30 @@
 #include <helpers/filesystem.h>
 #include <helpers/shader.h>
 #include <helpers/camera.h>
+#include <helpers/culling.h>
+#include <helpers/dynamic_resolution.h>
+#include <helpers/gpu_timer.h>
+#include <helpers/hdr_target.h>
+#include <helpers/ibl.h>
+#include <helpers/lights.h>
+#include <helpers/light_grid.h>
+#include <helpers/quality_governor.h>
+#include <helpers/spherical_harmonics.h>
+#include <helpers/texture_streamer.h>
+#include <helpers/thread_pool.h>
 
 #include "../objects.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <string>
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
+bool loadEnvironmentLighting(const std::vector<std::string> &faces, ThreadPool &pool, unsigned int textures[3], ShAmbient &sh);
 void renderSphere(int xSeg = 64, int ySeg = 64);
 void renderTorus(double r = 0.1, double c = 0.25,
                  int rSeg = 64, int cSeg = 32);
@@ -32,6 +46,23 @@ const unsigned int SCR_HEIGHT = 720;
 const float PI = 3.14159265359;
 const float TAU = 2 * PI;
 
+bool ibl = true;
+bool shAmbient = false;
+bool iblAvailable = true; // the environment loaded, otherwise ambient light stays constant
+bool iblKeyPressed = false; //press I to cycle ambient light between the baked environment, its spherical harmonics and a constant
+bool dynamicResolution = true;
+bool dynamicResolutionKeyPressed = false; //press M to switch between dynamic and full resolution
+const float upscaleSharpness = 0.5f;
+const unsigned int QUALITY_ADAPTIVE = 4; // after the presets low, medium, high and ultra
+unsigned int qualityMode = QUALITY_ADAPTIVE;
+bool qualityModePending = true;
+bool qualityKeyPressed = false; //press O to cycle the quality presets and the adaptive quality governor
+bool streamingReportPending = false;
+bool streamingKeyPressed = false; //press T to print the texture streaming budget and residency
+// texture repeats per world unit of the surfaces: around the unit sphere from pole to pole, around the torus tube
+const float SPHERE_UV_PER_UNIT = 1.0f / PI;
+const float TORUS_UV_PER_UNIT = 1.0f / (TAU * 0.2f);
+
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 float lastX = SCR_WIDTH / 2.0;
@@ -44,12 +75,13 @@ float lastFrame = 0.0f;
 
 int main()
 {
+    std::chrono::steady_clock::time_point startupBegin = std::chrono::steady_clock::now();
     // glfw: initialize and configure
     // ------------------------------
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_SAMPLES, 4);
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GL_TRUE); // the tonemap pass relies on GL_FRAMEBUFFER_SRGB for gamma
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
@@ -84,40 +116,88 @@ int main()
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    glEnable(GL_FRAMEBUFFER_SRGB);
+
+    // load PBR material textures, decoded on the pool while the shaders compile and the environment loads; only the
+    // coarse mips at first, the finer ones stream in and out with the screen size of the objects using them
+    // -------------------------------------------------------------------------------------------------
+    ThreadPool threadPool;
+    TextureStreamer textures(threadPool);
+    TextureHandle groundAlbedo    = textures.load(FileSystem::getPath("resources/textures/pbr/ground/albedo.jpg"), true);
+    TextureHandle groundNormal    = textures.load(FileSystem::getPath("resources/textures/pbr/ground/normal.jpg"));
+    // occlusion, roughness and metallic in one texture
+    TextureHandle groundOrm = textures.loadPacked({FileSystem::getPath("resources/textures/pbr/ground/ao.jpg"),
+                                                   FileSystem::getPath("resources/textures/pbr/ground/roughness.jpg"),
+                                                   FileSystem::getPath("resources/textures/pbr/ground/metallic.png")});
+
+    TextureHandle chainmailAlbedo    = textures.load(FileSystem::getPath("resources/textures/pbr/chainmail/albedo.jpg"), true);
+    TextureHandle chainmailNormal    = textures.load(FileSystem::getPath("resources/textures/pbr/chainmail/normal.jpg"));
+    TextureHandle chainmailOrm = textures.loadPacked({FileSystem::getPath("resources/textures/pbr/chainmail/ao.jpg"),
+                                                      FileSystem::getPath("resources/textures/pbr/chainmail/roughness.jpg"),
+                                                      FileSystem::getPath("resources/textures/pbr/chainmail/metallic.jpg")});
 
     // build and compile shaders
     // -------------------------
     Shader CookTorranceShader("pbr_vert.glsl", "pbr_frag.glsl");
+    Shader tonemapShader("quad_vert.glsl", "tonemap_frag.glsl");
 
     CookTorranceShader.use();
     CookTorranceShader.setInt("albedoMap", 0);
     CookTorranceShader.setInt("normalMap", 1);
-    CookTorranceShader.setInt("metallicMap", 2);
-    CookTorranceShader.setInt("roughnessMap", 3);
-    CookTorranceShader.setInt("aoMap", 4);
-
-    // load PBR material textures
-    unsigned int groundAlbedo    = loadTexture(FileSystem::getPath("resources/textures/pbr/ground/albedo.jpg").c_str());
-    unsigned int groundNormal    = loadTexture(FileSystem::getPath("resources/textures/pbr/ground/normal.jpg").c_str());
-    unsigned int groundMetallic  = loadTexture(FileSystem::getPath("resources/textures/pbr/ground/metallic.png").c_str());
-    unsigned int groundRoughness = loadTexture(FileSystem::getPath("resources/textures/pbr/ground/roughness.jpg").c_str());
-    unsigned int groundAo        = loadTexture(FileSystem::getPath("resources/textures/pbr/ground/ao.jpg").c_str());
-
-    unsigned int chainmailAlbedo    = loadTexture(FileSystem::getPath("resources/textures/pbr/chainmail/albedo.jpg").c_str());
-    unsigned int chainmailNormal    = loadTexture(FileSystem::getPath("resources/textures/pbr/chainmail/normal.jpg").c_str());
-    unsigned int chainmailMetallic  = loadTexture(FileSystem::getPath("resources/textures/pbr/chainmail/metallic.jpg").c_str());
-    unsigned int chainmailRoughness = loadTexture(FileSystem::getPath("resources/textures/pbr/chainmail/roughness.jpg").c_str());
-    unsigned int chainmailAo        = loadTexture(FileSystem::getPath("resources/textures/pbr/chainmail/ao.jpg").c_str());
-
-    // lights
+    CookTorranceShader.setInt("ormMap", 2);
+    CookTorranceShader.setInt("irradianceMap", 8);
+    CookTorranceShader.setInt("prefilterMap", 9);
+    CookTorranceShader.setInt("brdfLUT", 10);
+
+    // lights, assigned to view clusters every frame
+    LightGrid lightGrid(threadPool);
+
+    // image based ambient light from the skybox, baked once and cached by content hash
+    std::vector<std::string> skyboxFaces
+            {
+                    FileSystem::getPath("resources/textures/skybox/right.tga"),
+                    FileSystem::getPath("resources/textures/skybox/left.tga"),
+                    FileSystem::getPath("resources/textures/skybox/top.tga"),
+                    FileSystem::getPath("resources/textures/skybox/bottom.tga"),
+                    FileSystem::getPath("resources/textures/skybox/front.tga"),
+                    FileSystem::getPath("resources/textures/skybox/back.tga")
+            };
+    unsigned int iblTextures[3] = {0, 0, 0};
+    ShAmbient skyAmbient;
+    skyAmbient.bind(CookTorranceShader);
+    iblAvailable = loadEnvironmentLighting(skyboxFaces, threadPool, iblTextures, skyAmbient);
+    ibl = ibl && iblAvailable;
+    // upload the coarse mips of the material textures as their decodes finish
+    textures.finish();
+    std::vector<PointLight> lights;
+    std::vector<PointLight> visibleLights;
+    const float nearPlane = 0.1f, farPlane = 100.0f;
+
     int nrRows = 2;
     int nrColumns = 3;
     float spacing = 2.5;
 
-    // initialize static shader uniforms before rendering
-    glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-    CookTorranceShader.use();
-    CookTorranceShader.setMat4("projection", projection);
+    // the lit scene goes to a multisampled floating point target, tonemapped once per pixel at the end of the frame
+    HdrTarget hdrTarget(4);
+    // multisampling is the quality setting here, stepped down once dynamic resolution is at its lowest
+    GLint maxSamples = 1;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    QualityGovernor governor(1000.0f / 60.0f);
+    const unsigned int samplesSetting = governor.addSetting("MSAA samples", {1, 2, 4, 8}, {1.0f, 1.5f, 2.0f, 3.0f});
+    governor.addPreset("low", {0});
+    governor.addPreset("medium", {1});
+    governor.addPreset("high", {2});
+    governor.addPreset("ultra", {3});
+    governor.setMode(2); // the adaptive governor starts from high
+    // render scale that holds 60 fps on the GPU, shown in the window title with the frame time
+    DynamicResolution resolutionController(1000.0f / 60.0f);
+    GpuTimer frameTimer;
+    float statsTime = 0.0f;
+
+    std::cout << "Startup: " << std::chrono::duration<double>(std::chrono::steady_clock::now() - startupBegin).count() << " s, "
+              << textures.size() << " streamed textures decoded on " << threadPool.size() << " worker threads" << std::endl;
+    textures.report(std::cout);
 
     // render loop
     while (!glfwWindowShouldClose(window))
@@ -129,26 +209,78 @@ int main()
 
         // input
         processInput(window);
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
 
         // render
-        glClearColor(0.15f, 0.15f, 0.15f, 1.0f);
+        frameTimer.begin();
+        hdrTarget.resize(framebufferWidth, framebufferHeight);
+        if (dynamicResolution)
+            resolutionController.update(frameTimer);
+        hdrTarget.setRenderScale(dynamicResolution ? resolutionController.scale : 1.0f);
+        if (qualityModePending)
+        {
+            governor.setMode(qualityMode);
+            std::cout << "Quality: " << governor.modeName() << std::endl;
+            qualityModePending = false;
+        }
+        governor.update(frameTimer, !dynamicResolution || resolutionController.scale <= resolutionController.minScale,
+                        !dynamicResolution || resolutionController.scale >= resolutionController.maxScale);
+        hdrTarget.setSamples(std::min(governor.value(samplesSetting), (int)maxSamples));
+        governor.begin(samplesSetting);
+        hdrTarget.bind();
+        glClearColor(0.02f, 0.02f, 0.02f, 1.0f); // linear, 0.15 on screen after tonemapping
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+        float aspect = (float)std::max(framebufferWidth, 1) / (float)std::max(framebufferHeight, 1);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), aspect, nearPlane, farPlane);
         CookTorranceShader.use();
+        CookTorranceShader.setMat4("projection", projection);
         glm::mat4 view = camera.GetViewMatrix();
         CookTorranceShader.setMat4("view", view);
         CookTorranceShader.setVec3("camPos", camera.Position);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, groundAlbedo);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, groundNormal);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, groundMetallic);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, groundRoughness);
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_2D, groundAo);
+        // light intensity falls off with 1 / d^2
+        lights.clear();
+        for (unsigned int i = 0; i < sizeof(pbrLightPositions) / sizeof(pbrLightPositions[0]); ++i)
+        {
+            PointLight light(pbrLightPositions[i], pbrLightColors[i], 0.0f, 0.0f, 0.0f, 1.0f);
+            light.radius = lightRadius(light);
+            lights.push_back(light);
+        }
+        Frustum frustum(projection * view);
+        cullLights(lights, frustum, visibleLights);
+        lightGrid.update(visibleLights, view, glm::radians(camera.Zoom), aspect, nearPlane, farPlane);
+        lightGrid.bind(5);
+        lightGrid.setUniforms(CookTorranceShader, 5, glm::vec2(hdrTarget.renderWidth, hdrTarget.renderHeight));
+        CookTorranceShader.setBool("ibl", ibl);
+        CookTorranceShader.setBool("shAmbient", shAmbient);
+        if (ibl)
+        {
+            glActiveTexture(GL_TEXTURE8);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, iblTextures[0]);
+            glActiveTexture(GL_TEXTURE9);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, iblTextures[1]);
+            glActiveTexture(GL_TEXTURE10);
+            glBindTexture(GL_TEXTURE_2D, iblTextures[2]);
+        }
+
+        // the mip level every visible draw needs of its material, from its distance to the camera
+        auto requireMaterial = [&](const TextureHandle (&material)[3], const glm::vec3 &center, float radius, float uvPerUnit)
+        {
+            if (!frustum.intersectsSphere(center, radius))
+                return;
+            float distance = std::max(glm::length(center - camera.Position) - radius, nearPlane);
+            float pixelsPerUnit = screenPixelsPerUnit(distance, glm::radians(camera.Zoom), hdrTarget.renderHeight);
+            for (const TextureHandle &texture : material)
+                textures.require(texture, uvPerUnit, pixelsPerUnit);
+        };
+        const TextureHandle ground[3] = {groundAlbedo, groundNormal, groundOrm};
+        const TextureHandle chainmail[3] = {chainmailAlbedo, chainmailNormal, chainmailOrm};
+
+        bindTexture(0, groundAlbedo);
+        bindTexture(1, groundNormal);
+        bindTexture(2, groundOrm);
 
         // render rows*column number of spheres with material properties defined by textures (ground & chainmail)
         glm::mat4 model = glm::mat4(1.0f);
@@ -163,18 +295,12 @@ int main()
             ));
             CookTorranceShader.setMat4("model", model);
             renderSphere();
+            requireMaterial(ground, glm::vec3(model[3]), 1.0f, SPHERE_UV_PER_UNIT);
         }
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, chainmailAlbedo);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, chainmailNormal);
-        glActiveTexture(GL_TEXTURE2);
-        glBindTexture(GL_TEXTURE_2D, chainmailMetallic);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, chainmailRoughness);
-        glActiveTexture(GL_TEXTURE4);
-        glBindTexture(GL_TEXTURE_2D, chainmailAo);
+        bindTexture(0, chainmailAlbedo);
+        bindTexture(1, chainmailNormal);
+        bindTexture(2, chainmailOrm);
 
         for (int col = 0; col < nrColumns; ++col)
         {
@@ -186,6 +312,15 @@ int main()
             ));
             CookTorranceShader.setMat4("model", model);
             renderTorus();
+            requireMaterial(chainmail, glm::vec3(model[3]), 0.7f, TORUS_UV_PER_UNIT);
+        }
+        unbindSamplers(0, 3);
+        // finer levels for the next frames, within the budget
+        textures.update();
+        if (streamingReportPending)
+        {
+            textures.report(std::cout);
+            streamingReportPending = false;
         }
 
 
@@ -195,8 +330,6 @@ int main()
         {
             glm::vec3 newPos = pbrLightPositions[i] + glm::vec3(std::sin(glfwGetTime() * 5.0) * 5.0, 0.0, 0.0);
             newPos = pbrLightPositions[i];
-            CookTorranceShader.setVec3("lightPositions[" + std::to_string(i) + "]", newPos);
-            CookTorranceShader.setVec3("lightColors[" + std::to_string(i) + "]", pbrLightColors[i]);
 
             model = glm::mat4(1.0f);
             model = glm::translate(model, newPos);
@@ -205,6 +338,24 @@ int main()
             renderTorus();
         }
 
+        hdrTarget.present(tonemapShader, upscaleSharpness);
+        governor.end(samplesSetting);
+        frameTimer.end();
+        statsTime += deltaTime;
+        if (statsTime > 0.5f)
+        {
+            std::string title = "LearnOpenGL | GPU " + std::to_string(frameTimer.averageMs()) + " ms | resolution "
+                                + std::to_string((int)(100.0f * hdrTarget.renderWidth / std::max(hdrTarget.width, 1) + 0.5f)) + "%, "
+                                + std::to_string((int)(100.0f * resolutionController.adherence() + 0.5f)) + "% of frames in budget"
+                                + " | quality " + governor.modeName() + ": " + std::to_string(hdrTarget.samples) + "x MSAA"
+                                + " | textures " + std::to_string(textures.residentBytes() / (1024 * 1024)) + " of "
+                                + std::to_string(textures.budget() / (1024 * 1024)) + " MB";
+            glfwSetWindowTitle(window, title.c_str());
+            frameTimer.reset();
+            resolutionController.resetStats();
+            statsTime = 0.0f;
+        }
+
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -230,6 +381,49 @@ void processInput(GLFWwindow *window)
         camera.ProcessKeyboard(LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera.ProcessKeyboard(RIGHT, deltaTime);
+
+    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS && !iblKeyPressed)
+    {
+        // image based -> spherical harmonics -> constant, both need the environment
+        bool wasIbl = ibl;
+        ibl = !ibl && !shAmbient && iblAvailable;
+        shAmbient = wasIbl;
+        std::cout << "Ambient light: " << (ibl ? "image based" : shAmbient ? "spherical harmonics" : "constant") << std::endl;
+        iblKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_I) == GLFW_RELEASE)
+    {
+        iblKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && !qualityKeyPressed)
+    {
+        qualityMode = (qualityMode + 1) % (QUALITY_ADAPTIVE + 1);
+        qualityModePending = true;
+        qualityKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_RELEASE)
+    {
+        qualityKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && !dynamicResolutionKeyPressed)
+    {
+        dynamicResolution = !dynamicResolution;
+        std::cout << "Resolution: " << (dynamicResolution ? "dynamic" : "full") << std::endl;
+        dynamicResolutionKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_RELEASE)
+    {
+        dynamicResolutionKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && !streamingKeyPressed)
+    {
+        streamingReportPending = true;
+        streamingKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE)
+    {
+        streamingKeyPressed = false;
+    }
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -446,40 +640,60 @@ void renderTorus(double r, double c,
     glDrawArrays(GL_TRIANGLE_STRIP, 0, torusIndexCount);
 }
 
-// utility function for loading a 2D texture from file
-unsigned int loadTexture(char const * path)
+// uploads a baked cubemap (and its mips) as RGB16F
+void uploadCube(const std::vector<CubeImage> &chain)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+    for (unsigned int mip = 0; mip < chain.size(); ++mip)
+        for (unsigned int face = 0; face < 6; ++face)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, GL_RGB16F, chain[mip].size, chain[mip].size, 0, GL_RGB, GL_FLOAT, chain[mip].faces[face].data());
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, chain.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, chain.size() - 1);
+}
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+// irradiance cubemap, prefiltered specular cubemap and BRDF lookup table of an environment (see helpers/ibl.h),
+// read from the cache next to it or baked on the pool and written there, and its spherical harmonics in sh
+bool loadEnvironmentLighting(const std::vector<std::string> &faces, ThreadPool &pool, unsigned int textures[3], ShAmbient &sh)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::string cachePath = iblCachePath(faces);
+    IblMaps maps;
+    if (loadIbl(cachePath, maps))
     {
-        GLenum format = 0;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
+        std::cout << "Image based lighting loaded from " << cachePath << " in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
     }
     else
     {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+        CubeImage environment;
+        if (!loadCubeImage(faces, IBL_SPECULAR_SIZE, environment))
+        {
+            std::cout << "Cubemap texture failed to load at path: " << faces[0] << std::endl;
+            return false;
+        }
+        maps = bakeIbl(environment, pool);
+        std::cout << "Image based lighting baked in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+                  << " s on " << pool.size() + 1 << " threads" << std::endl;
+        if (!saveIbl(cachePath, maps))
+            std::cout << "ERROR::IBL::SAVE_FAILED " << cachePath << std::endl;
     }
 
-    return textureID;
+    // the first level of the specular chain is the environment itself
+    sh.update(maps.specular[0], pool);
+
+    glGenTextures(3, textures);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textures[0]);
+    uploadCube(std::vector<CubeImage>(1, maps.irradiance));
+    glBindTexture(GL_TEXTURE_CUBE_MAP, textures[1]);
+    uploadCube(maps.specular);
+    glBindTexture(GL_TEXTURE_2D, textures[2]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, maps.lutSize, maps.lutSize, 0, GL_RG, GL_FLOAT, maps.lut.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    return true;
 }
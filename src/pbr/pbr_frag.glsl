@@ -8,22 +8,63 @@ in vec3 Normal;
 // material parameters
 uniform sampler2D albedoMap;
 uniform sampler2D normalMap;
-uniform sampler2D metallicMap;
-uniform sampler2D roughnessMap;
-uniform sampler2D aoMap;
-
-// lights
-uniform vec3 lightPositions[4];
-uniform vec3 lightColors[4];
+uniform sampler2D ormMap; // occlusion, roughness, metallic
+
+// image based ambient light baked from the skybox, see helpers/ibl.h
+uniform bool ibl;
+uniform samplerCube irradianceMap;
+uniform samplerCube prefilterMap;
+uniform sampler2D brdfLUT;
+const float MAX_REFLECTION_LOD = 4.0; // IBL_SPECULAR_MIPS - 1
+
+// second order spherical harmonics ambient light of the skybox, see helpers/spherical_harmonics.h
+uniform bool shAmbient;
+layout (std140) uniform AmbientSH
+{
+    vec4 shCoefficients[9];
+};
 
 uniform vec3 camPos;
 
+// clustered lights, see LightGrid
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer lightIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterZParams;
+uniform vec2 viewportSize;
+uniform float nearPlane;
+uniform float farPlane;
+
 const float PI = 3.14159265359;
+// irradiance / pi around the unit vector n, a few multiply-adds and no texture fetches
+vec3 ShIrradiance(vec3 n)
+{
+    return shCoefficients[0].rgb
+         + shCoefficients[1].rgb * n.y + shCoefficients[2].rgb * n.z + shCoefficients[3].rgb * n.x
+         + shCoefficients[4].rgb * (n.x * n.y) + shCoefficients[5].rgb * (n.y * n.z)
+         + shCoefficients[6].rgb * (3.0 * n.z * n.z - 1.0) + shCoefficients[7].rgb * (n.x * n.z)
+         + shCoefficients[8].rgb * (n.x * n.x - n.y * n.y);
+}
+
+// analytic fit of the split sum BRDF scale and bias (Karis, "Physically Based Shading on Mobile")
+vec2 EnvBRDFApprox(float NdotV, float roughness)
+{
+    const vec4 c0 = vec4(-1.0, -0.0275, -0.572, 0.022);
+    const vec4 c1 = vec4(1.0, 0.0425, 1.04, -0.04);
+    vec4 r = roughness * c0 + c1;
+    float a004 = min(r.x * r.x, exp2(-9.28 * NdotV)) * r.x + r.y;
+    return vec2(-1.04, 1.04) * a004 + r.zw;
+}
+
 // Easy trick to get tangent-normals to world-space to keep PBR code simplified.
 // alternative way is usual normal mapping
 vec3 getNormalFromMap()
 {
-    vec3 tangentNormal = texture(normalMap, TexCoords).xyz * 2.0 - 1.0;
+    // z from x and y, cooked BC5 normal maps store only those
+    vec3 tangentNormal;
+    tangentNormal.xy = texture(normalMap, TexCoords).rg * 2.0 - 1.0;
+    tangentNormal.z = sqrt(max(1.0 - dot(tangentNormal.xy, tangentNormal.xy), 0.0));
 
     vec3 Q1  = dFdx(WorldPos);
     vec3 Q2  = dFdy(WorldPos);
@@ -78,12 +119,37 @@ vec3 fresnelSchlick(float cosTheta, vec3 F0)
     return F0 + (1.0 - F0) * pow(1.0 - cosTheta, 5.0);
 }
 
+// rough surfaces reflect less at grazing angles on average over the lobe
+vec3 fresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
+{
+    return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(1.0 - cosTheta, 5.0);
+}
+
+// smooth falloff that brings a light's attenuation to exactly zero at its radius
+float RadiusWindow(float distance, float radius)
+{
+    float x = distance / radius;
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    return window * window;
+}
+
+// finds the cluster of the current fragment from its window position and view-space depth
+int ClusterIndex()
+{
+    float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+    float viewDepth = (2.0 * nearPlane * farPlane) / (farPlane + nearPlane - ndcDepth * (farPlane - nearPlane));
+    int slice = clamp(int(log(viewDepth) * clusterZParams.x - clusterZParams.y), 0, clusterDims.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / viewportSize * vec2(clusterDims.xy)), ivec2(0), clusterDims.xy - 1);
+    return tile.x + clusterDims.x * (tile.y + clusterDims.y * slice);
+}
+
 void main()
 {		
-    vec3 albedo     = pow(texture(albedoMap, TexCoords).rgb, vec3(2.2));
-    float metallic  = texture(metallicMap, TexCoords).r * 1;
-    float roughness = texture(roughnessMap, TexCoords).r;
-    float ao        = texture(aoMap, TexCoords).r;
+    vec3 albedo     = texture(albedoMap, TexCoords).rgb; // sRGB texture, decoded by the sampler
+    vec3 orm        = texture(ormMap, TexCoords).rgb;
+    float metallic  = orm.b;
+    float roughness = orm.g;
+    float ao        = orm.r;
 
     vec3 N = getNormalFromMap();
     vec3 V = normalize(camPos - WorldPos);
@@ -95,14 +161,21 @@ void main()
 
     // reflectance equation
     vec3 Lo = vec3(0.0);
-    for(int i = 0; i < 4; ++i) 
+    uvec2 cluster = texelFetch(clusterGrid, ClusterIndex()).xy;
+    for(uint i = 0u; i < cluster.y; ++i)
     {
+        int light = int(texelFetch(lightIndices, int(cluster.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, light * 3);
+        vec3 attenuationTerms = texelFetch(lightData, light * 3 + 2).xyz;
+
         // calculate per-light radiance
-        vec3 L = normalize(lightPositions[i] - WorldPos);
+        vec3 L = normalize(positionRadius.xyz - WorldPos);
         vec3 H = normalize(V + L);
-        float distance = length(lightPositions[i] - WorldPos);
-        float attenuation = 1.0 / (distance * distance);
-        vec3 radiance = lightColors[i] * attenuation;
+        float distance = length(positionRadius.xyz - WorldPos);
+        if (distance > positionRadius.w)
+            continue;
+        float attenuation = RadiusWindow(distance, positionRadius.w) / (attenuationTerms.x + attenuationTerms.y * distance + attenuationTerms.z * (distance * distance));
+        vec3 radiance = texelFetch(lightData, light * 3 + 1).rgb * attenuation;
 
         // Cook-Torrance BRDF
         float NDF = DistributionGGX(N, H, roughness);   
@@ -131,15 +204,32 @@ void main()
         Lo += (kD * albedo / PI + specular) * radiance * NdotL;  // note that we already multiplied the BRDF by the Fresnel (kS) so we won't multiply by kS again
     }   
     
-    // ambient lighting
+    // ambient lighting: irradiance for diffuse, split sum of prefiltered environment and BRDF scale/bias for specular
     vec3 ambient = vec3(0.03) * albedo * ao;
+    if (ibl)
+    {
+        float NdotV = max(dot(N, V), 0.0);
+        vec3 F = fresnelSchlickRoughness(NdotV, F0, roughness);
+        vec3 kD = (1.0 - F) * (1.0 - metallic);
+        vec3 diffuse = texture(irradianceMap, N).rgb * albedo;
+        vec3 prefilteredColor = textureLod(prefilterMap, reflect(-V, N), roughness * MAX_REFLECTION_LOD).rgb;
+        vec2 brdf = texture(brdfLUT, vec2(NdotV, roughness)).rg;
+        vec3 specular = prefilteredColor * (F * brdf.x + brdf.y);
+        ambient = (kD * diffuse + specular) * ao;
+    }
+    else if (shAmbient)
+    {
+        // the same split with no fetches: SH irradiance, also along the reflection as a very rough environment
+        float NdotV = max(dot(N, V), 0.0);
+        vec3 F = fresnelSchlickRoughness(NdotV, F0, roughness);
+        vec3 kD = (1.0 - F) * (1.0 - metallic);
+        vec2 brdf = EnvBRDFApprox(NdotV, roughness);
+        vec3 specular = ShIrradiance(reflect(-V, N)) * (F * brdf.x + brdf.y);
+        ambient = (kD * ShIrradiance(N) * albedo + specular) * ao;
+    }
     
     vec3 color = ambient + Lo;
 
-    // HDR tonemapping
-    color = color / (color + vec3(1.0));
-    // gamma correct
-    color = pow(color, vec3(1.0/2.2)); 
-
+    // linear HDR, tonemapped and gamma encoded once per pixel by tonemap_frag.glsl
     FragColor = vec4(color, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,39 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D hdrBuffer; // linear radiance, see helpers/hdr_target.h
+uniform vec2 renderSize; // lower left pixels of hdrBuffer covered by the scene, smaller than it under dynamic resolution
+uniform float sharpness; // 0 is plain bilinear upscaling
+
+vec3 Tonemap(vec3 color)
+{
+    return color / (color + vec3(1.0)); // Reinhard
+}
+
+// bilinear lookup at a position in render pixels, kept inside the render rectangle
+vec3 SampleScene(vec2 position, vec2 texelSize)
+{
+    position = clamp(position, vec2(0.5), renderSize - 0.5);
+    return Tonemap(texture(hdrBuffer, position * texelSize).rgb);
+}
+
+// tonemapping and upscaling to the window, once per pixel; the sRGB default framebuffer encodes the gamma on write
+void main()
+{
+    vec2 texelSize = 1.0 / vec2(textureSize(hdrBuffer, 0));
+    // the window is as large as hdrBuffer, so this maps window pixel centers onto the render rectangle
+    vec2 position = gl_FragCoord.xy * renderSize * texelSize;
+    vec3 color = SampleScene(position, texelSize);
+    if (sharpness > 0.0)
+    {
+        // unsharp mask over the four neighbouring render pixels, clamped to their range so edges do not ring
+        vec3 n = SampleScene(position + vec2(0.0, 1.0), texelSize);
+        vec3 s = SampleScene(position - vec2(0.0, 1.0), texelSize);
+        vec3 e = SampleScene(position + vec2(1.0, 0.0), texelSize);
+        vec3 w = SampleScene(position - vec2(1.0, 0.0), texelSize);
+        vec3 lowest = min(color, min(min(n, s), min(e, w)));
+        vec3 highest = max(color, max(max(n, s), max(e, w)));
+        color = clamp(color + sharpness * (color - 0.25 * (n + s + e + w)), lowest, highest);
+    }
+    FragColor = vec4(color, 1.0);
+}
@@ -0,0 +1,21 @@
+#version 330 core
+#define MAX_CASCADES 4
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 12) out;
+
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+uniform int cascadeCount;
+
+void main()
+{
+    for(int cascade = 0; cascade < cascadeCount; ++cascade)
+    {
+        gl_Layer = cascade; // layer of the depth array texture
+        for(int i = 0; i < 3; ++i)
+        {
+            gl_Position = cascadeMatrices[cascade] * gl_in[i].gl_Position;
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
@@ -0,0 +1,54 @@
+#version 330 core
+out vec4 FragColor;
+
+flat in int LightIndex;
+
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform samplerBuffer lightData;
+
+uniform mat4 inverseViewProjection;
+uniform vec2 viewportSize;
+uniform vec3 viewPos;
+uniform float shininess;
+
+// smooth falloff that brings a light's attenuation to exactly zero at its radius
+float RadiusWindow(float distance, float radius)
+{
+    float x = distance / radius;
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    return window * window;
+}
+
+void main()
+{
+    // reconstruct the world position of the surface behind this pixel
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    vec4 clipPos = vec4(gl_FragCoord.xy / viewportSize * 2.0 - 1.0, texelFetch(gDepth, texel, 0).r * 2.0 - 1.0, 1.0);
+    vec4 worldPos = inverseViewProjection * clipPos;
+    vec3 fragPos = worldPos.xyz / worldPos.w;
+
+    vec4 positionRadius = texelFetch(lightData, LightIndex * 3);
+    float distance = length(positionRadius.xyz - fragPos);
+    if (distance > positionRadius.w)
+        discard;
+    vec4 colorAmbient = texelFetch(lightData, LightIndex * 3 + 1);
+    vec3 attenuationTerms = texelFetch(lightData, LightIndex * 3 + 2).xyz;
+    float attenuation = RadiusWindow(distance, positionRadius.w) / (attenuationTerms.x + attenuationTerms.y * distance + attenuationTerms.z * (distance * distance));
+
+    vec4 albedoSpec = texelFetch(gAlbedoSpec, texel, 0);
+    vec3 normal = texelFetch(gNormal, texel, 0).xyz;
+    vec3 viewDir = normalize(viewPos - fragPos);
+
+    // same Phong terms as lights_frag.glsl
+    vec3 ambient = colorAmbient.w * colorAmbient.rgb * albedoSpec.rgb;
+    vec3 lightDir = normalize(positionRadius.xyz - fragPos);
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 diffuse = colorAmbient.rgb * diff * albedoSpec.rgb;
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
+    vec3 specular = colorAmbient.rgb * spec * albedoSpec.a;
+
+    FragColor = vec4((ambient + diffuse + specular) * attenuation, 1.0);
+}
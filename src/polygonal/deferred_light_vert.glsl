@@ -0,0 +1,18 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// one instance per light, see LightGrid for the layout
+uniform samplerBuffer lightData;
+uniform mat4 projection;
+uniform mat4 view;
+
+flat out int LightIndex;
+
+void main()
+{
+    vec4 positionRadius = texelFetch(lightData, gl_InstanceID * 3);
+    LightIndex = gl_InstanceID;
+    // the tessellated unit sphere lies inside the real one, grow it a little so the volume bounds the light
+    vec3 worldPos = positionRadius.xyz + aPos * positionRadius.w * 1.1;
+    gl_Position = projection * view * vec4(worldPos, 1.0);
+}
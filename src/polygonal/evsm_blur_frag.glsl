@@ -0,0 +1,47 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform samplerCube source; // depth cubemap or horizontally blurred moments
+uniform int face; // GL_TEXTURE_CUBE_MAP_POSITIVE_X + face is being written
+uniform bool fromDepth;
+uniform vec2 blurDirection;
+uniform int blurRadius;
+
+// positive and negative warp exponents, 40 is about the largest fp32 moments survive squared
+const vec2 EVSM_EXPONENTS = vec2(40.0, 5.0);
+
+// direction of a texel of the face, inverse of the GL cubemap face selection
+vec3 faceDirection(vec2 uv)
+{
+    vec2 st = uv * 2.0 - 1.0;
+    if (face == 0) return vec3(1.0, -st.y, -st.x);
+    if (face == 1) return vec3(-1.0, -st.y, st.x);
+    if (face == 2) return vec3(st.x, 1.0, st.y);
+    if (face == 3) return vec3(st.x, -1.0, -st.y);
+    if (face == 4) return vec3(st.x, -st.y, 1.0);
+    return vec3(-st.x, -st.y, -1.0);
+}
+
+vec4 moments(vec3 direction)
+{
+    if (!fromDepth)
+        return texture(source, direction);
+    float depth = texture(source, direction).r * 2.0 - 1.0;
+    vec2 warped = vec2(exp(EVSM_EXPONENTS.x * depth), -exp(-EVSM_EXPONENTS.y * depth));
+    return vec4(warped.x, warped.x * warped.x, warped.y, warped.y * warped.y);
+}
+
+void main()
+{
+    // box filter that stays inside the face
+    float texel = 1.0 / float(textureSize(source, 0).x);
+    vec4 sum = vec4(0.0);
+    for (int i = -blurRadius; i <= blurRadius; ++i)
+    {
+        vec2 uv = clamp(TexCoords + blurDirection * float(i) * texel, 0.5 * texel, 1.0 - 0.5 * texel);
+        sum += moments(faceDirection(uv));
+    }
+    FragColor = sum / float(2 * blurRadius + 1);
+}
@@ -0,0 +1,56 @@
+#version 330 core
+layout (location = 0) out vec4 gAlbedoSpec;
+layout (location = 1) out vec4 gNormal;
+layout (location = 2) out vec4 gLighting;
+
+struct Material {
+    sampler2D diffuse;
+    sampler2D specular;
+    sampler2D emission;
+    float shininess;
+};
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform Material material;
+uniform float time;
+uniform bool withEmission;
+
+// second order spherical harmonics ambient light of the skybox, see helpers/spherical_harmonics.h
+uniform bool shAmbient;
+layout (std140) uniform AmbientSH
+{
+    vec4 shCoefficients[9];
+};
+
+// irradiance / pi around the unit vector n, a few multiply-adds and no texture fetches
+vec3 ShIrradiance(vec3 n)
+{
+    return shCoefficients[0].rgb
+         + shCoefficients[1].rgb * n.y + shCoefficients[2].rgb * n.z + shCoefficients[3].rgb * n.x
+         + shCoefficients[4].rgb * (n.x * n.y) + shCoefficients[5].rgb * (n.y * n.z)
+         + shCoefficients[6].rgb * (3.0 * n.z * n.z - 1.0) + shCoefficients[7].rgb * (n.x * n.z)
+         + shCoefficients[8].rgb * (n.x * n.x - n.y * n.y);
+}
+
+void main()
+{
+    vec3 diffuseColor = texture(material.diffuse, TexCoords).rgb;
+    vec3 specularColor = texture(material.specular, TexCoords).rgb;
+    gAlbedoSpec = vec4(diffuseColor, dot(specularColor, vec3(1.0 / 3.0)));
+    vec3 norm = normalize(Normal);
+    gNormal = vec4(norm, 0.0);
+
+    // sky light and pulsating & floating emission go straight into the light accumulation buffer
+    vec3 emission = vec3(0.0);
+    if (shAmbient)
+        emission += ShIrradiance(norm) * diffuseColor;
+    if (withEmission && (specularColor.r == 0.0))
+    {
+        vec3 glow = texture(material.emission, TexCoords + vec2(0.0, time)).rgb;   //floating
+        emission += glow * (sin(2*time) * 0.5 + 0.5);                         //pulsating
+    }
+    gLighting = vec4(emission, 1.0);
+}
@@ -8,61 +8,87 @@ struct Material {
     float shininess;
 };
 
-struct PointLight {
-    vec3 position;
-	
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-#define NR_POINT_LIGHTS 4
-
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
 
 uniform vec3 viewPos;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
 uniform Material material;
 uniform float time;
 uniform bool withEmission;
 
+// clustered lights, see LightGrid
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer lightIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterZParams;
+uniform vec2 viewportSize;
+uniform float nearPlane;
+uniform float farPlane;
+
+// second order spherical harmonics ambient light of the skybox, see helpers/spherical_harmonics.h
+uniform bool shAmbient;
+layout (std140) uniform AmbientSH
+{
+    vec4 shCoefficients[9];
+};
+
+// finds the cluster of the current fragment from its window position and view-space depth
+int ClusterIndex()
+{
+    float ndcDepth = gl_FragCoord.z * 2.0 - 1.0;
+    float viewDepth = (2.0 * nearPlane * farPlane) / (farPlane + nearPlane - ndcDepth * (farPlane - nearPlane));
+    int slice = clamp(int(log(viewDepth) * clusterZParams.x - clusterZParams.y), 0, clusterDims.z - 1);
+    ivec2 tile = clamp(ivec2(gl_FragCoord.xy / viewportSize * vec2(clusterDims.xy)), ivec2(0), clusterDims.xy - 1);
+    return tile.x + clusterDims.x * (tile.y + clusterDims.y * slice);
+}
+
+// smooth falloff that brings a light's attenuation to exactly zero at its radius
+float RadiusWindow(float distance, float radius)
+{
+    float x = distance / radius;
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    return window * window;
+}
+
+// irradiance / pi around the unit vector n, a few multiply-adds and no texture fetches
+vec3 ShIrradiance(vec3 n)
+{
+    return shCoefficients[0].rgb
+         + shCoefficients[1].rgb * n.y + shCoefficients[2].rgb * n.z + shCoefficients[3].rgb * n.x
+         + shCoefficients[4].rgb * (n.x * n.y) + shCoefficients[5].rgb * (n.y * n.z)
+         + shCoefficients[6].rgb * (3.0 * n.z * n.z - 1.0) + shCoefficients[7].rgb * (n.x * n.z)
+         + shCoefficients[8].rgb * (n.x * n.x - n.y * n.y);
+}
+
 // calculates the color when using a point light.
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+vec3 CalcPointLight(int light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 diffuseColor, vec3 specularColor)
 {
+    vec4 positionRadius = texelFetch(lightData, light * 3);
+    vec4 colorAmbient   = texelFetch(lightData, light * 3 + 1);
+    vec3 attenuationTerms = texelFetch(lightData, light * 3 + 2).xyz;
+
+    // attenuation
+    float distance = length(positionRadius.xyz - fragPos);
+    if (distance > positionRadius.w)
+        return vec3(0.0);
+    float attenuation = RadiusWindow(distance, positionRadius.w) / (attenuationTerms.x + attenuationTerms.y * distance + attenuationTerms.z * (distance * distance));
+
     // ambient
-    vec3 ambient = light.ambient * texture(material.diffuse, TexCoords).rgb;
+    vec3 ambient = colorAmbient.w * colorAmbient.rgb * diffuseColor;
 
     // diffuse
-    vec3 lightDir = normalize(light.position - FragPos);
+    vec3 lightDir = normalize(positionRadius.xyz - fragPos);
     float diff = max(dot(normal, lightDir), 0.0);
-    vec3 diffuse = light.diffuse * diff * texture(material.diffuse, TexCoords).rgb;
+    vec3 diffuse = colorAmbient.rgb * diff * diffuseColor;
 
     // specular
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    vec3 specular = light.specular * spec * texture(material.specular, TexCoords).rgb;
-
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
+    vec3 specular = colorAmbient.rgb * spec * specularColor;
 
-    // pulsating & floating emission
-    vec3 emission = vec3(0.0);
-    if (withEmission &&  (texture(material.specular, TexCoords).r == 0.0))
-    {
-        emission = texture(material.emission, TexCoords + vec2(0.0, time)).rgb;   //floating
-        emission = emission * (sin(2*time) * 0.5 + 0.5);                     //pulsating
-    }
-    return (ambient + diffuse + specular + emission);
+    return (ambient + diffuse + specular) * attenuation;
 }
 
 void main()
@@ -70,9 +96,22 @@ void main()
     // properties
     vec3 norm = normalize(Normal);
     vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 diffuseColor = texture(material.diffuse, TexCoords).rgb;
+    vec3 specularColor = texture(material.specular, TexCoords).rgb;
     vec3 result = vec3(0.0, 0.0, 0.0);
-    //point lights
-    for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);
+    //point lights of this cluster
+    uvec2 cluster = texelFetch(clusterGrid, ClusterIndex()).xy;
+    for(uint i = 0u; i < cluster.y; i++)
+        result += CalcPointLight(int(texelFetch(lightIndices, int(cluster.x + i)).r), norm, FragPos, viewDir, diffuseColor, specularColor);
+    // sky light
+    if (shAmbient)
+        result += ShIrradiance(norm) * diffuseColor;
+
+    // pulsating & floating emission
+    if (withEmission && (specularColor.r == 0.0))
+    {
+        vec3 emission = texture(material.emission, TexCoords + vec2(0.0, time)).rgb;   //floating
+        result += emission * (sin(2*time) * 0.5 + 0.5);                              //pulsating
+    }
     FragColor = vec4(result, 1.0);
 }
\ No newline at end of file
@@ -4,9 +4,9 @@ out vec4 FragColor;
 in VS_OUT {
     vec3 FragPos;
     vec2 TexCoords;
-    vec3 TangentLightPos;
     vec3 TangentViewPos;
     vec3 TangentFragPos;
+    mat3 TBN;
 } fs_in;
 
 uniform sampler2D diffuseMap;
@@ -15,12 +15,45 @@ uniform sampler2D depthMap;
 
 uniform float heightScale;
 
-vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
+// relaxed cone stepping instead of the layer search, see includes/helpers/cone_step.h
+uniform bool coneStepMapping;
+uniform sampler2D coneMap; // depth, square root of the relaxed cone ratio
+
+// level of detail from the screen footprint of the relief
+uniform bool parallaxLod;
+uniform float parallaxPixelsPerLayer;
+// below this many pixels of parallax shift the wall is plainly normal mapped
+const float minParallaxPixels = 1.0;
+
+// most search layers and relief steps at full detail, the application compiles one permutation per quality level
+#ifndef MAX_PARALLAX_LAYERS
+#define MAX_PARALLAX_LAYERS 32
+#endif
+#ifndef MAX_RELIEF_STEPS
+#define MAX_RELIEF_STEPS 6
+#endif
+
+// writes the number of depth map fetches instead of shading, see reportParallaxFetches
+uniform bool countFetches;
+int fetches = 0;
+
+// the lights reaching the wall, picked on the CPU (see lightsAffecting)
+#define MAX_OBJECT_LIGHTS 4
+uniform int lightCount;
+uniform vec3 lightPositions[MAX_OBJECT_LIGHTS];
+uniform vec3 lightColors[MAX_OBJECT_LIGHTS];
+uniform vec4 lightAttenuations[MAX_OBJECT_LIGHTS]; // constant, linear, quadratic, radius
+
+// smooth falloff that brings a light's attenuation to exactly zero at its radius
+float RadiusWindow(float distance, float radius)
+{
+    float x = distance / radius;
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    return window * window;
+}
+
+vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir, float numLayers, int reliefSteps)
 {
-    // number of depth layers
-    const float minLayers = 8;
-    const float maxLayers = 32;
-    float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));
     // calculate the size of each layer
     float layerDepth = 1.0 / numLayers;
     // depth of current layer
@@ -32,6 +65,7 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
     // get initial values
     vec2  currentTexCoords     = texCoords;
     float currentDepthMapValue = texture(depthMap, currentTexCoords).r;
+    fetches++;
 
     while(currentLayerDepth < currentDepthMapValue)
     {
@@ -39,15 +73,16 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
         currentTexCoords -= deltaTexCoords;
         // get depthmap value at current texture coordinates
         currentDepthMapValue = texture(depthMap, currentTexCoords).r;
+        fetches++;
         // get depth of next layer
         currentLayerDepth += layerDepth;
     }
 
     //relief PM
-    const int reliefSteps = 6;
     int currentStep = reliefSteps;
     while (currentStep > 0) {
         currentDepthMapValue = texture(depthMap, currentTexCoords).r;
+        fetches++;
         deltaTexCoords *= 0.5;
         layerDepth *= 0.5;
         // move to the left part of interval,
@@ -66,34 +101,104 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
     return currentTexCoords;
 }
 
+vec2 ConeStepMapping(vec2 texCoords, vec3 viewDir, int coneSteps, int binarySteps)
+{
+    // the ray shifts the texture coordinates by P per unit of depth, like the layers above
+    vec3 ray = vec3(-viewDir.xy / viewDir.z * heightScale, 1.0);
+    float rayRatio = length(ray.xy);
+    vec3 position = vec3(texCoords, 0.0);
+    vec3 previous = position;
+    float height = 0.0;
+    // step to the boundary of the relaxed cone below, this may end inside the relief but not past the first intersection
+    for (int i = 0; i < coneSteps; ++i)
+    {
+        vec2 cone = texture(coneMap, position.xy).rg;
+        fetches++;
+        height = cone.r - position.z;
+        if (height <= 0.0)
+            break;
+        float coneRatio = cone.g * cone.g;
+        previous = position;
+        position += ray * (coneRatio * height / (rayRatio + coneRatio));
+    }
+    // narrow grooves converge slowly: if still above, jump by the remaining height and let the search refine it
+    if (height > 0.0)
+    {
+        previous = position;
+        position += ray * height;
+    }
+    // binary search between the last point above and the point below the surface
+    for (int i = 0; i < binarySteps; ++i)
+    {
+        vec3 middle = (previous + position) * 0.5;
+        fetches++;
+        if (texture(coneMap, middle.xy).r > middle.z)
+            previous = middle;
+        else
+            position = middle;
+    }
+    return position.xy;
+}
+
 void main()
 {
     // offset texture coordinates with Parallax Mapping
     vec3 viewDir = normalize(fs_in.TangentViewPos - fs_in.TangentFragPos);
     vec2 texCoords = fs_in.TexCoords;
 
-    texCoords = ParallaxMapping(fs_in.TexCoords,  viewDir);
+    // full detail: layers by view angle only
+    float numLayers = mix(float(MAX_PARALLAX_LAYERS), float(MAX_PARALLAX_LAYERS) / 4.0, abs(viewDir.z));
+    int reliefSteps = MAX_RELIEF_STEPS;
+    bool parallax = true;
+    // the derivatives map the whole parallax shift to screen pixels, covering distance, resolution and foreshortening
+    mat2 pixelToTexture = mat2(dFdx(fs_in.TexCoords), dFdy(fs_in.TexCoords));
+    if (parallaxLod)
+    {
+        vec2 P = viewDir.xy / max(viewDir.z, 0.01) * heightScale;
+        float parallaxPixels = abs(determinant(pixelToTexture)) > 1e-14 ? length(inverse(pixelToTexture) * P) : 1e6;
+        parallax = parallaxPixels >= minParallaxPixels;
+        numLayers = clamp(ceil(parallaxPixels / parallaxPixelsPerLayer), 2.0, float(MAX_PARALLAX_LAYERS));
+        // every relief step halves a layer, stop once it is under half a pixel
+        reliefSteps = int(clamp(ceil(log2(2.0 * parallaxPixels / numLayers)), 0.0, float(MAX_RELIEF_STEPS)));
+    }
+
+    if (parallax)
+        texCoords = coneStepMapping ? ConeStepMapping(fs_in.TexCoords, viewDir, min(int(numLayers), 10), min(reliefSteps, 5))
+                                    : ParallaxMapping(fs_in.TexCoords, viewDir, numLayers, reliefSteps);
+    if (countFetches)
+    {
+        // fetches, coverage, normal mapping fallback
+        FragColor = vec4(float(fetches) / 255.0, 1.0, parallax ? 0.0 : 1.0, 1.0);
+        return;
+    }
     if(texCoords.x > 1.0 || texCoords.y > 1.0 || texCoords.x < 0.0 || texCoords.y < 0.0)
     discard;
 
-    // obtain normal from normal map
-    vec3 normal = texture(normalMap, texCoords).rgb;
-    normal = normalize(normal * 2.0 - 1.0);
+    // obtain normal from normal map, z from x and y: cooked BC5 normal maps store only those
+    vec3 normal;
+    normal.xy = texture(normalMap, texCoords).rg * 2.0 - 1.0;
+    normal.z = sqrt(max(1.0 - dot(normal.xy, normal.xy), 0.0));
+    normal = normalize(normal);
 
     // get diffuse color
     vec3 color = texture(diffuseMap, texCoords).rgb;
     // ambient
-    vec3 ambient = 0.1 * color;
-    // diffuse
-    vec3 lightDir = normalize(fs_in.TangentLightPos - fs_in.TangentFragPos);
-    float diff = max(dot(lightDir, normal), 0.0);
-    vec3 diffuse = diff * color;
-    // specular    
-    vec3 reflectDir = reflect(-lightDir, normal);
-    vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), 32.0);
-
-    vec3 specular = vec3(0.2) * spec;
-    FragColor = vec4(ambient + diffuse + specular, 1.0);
+    vec3 result = 0.1 * color;
+    for (int i = 0; i < lightCount; ++i)
+    {
+        vec3 tangentLightPos = fs_in.TBN * lightPositions[i];
+        float distance = length(tangentLightPos - fs_in.TangentFragPos);
+        vec4 terms = lightAttenuations[i];
+        float attenuation = RadiusWindow(distance, terms.w) / (terms.x + terms.y * distance + terms.z * distance * distance);
+        // diffuse
+        vec3 lightDir = normalize(tangentLightPos - fs_in.TangentFragPos);
+        float diff = max(dot(lightDir, normal), 0.0);
+        vec3 diffuse = diff * color;
+        // specular
+        vec3 halfwayDir = normalize(lightDir + viewDir);
+        float spec = pow(max(dot(normal, halfwayDir), 0.0), 32.0);
+        vec3 specular = vec3(0.2) * spec;
+        result += (diffuse + specular) * lightColors[i] * attenuation;
+    }
+    FragColor = vec4(result, 1.0);
 }
-
@@ -12,10 +12,30 @@
 #include <helpers/filesystem.h>
 #include <helpers/shader.h>
 #include <helpers/camera.h>
+#include <helpers/cascaded_shadows.h>
+#include <helpers/cone_step.h>
+#include <helpers/culling.h>
+#include <helpers/dynamic_resolution.h>
+#include <helpers/evsm.h>
+#include <helpers/gbuffer.h>
+#include <helpers/gpu_timer.h>
+#include <helpers/hdr_target.h>
+#include <helpers/lights.h>
+#include <helpers/light_grid.h>
+#include <helpers/point_shadow.h>
+#include <helpers/quality_governor.h>
+#include <helpers/shadow_atlas.h>
+#include <helpers/spherical_harmonics.h>
+#include <helpers/texture_manager.h>
+#include <helpers/thread_pool.h>
 
 #include "../objects.h"
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -23,28 +43,75 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-unsigned int loadTexture(const char *path);
-unsigned int loadCubemap(std::vector<std::string> faces);
-void renderFloor();
-void renderCube();
+unsigned int loadConeStepTexture(const char *path, ThreadPool &pool);
+void renderFloor(unsigned int instances = 1);
+void renderCube(unsigned int instances = 1);
 void renderWall();
-void renderScene(const Shader &shader, unsigned int flDiffuse, unsigned int flSpecular,
-                 unsigned int cDiffuse, unsigned int cSpecular, unsigned int cEmission);
+enum SceneObjects { ALL_OBJECTS, STATIC_OBJECTS, DYNAMIC_OBJECTS };
+struct SceneObject;
+std::vector<SceneObject> sceneObjects(SceneObjects objects);
+std::vector<ShadowCaster> shadowCasters(SceneObjects objects);
+void renderScene(const Shader &shader, const TextureHandle &flDiffuse, const TextureHandle &flSpecular,
+                 const TextureHandle &cDiffuse, const TextureHandle &cSpecular, const TextureHandle &cEmission, SceneObjects objects = ALL_OBJECTS);
 void renderSkybox();
-void renderSphere(int xSeg = 64, int ySeg = 64);
+void renderSphere(int xSeg = 64, int ySeg = 64, unsigned int instances = 1);
 void renderTorus(double r = 0.2, double c = 0.45,
                  int rSeg = 64, int cSeg = 32);
+std::vector<PointLight> buildSceneLights(unsigned int count);
+void updateBenchmark(GpuTimer &timer, std::vector<std::string> &results);
+void reportParallaxFetches(Shader &parallaxShader, const glm::mat4 &view);
 
 // settings
 const unsigned int SCR_WIDTH = 1920;
 const unsigned int SCR_HEIGHT = 1000;
 float heightScale = 0.1;
+float parallaxPixelsPerLayer = 4.0f; // adjust with Z and X keys
 const float PI = 3.14159265359;
 const float TAU = 2 * PI;
 
 bool filling = false; //press SPACE to see scene without textures
 bool shadows = true;
 bool shadowsKeyPressed = false; //press H to enable/disable shadows
+const unsigned int lightCounts[] = {4, 64, 512, 4096};
+unsigned int lightCountIndex = 0;
+bool lightsKeyPressed = false; //press L to cycle the number of point lights
+bool deferred = false;
+bool deferredKeyPressed = false; //press R to switch between forward and deferred shading
+int benchmarkStep = -1;
+bool benchmarkKeyPressed = false; //press B to compare forward and deferred frame times for every light count
+bool dynamicResolution = true;
+bool dynamicResolutionKeyPressed = false; //press M to switch between dynamic and full resolution
+const float upscaleSharpness = 0.5f;
+bool lightPaused = false;
+bool pauseKeyPressed = false; //press P to stop the shadow casting light, its cached shadow map is reused then
+float lightTime = 0.0f;
+int shadowMode = SHADOW_PER_FACE;
+bool vertexLayerShadows = false;
+bool shadowModeKeyPressed = false; //press G to cycle geometry shader / per-face culled / layered instanced shadow passes
+bool shadowStatsPending = true;
+bool shadowSamplesPending = false;
+bool shadowSamplesKeyPressed = false; //press T to cycle the number of hardware-filtered shadow taps
+const unsigned int QUALITY_ADAPTIVE = 4; // after the presets low, medium, high and ultra
+unsigned int qualityMode = QUALITY_ADAPTIVE;
+bool qualityModePending = true;
+bool qualityKeyPressed = false; //press O to cycle the quality presets and the adaptive quality governor
+bool coneStepParallax = true;
+bool coneStepKeyPressed = false; //press K to switch the parallax wall between layer search and relaxed cone stepping
+bool parallaxLod = true;
+bool parallaxLodKeyPressed = false; //press J to switch the parallax level of detail by screen footprint on and off
+bool parallaxReportPending = false;
+bool parallaxReportKeyPressed = false; //press N to print the wall's depth map fetches per pixel at several distances
+bool shAmbientLight = true;
+bool shAmbientKeyPressed = false; //press U to switch the sky's spherical harmonics ambient light on and off
+bool evsmShadows = false;
+bool evsmKeyPressed = false; //press V to switch the main light between PCF and prefiltered EVSM shadows
+int atlasProjection = OMNI_AUTO;
+bool atlasProjectionKeyPressed = false; //press Y to force cube or tetrahedral shadows for the atlas lights
+unsigned int sunCascades = 4;
+bool cascadesKeyPressed = false; //press C to cycle between 2, 3 and 4 sun shadow cascades
+const glm::vec3 sunDirection = glm::normalize(glm::vec3(-1.0f, -0.7f, -0.4f)); // low evening sun
+const glm::vec3 sunColor(0.5f, 0.3f, 0.15f);
+unsigned int staticSceneVersion = 0; //bump whenever static geometry changes to invalidate cached shadows
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 5.0f));
@@ -57,11 +124,13 @@ float deltaTime = 0.0f;    // time between current frame and last frame
 float lastFrame = 0.0f;
 
 int main() {
+    std::chrono::steady_clock::time_point startupBegin = std::chrono::steady_clock::now();
     // glfw: initialize and configure
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_SRGB_CAPABLE, GL_TRUE); // the tonemap pass relies on GL_FRAMEBUFFER_SRGB for gamma
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // uncomment this statement to fix compilation on OS X
@@ -92,87 +161,171 @@ int main() {
 
     // configure global opengl state
     glEnable(GL_DEPTH_TEST);
+    // filtered lookups of the EVSM moments cubemap blend across face edges
+    glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    // lighting is linear: color textures are decoded from sRGB on sampling and encoded again on the final write
+    glEnable(GL_FRAMEBUFFER_SRGB);
+
+    // decode every image on the pool while the shaders compile, uploaded by textures.finish()
+    ThreadPool threadPool;
+    TextureManager textures(threadPool);
+    TextureHandle floorTexture     = textures.load(FileSystem::getPath("resources/textures/wood.png"), true);
+    TextureHandle floorSpecularMap = textures.load(FileSystem::getPath("resources/textures/wood_specular.png"));
+
+    TextureHandle boxDiffuseMap  = textures.load(FileSystem::getPath("resources/textures/container2.png"), true);
+    TextureHandle boxSpecularMap = textures.load(FileSystem::getPath("resources/textures/container2_specular.png"));
+    TextureHandle boxEmissionMap = textures.load(FileSystem::getPath("resources/textures/container2_neon.jpg"), true);
+
+    TextureHandle groundDiffuseMap = textures.load(FileSystem::getPath("resources/textures/pbr/acoustic/albedo.jpg"), true);
+    TextureHandle groundNormalMap  = textures.load(FileSystem::getPath("resources/textures/pbr/acoustic/normal.jpg"));
+    TextureHandle groundHeightMap  = textures.load(FileSystem::getPath("resources/textures/pbr/acoustic/displacement.png"));
+
+    std::vector<std::string> faces
+            {
+                    FileSystem::getPath("resources/textures/skybox/right.tga"),
+                    FileSystem::getPath("resources/textures/skybox/left.tga"),
+                    FileSystem::getPath("resources/textures/skybox/top.tga"),
+                    FileSystem::getPath("resources/textures/skybox/bottom.tga"),
+                    FileSystem::getPath("resources/textures/skybox/front.tga"),
+                    FileSystem::getPath("resources/textures/skybox/back.tga")
+            };
+    TextureHandle cubemapTexture = textures.loadCubemap(faces, true);
+    // the sky again as floats for its spherical harmonics
+    CubeImage skyEnvironment;
+    bool skyLoaded = false;
+    std::future<void> skyDecode = threadPool.submit([&] { skyLoaded = loadCubeImage(faces, 32, skyEnvironment); });
+
+    // quality settings, cheapest level first; the weights guess the relative cost of a level until it is measured
+    QualityGovernor governor(1000.0f / 60.0f);
+    const unsigned int shadowSizeSetting = governor.addSetting("shadow map size", {512, 1024, 2048}, {1.0f, 4.0f, 16.0f});
+    const unsigned int shadowSamplesSetting = governor.addSetting("PCF taps", {1, 4, 8, 20}, {2.0f, 5.0f, 9.0f, 21.0f});
+    const unsigned int parallaxSetting = governor.addSetting("parallax layers", {8, 16, 32}, {10.0f, 20.0f, 38.0f});
+    const int reliefStepLevels[] = {2, 4, 6}; // with the parallax layers of the same level
+    governor.addPreset("low", {0, 0, 0});
+    governor.addPreset("medium", {1, 1, 1});
+    governor.addPreset("high", {1, 2, 2});
+    governor.addPreset("ultra", {2, 3, 2});
+    governor.setMode(2); // the adaptive governor starts from high
 
     // build and compile shaders
     Shader skyboxShader("skybox_vert.glsl", "skybox_frag.glsl");
     Shader lightingShader("basic_vert.glsl", "lights_frag.glsl");
     Shader lampShader("basic_vert.glsl", "lamp_frag.glsl");
-    Shader shadowShader("shadow_mapping_vert.glsl", "shadow_mapping_frag.glsl");
+    // a permutation for every PCF tap count and parallax level, so the governor never waits for a compile
+    std::vector<Shader> shadowShaders;
+    for (int taps : governor.settings[shadowSamplesSetting].values)
+        shadowShaders.emplace_back("shadow_mapping_vert.glsl", "shadow_mapping_frag.glsl", nullptr,
+                                   "#define SHADOW_SAMPLES " + std::to_string(taps) + "\n");
+    std::vector<Shader> parallaxShaders;
+    for (unsigned int level = 0; level < governor.settings[parallaxSetting].values.size(); ++level)
+        parallaxShaders.emplace_back("parallax_mapping_vert.glsl", "parallax_mapping_frag.glsl", nullptr,
+                                     "#define MAX_PARALLAX_LAYERS " + std::to_string(governor.settings[parallaxSetting].values[level])
+                                     + "\n#define MAX_RELIEF_STEPS " + std::to_string(reliefStepLevels[level]) + "\n");
     Shader shadowDepthShader("shadow_mapping_depth_vert.glsl", "shadow_mapping_depth_frag.glsl", "shadow_mapping_depth_geom.glsl");
-    Shader parallaxShader("parallax_mapping_vert.glsl", "parallax_mapping_frag.glsl");
-
-    // configure depth map FBO
-    const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
-    unsigned int depthMapFBO;
-    glGenFramebuffers(1, &depthMapFBO);
-    // create depth cubemap texture
-    unsigned int depthCubemap;
-    glGenTextures(1, &depthCubemap);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
-    for (unsigned int i = 0; i < 6; ++i)
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    // attach depth texture as FBO's depth buffer
-    glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCubemap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-
-    //shader configuration
-    shadowShader.use();
-    shadowShader.setInt("diffuseTexture", 0);
-    shadowShader.setInt("shadowMap", 1);
-
-    //load textures
-    unsigned int floorTexture     = loadTexture(FileSystem::getPath("resources/textures/wood.png").c_str());
-    unsigned int floorSpecularMap = loadTexture(FileSystem::getPath("resources/textures/wood_specular.png").c_str());
-
-    unsigned int boxDiffuseMap  = loadTexture(FileSystem::getPath("resources/textures/container2.png").c_str());
-    unsigned int boxSpecularMap = loadTexture(FileSystem::getPath("resources/textures/container2_specular.png").c_str());
-    unsigned int boxEmissionMap = loadTexture(FileSystem::getPath("resources/textures/container2_neon.jpg").c_str());
-
-    unsigned int groundDiffuseMap = loadTexture(FileSystem::getPath("resources/textures/pbr/acoustic/albedo.jpg").c_str());
-    unsigned int groundNormalMap  = loadTexture(FileSystem::getPath("resources/textures/pbr/acoustic/normal.jpg").c_str());
-    unsigned int groundHeightMap  = loadTexture(FileSystem::getPath("resources/textures/pbr/acoustic/displacement.png").c_str());
+    Shader shadowFaceShader("shadow_mapping_face_vert.glsl", "shadow_mapping_depth_frag.glsl");
+    std::unique_ptr<Shader> shadowLayerShader;
+    vertexLayerShadows = PointShadowMap::vertexLayerSupported();
+    if (vertexLayerShadows) {
+        shadowLayerShader.reset(new Shader("shadow_mapping_layer_vert.glsl", "shadow_mapping_depth_frag.glsl"));
+        shadowMode = SHADOW_LAYERED;
+    }
+    Shader cascadeDepthShader("shadow_mapping_depth_vert.glsl", "cascade_depth_frag.glsl", "cascade_depth_geom.glsl");
+    Shader *shadowPassShaders[3] = {&shadowDepthShader, &shadowFaceShader, shadowLayerShader.get()};
+    Shader evsmBlurShader("evsm_quad_vert.glsl", "evsm_blur_frag.glsl");
+    Shader tonemapShader("evsm_quad_vert.glsl", "tonemap_frag.glsl");
+    Shader gBufferShader("basic_vert.glsl", "gbuffer_frag.glsl");
+    Shader deferredLightShader("deferred_light_vert.glsl", "deferred_light_frag.glsl");
+
+    // depth cubemap of the shadow casting light, static casters are cached between frames
+    PointShadowMap pointShadow(1024, 1.0f, 25.0f);
+    // prefiltered moments of that cubemap, only refiltered where the depth changed
+    EvsmCubemap evsmShadow;
+    // shadow maps of the four scene lights, sized by screen coverage within a fixed budget
+    ShadowAtlas shadowAtlas;
+    std::vector<PointLight> shadowLights = buildSceneLights(4);
+    // sun shadows covering the whole floor
+    CascadedShadowMap sunShadow;
+    std::cout << "Shadow atlas: " << shadowAtlas.width() << "x" << shadowAtlas.height() << ", "
+              << shadowAtlas.memoryBytes() / (1024 * 1024) << " MB" << std::endl;
+    std::cout << "Main light shadows: PCF " << 2 * pointShadow.size * pointShadow.size * 6 * 4 / (1024 * 1024) << " MB, EVSM "
+              << evsmShadow.memoryBytes() / (1024 * 1024) << " MB more" << std::endl;
+
+
+    // upload the images as their decodes finish
+    textures.finish();
 
     // shader configuration
-    shadowShader.use();
-    shadowShader.setInt("diffuseTexture", 0);
-    shadowShader.setInt("depthMap", 1);
+    for (Shader &shadowShader : shadowShaders) {
+        shadowShader.use();
+        shadowShader.setInt("diffuseTexture", 0);
+        shadowShader.setInt("depthMap", 1);
+        shadowShader.setInt("shadowAtlas", 2);
+        shadowShader.setInt("momentsMap", 4);
+    }
 
     lightingShader.use();
     lightingShader.setInt("material.diffuse", 0);
     lightingShader.setInt("material.specular", 1);
     lightingShader.setInt("material.emission", 2);
 
-    parallaxShader.use();
-    parallaxShader.setInt("diffuseMap", 0);
-    parallaxShader.setInt("normalMap", 1);
-    parallaxShader.setInt("depthMap", 2);
+    for (Shader &parallaxShader : parallaxShaders) {
+        parallaxShader.use();
+        parallaxShader.setInt("diffuseMap", 0);
+        parallaxShader.setInt("normalMap", 1);
+        parallaxShader.setInt("depthMap", 2);
+        parallaxShader.setInt("coneMap", 3);
+    }
+
+    gBufferShader.use();
+    gBufferShader.setInt("material.diffuse", 0);
+    gBufferShader.setInt("material.specular", 1);
+    gBufferShader.setInt("material.emission", 2);
+
+    deferredLightShader.use();
+    deferredLightShader.setInt("gAlbedoSpec", 0);
+    deferredLightShader.setInt("gNormal", 1);
+    deferredLightShader.setInt("gDepth", 2);
+    deferredLightShader.setInt("lightData", 3);
+    deferredLightShader.setFloat("shininess", 64.0f);
 
     lampShader.use();
     lampShader.setInt("lightColor", 0);
 
-    //load skybox textures
-    std::vector<std::string> faces
-            {
-                    FileSystem::getPath("resources/textures/skybox/right.tga"),
-                    FileSystem::getPath("resources/textures/skybox/left.tga"),
-                    FileSystem::getPath("resources/textures/skybox/top.tga"),
-                    FileSystem::getPath("resources/textures/skybox/bottom.tga"),
-                    FileSystem::getPath("resources/textures/skybox/front.tga"),
-                    FileSystem::getPath("resources/textures/skybox/back.tga")
-            };
-    unsigned int cubemapTexture = loadCubemap(faces);
     skyboxShader.use();
     skyboxShader.setInt("skybox", 0);
 
+    // clustered point lights
+    LightGrid lightGrid(threadPool);
+    // acceleration map of the wall's relief, baked once and cached next to the depth map
+    unsigned int groundConeMap = loadConeStepTexture(FileSystem::getPath("resources/textures/pbr/acoustic/displacement.png").c_str(), threadPool);
+    // ambient light of the sky, update projects again only the faces of skyEnvironment that changed
+    ShAmbient skyAmbient;
+    skyDecode.get();
+    if (skyLoaded)
+        skyAmbient.update(skyEnvironment, threadPool);
+    else
+        std::cout << "ERROR::SH_AMBIENT::SKY_NOT_LOADED" << std::endl;
+    for (Shader &shadowShader : shadowShaders)
+        skyAmbient.bind(shadowShader);
+    skyAmbient.bind(lightingShader);
+    skyAmbient.bind(gBufferShader);
+    std::vector<PointLight> sceneLights;
+    std::vector<PointLight> visibleLights;
+    const float near_view = 0.1f, far_view = 1000.0f;
+    GBuffer gBuffer;
+    HdrTarget hdrTarget;
+    // render scale that holds 60 fps on the GPU, full resolution while benchmarking
+    DynamicResolution resolutionController(1000.0f / 60.0f);
+
+    // frame time statistics
+    GpuTimer frameTimer;
+    float statsTime = 0.0f;
+    std::vector<std::string> benchmarkResults;
+
+    std::cout << "Startup: " << std::chrono::duration<double>(std::chrono::steady_clock::now() - startupBegin).count() << " s, "
+              << textures.decodedImages() << " images decoded on " << threadPool.size() << " worker threads" << std::endl;
+    textures.report(std::cout);
+
     // render loop
     while (!glfwWindowShouldClose(window)) {
         // per-frame time logic
@@ -182,45 +335,94 @@ int main() {
 
         // input
         processInput(window);
-
-        // render
+        // textures requested since startup stream in a few MB a frame
+        textures.poll();
+        updateBenchmark(frameTimer, benchmarkResults);
+        frameTimer.begin();
+
+        // render, the scene is lit into the floating point target and tonemapped into the window at the end
+        int framebufferWidth, framebufferHeight;
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        hdrTarget.resize(framebufferWidth, framebufferHeight);
+        bool scaled = dynamicResolution && benchmarkStep < 0;
+        if (scaled)
+            resolutionController.update(frameTimer);
+        hdrTarget.setRenderScale(scaled ? resolutionController.scale : 1.0f);
+
+        // quality: presets or the closed loop, which only acts once the resolution is at its limit
+        if (qualityModePending) {
+            governor.setMode(qualityMode);
+            std::cout << "Quality: " << governor.modeName() << std::endl;
+            qualityModePending = false;
+        }
+        if (shadowSamplesPending) {
+            governor.setLevel(shadowSamplesSetting, (governor.level(shadowSamplesSetting) + 1) % shadowShaders.size());
+            std::cout << "Shadow taps: " << governor.value(shadowSamplesSetting) << std::endl;
+            shadowSamplesPending = false;
+        }
+        governor.update(frameTimer, benchmarkStep < 0 && (!scaled || resolutionController.scale <= resolutionController.minScale),
+                        benchmarkStep < 0 && (!scaled || resolutionController.scale >= resolutionController.maxScale));
+        pointShadow.resize(governor.value(shadowSizeSetting));
+        Shader &shadowShader = shadowShaders[governor.level(shadowSamplesSetting)];
+        Shader &parallaxShader = parallaxShaders[governor.level(parallaxSetting)];
         glClearColor(0.2f, 0.6f, 0.8f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         //init uniforms
+        float aspect = (float)std::max(framebufferWidth, 1) / (float)std::max(framebufferHeight, 1);
         glm::mat4 model = glm::mat4(1.0f);
         glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 1000.0f);
+        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), aspect, near_view, far_view);
 
         if (shadows) {
             // 0. create depth cubemap transformation matrices
             // only ONE light source used for shadow!
-            glm::vec3 lightPos(3.0, 1.0, sin(glfwGetTime() * 0.5) * 3.0);
-            float near_plane = 1.0f;
-            float far_plane = 25.0f;
-            glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT, near_plane, far_plane);
-            std::vector<glm::mat4> shadowTransforms;
-            shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-            shadowTransforms.push_back(shadowProj * glm::lookAt(lightPos, lightPos + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-
-            // 1. render scene to depth cubemap
-            glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-            glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-            glClear(GL_DEPTH_BUFFER_BIT);
-            shadowDepthShader.use();
-            for (unsigned int i = 0; i < 6; ++i)
-                shadowDepthShader.setMat4("shadowMatrices[" + std::to_string(i) + "]", shadowTransforms[i]);
-            shadowDepthShader.setFloat("far_plane", far_plane);
-            shadowDepthShader.setVec3("lightPos", lightPos);
-            renderScene(shadowDepthShader, floorTexture, floorSpecularMap, boxDiffuseMap, boxSpecularMap, boxEmissionMap);
+            if (!lightPaused)
+                lightTime += deltaTime;
+            glm::vec3 lightPos(3.0, 1.0, sin(lightTime * 0.5) * 3.0);
+            float far_plane = pointShadow.farPlane;
+            PointShadowMode mode = (PointShadowMode)shadowMode;
+
+            // 1.1 render static casters to the cached depth cubemap, only when the light or static geometry changed
+            governor.begin(shadowSizeSetting);
+            if (pointShadow.beginStaticPass(lightPos, staticSceneVersion))
+                pointShadow.renderCasters(shadowCasters(STATIC_OBJECTS), lightPos, mode, *shadowPassShaders[mode]);
+            // 1.2 copy the cached depth and add the moving casters on top
+            pointShadow.beginDynamicPass();
+            pointShadow.renderCasters(shadowCasters(DYNAMIC_OBJECTS), lightPos, mode, *shadowPassShaders[mode]);
+            governor.end(shadowSizeSetting);
             glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            if (shadowStatsPending) {
+                const char *modeNames[3] = {"geometry shader", "per-face culled", "layered instanced"};
+                std::cout << "Shadow pass: " << modeNames[mode] << ", triangles per face";
+                for (unsigned int face = 0; face < 6; ++face)
+                    std::cout << " " << pointShadow.faceTriangles[face];
+                std::cout << ", total " << pointShadow.triangles() << " (geometry shader: " << 6 * pointShadow.casterTriangles << ")" << std::endl;
+                shadowStatsPending = false;
+            }
+            // convert the changed faces to blurred, mipmapped moments; stale while PCF is used
+            if (evsmShadows)
+                evsmShadow.update(pointShadow.texture(), pointShadow.changedFaces(), evsmBlurShader);
+            else
+                evsmShadow.invalidate();
+
+            // 1.3 refresh a few atlas tiles of the scene lights, the rest keep last frame's shadows
+            for (unsigned int i = 0; i < shadowLights.size(); i++)
+                shadowAtlas.setProjection(i, (OmniProjection)atlasProjection);
+            std::vector<unsigned int> atlasUpdates = shadowAtlas.update(shadowLights, camera.Position, Frustum(projection * view), glm::radians(camera.Zoom));
+            if (!atlasUpdates.empty()) {
+                std::vector<ShadowCaster> casters = shadowCasters(ALL_OBJECTS);
+                for (unsigned int light : atlasUpdates)
+                    shadowAtlas.render(light, casters, shadowFaceShader);
+            }
+
+            // 1.4 sun cascades, all layers in one pass
+            sunShadow.setCascadeCount(sunCascades);
+            sunShadow.update(view, glm::radians(camera.Zoom), aspect, near_view, sunDirection);
+            sunShadow.render(shadowCasters(ALL_OBJECTS), cascadeDepthShader);
 
             // 2.1 render scene using the generated depth/shadow map
-            glViewport(0, 0, SCR_WIDTH * 2, SCR_HEIGHT * 2);
+            governor.begin(shadowSamplesSetting);
+            hdrTarget.bind();
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
             shadowShader.use();
             shadowShader.setMat4("projection", projection);
@@ -228,20 +430,38 @@ int main() {
             shadowShader.setVec3("lightPos", lightPos);
             shadowShader.setVec3("viewPos", camera.Position);
             shadowShader.setFloat("far_plane", far_plane);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, floorTexture);
+            shadowShader.setBool("evsm", evsmShadows);
+            shadowShader.setBool("shAmbient", shAmbientLight);
+            shadowShader.setFloat("momentsBlur", 2.0f * evsmShadow.blurRadius + 1.0f);
+            glActiveTexture(GL_TEXTURE4);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, evsmShadow.moments);
+            shadowShader.setVec3("sunDirection", sunDirection);
+            shadowShader.setVec3("sunColor", sunColor);
+            sunShadow.setUniforms(shadowShader, 3);
+            shadowShader.setInt("atlasLightCount", shadowLights.size());
+            for (unsigned int i = 0; i < shadowLights.size(); i++) {
+                const PointLight &light = shadowLights[i];
+                shadowShader.setVec3("lightPositions[" + std::to_string(i) + "]", light.position);
+                shadowShader.setVec3("lightColors[" + std::to_string(i) + "]", light.color);
+                shadowShader.setVec4("lightAttenuations[" + std::to_string(i) + "]", glm::vec4(light.constant, light.linear, light.quadratic, light.radius));
+                shadowShader.setVec4("lightShadowTiles[" + std::to_string(i) + "]", shadowAtlas.tileTransform(i));
+                shadowShader.setFloat("lightFarPlanes[" + std::to_string(i) + "]", shadowAtlas.tiles[i].farPlane);
+                shadowShader.setBool("lightTetrahedral[" + std::to_string(i) + "]", shadowAtlas.tiles[i].projection == OMNI_TETRAHEDRAL);
+            }
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, shadowAtlas.texture);
+            bindTexture(0, floorTexture);
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, pointShadow.texture());
             //render floor
             model = glm::mat4(1.0f);
             shadowShader.setMat4("model", model);
             renderFloor();
 
             // bind cubes diffuse map
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, boxDiffuseMap);
+            bindTexture(0, boxDiffuseMap);
             glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, depthCubemap);
+            glBindTexture(GL_TEXTURE_CUBE_MAP, pointShadow.texture());
             // render boxes
             for (unsigned int i = 0; i < 4; i++) {
                 float angle = 15.0f;
@@ -251,38 +471,88 @@ int main() {
                 shadowShader.setMat4("model", model);
                 renderCube();
             }
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            unbindSamplers(0, 1);
+            governor.end(shadowSamplesSetting);
         } else {
             // 2.2 render scene with other lights
-            glViewport(0, 0, SCR_WIDTH * 2, SCR_HEIGHT * 2);
+            hdrTarget.bind();
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            lightingShader.use();
-            lightingShader.setMat4("projection", projection);
-            lightingShader.setMat4("view", view);
-            lightingShader.setVec3("viewPos", camera.Position);
-            lightingShader.setFloat("material.shininess", 64.0f);
-            lightingShader.setFloat("time", glfwGetTime());
-            //point lights
-            for (int i = 0; i < 4; i++) {
-                lightingShader.setVec3("pointLights[" + std::to_string(i) + "].position", pointLightPositions[i]);
-                lightingShader.setVec3("pointLights["  + std::to_string(i) + "].ambient", pointLightColors[i].x * 0.1,  pointLightColors[i].y  * 0.1,  pointLightColors[i].z * 0.1);
-                lightingShader.setVec3("pointLights["  + std::to_string(i) + "].diffuse", pointLightColors[i].x,  pointLightColors[i].y,  pointLightColors[i].z);
-                lightingShader.setVec3("pointLights["  + std::to_string(i) + "].specular", pointLightColors[i].x,  pointLightColors[i].y,  pointLightColors[i].z);
-                lightingShader.setFloat("pointLights["  + std::to_string(i) + "].constant", 1.0f);
-                lightingShader.setFloat("pointLights["  + std::to_string(i) + "].linear", 0.09);
-                lightingShader.setFloat("pointLights["  + std::to_string(i) + "].quadratic", 0.032);
+            if (sceneLights.size() != lightCounts[lightCountIndex])
+                sceneLights = buildSceneLights(lightCounts[lightCountIndex]);
+            // only lights whose radius reaches into the view frustum are shaded
+            Frustum viewFrustum(projection * view);
+            cullLights(sceneLights, viewFrustum, visibleLights);
+            if (!deferred) {
+                lightingShader.use();
+                lightingShader.setMat4("projection", projection);
+                lightingShader.setMat4("view", view);
+                lightingShader.setVec3("viewPos", camera.Position);
+                lightingShader.setFloat("material.shininess", 64.0f);
+                lightingShader.setFloat("time", glfwGetTime());
+                lightingShader.setBool("shAmbient", shAmbientLight);
+                //point lights, assigned to view clusters
+                lightGrid.update(visibleLights, view, glm::radians(camera.Zoom), aspect, near_view, far_view);
+                lightGrid.bind(3);
+                lightGrid.setUniforms(lightingShader, 3, glm::vec2(hdrTarget.renderWidth, hdrTarget.renderHeight));
+                renderScene(lightingShader, floorTexture, floorSpecularMap, boxDiffuseMap, boxSpecularMap, boxEmissionMap);
+            } else {
+                // 2.2.1 geometry pass: albedo, specular, normal and depth into the G-buffer, emission into the light buffer
+                gBuffer.resize(hdrTarget.width, hdrTarget.height);
+                gBuffer.setRenderSize(hdrTarget.renderWidth, hdrTarget.renderHeight);
+                gBuffer.bindGeometryPass();
+                glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                gBufferShader.use();
+                gBufferShader.setMat4("projection", projection);
+                gBufferShader.setMat4("view", view);
+                gBufferShader.setFloat("time", glfwGetTime());
+                gBufferShader.setBool("shAmbient", shAmbientLight);
+                renderScene(gBufferShader, floorTexture, floorSpecularMap, boxDiffuseMap, boxSpecularMap, boxEmissionMap);
+
+                // 2.2.2 light pass: one instanced sphere per light, only the back faces lying behind the surface shade it
+                gBuffer.bindLightPass();
+                deferredLightShader.use();
+                deferredLightShader.setMat4("projection", projection);
+                deferredLightShader.setMat4("view", view);
+                deferredLightShader.setMat4("inverseViewProjection", glm::inverse(projection * view));
+                deferredLightShader.setVec2("viewportSize", glm::vec2(gBuffer.renderWidth, gBuffer.renderHeight));
+                deferredLightShader.setVec3("viewPos", camera.Position);
+                lightGrid.uploadLightData(visibleLights);
+                lightGrid.bindLightData(3);
+                gBuffer.bindTextures(0);
+                glDepthMask(GL_FALSE);
+                glDepthFunc(GL_GEQUAL);
+                glEnable(GL_CULL_FACE);
+                glFrontFace(GL_CW); // the sphere strip is wound clockwise seen from outside
+                glCullFace(GL_FRONT);
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_ONE, GL_ONE);
+                renderSphere(16, 12, visibleLights.size());
+                glDisable(GL_BLEND);
+                glFrontFace(GL_CCW);
+                glCullFace(GL_BACK);
+                glDisable(GL_CULL_FACE);
+                glDepthFunc(GL_LESS);
+                glDepthMask(GL_TRUE);
+
+                // 2.2.3 copy lighting and depth to the HDR target, the remaining passes are forward
+                gBuffer.resolve(hdrTarget.FBO, hdrTarget.renderWidth, hdrTarget.renderHeight);
+                glViewport(0, 0, hdrTarget.renderWidth, hdrTarget.renderHeight);
+                glClearColor(0.2f, 0.6f, 0.8f, 1.0f);
             }
-            renderScene(lightingShader, floorTexture, floorSpecularMap, boxDiffuseMap, boxSpecularMap, boxEmissionMap);
 
             // 3. render lamps
             lampShader.use();
             lampShader.setMat4("projection", projection);
             lampShader.setMat4("view", view);
-            for (int i = 0; i < 4; i++) {
+            for (unsigned int i = 0; i < sceneLights.size(); i++) {
+                float lampSize = i < 4 ? 0.2f : 0.03f;
+                if (!viewFrustum.intersectsSphere(sceneLights[i].position, lampSize * 1.75f))
+                    continue;
                 model = glm::mat4(1.0f);
-                model = glm::translate(model, pointLightPositions[i]);
-                model = glm::scale(model, glm::vec3(0.2f));
-                lampShader.setVec3("lightColor", pointLightColors[i]);
+                model = glm::translate(model, sceneLights[i].position);
+                model = glm::scale(model, glm::vec3(lampSize));
+                lampShader.setVec3("lightColor", sceneLights[i].color);
                 lampShader.setMat4("model", model);
                 renderCube();
             }
@@ -296,15 +566,32 @@ int main() {
             model = glm::rotate(model, glm::radians((float)glfwGetTime() * -5.0f), glm::normalize(glm::vec3(1.0, 0.0, 1.0))); // rotate the quad to show parallax mapping from multiple directions
             parallaxShader.setMat4("model", model);
             parallaxShader.setVec3("viewPos", camera.Position);
-            parallaxShader.setVec3("lightPos", pointLightPositions[2]);
+            // per-object light list: the strongest lights that reach the wall
+            std::vector<unsigned int> wallLights = lightsAffecting(visibleLights, BoundingBox(glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f)).transformed(model), 4);
+            parallaxShader.setInt("lightCount", wallLights.size());
+            for (unsigned int i = 0; i < wallLights.size(); i++) {
+                const PointLight &light = visibleLights[wallLights[i]];
+                parallaxShader.setVec3("lightPositions[" + std::to_string(i) + "]", light.position);
+                parallaxShader.setVec3("lightColors[" + std::to_string(i) + "]", light.color);
+                parallaxShader.setVec4("lightAttenuations[" + std::to_string(i) + "]", glm::vec4(light.constant, light.linear, light.quadratic, light.radius));
+            }
             parallaxShader.setFloat("heightScale", heightScale); // adjust with Q and E keys
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, groundDiffuseMap);
-            glActiveTexture(GL_TEXTURE1);
-            glBindTexture(GL_TEXTURE_2D, groundNormalMap);
-            glActiveTexture(GL_TEXTURE2);
-            glBindTexture(GL_TEXTURE_2D, groundHeightMap);
+            parallaxShader.setBool("coneStepMapping", coneStepParallax && groundConeMap != 0);
+            parallaxShader.setBool("parallaxLod", parallaxLod);
+            parallaxShader.setFloat("parallaxPixelsPerLayer", parallaxPixelsPerLayer); // adjust with Z and X keys
+            bindTexture(0, groundDiffuseMap);
+            bindTexture(1, groundNormalMap);
+            bindTexture(2, groundHeightMap);
+            glActiveTexture(GL_TEXTURE3);
+            glBindTexture(GL_TEXTURE_2D, groundConeMap);
+            governor.begin(parallaxSetting);
             renderWall();
+            governor.end(parallaxSetting);
+            unbindSamplers(0, 3);
+            if (parallaxReportPending) {
+                reportParallaxFetches(parallaxShader, view);
+                parallaxReportPending = false;
+            }
         }
 
         // 4. render skybox as last
@@ -315,12 +602,38 @@ int main() {
         skyboxShader.setMat4("view", view);
         skyboxShader.setMat4("projection", projection);
         // skybox cube
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        bindTexture(0, cubemapTexture);
         renderSkybox();
+        unbindSamplers(0, 1);
         //glDepthMask(GL_TRUE);
         glDepthFunc(GL_FALSE); // set depth function back to default
 
+        // 5. tonemap and upscale into the window
+        hdrTarget.present(tonemapShader, upscaleSharpness);
+
+        frameTimer.end();
+        statsTime += deltaTime;
+        if (statsTime > 0.5f && benchmarkStep < 0) {
+            std::string mode = deferred ? "deferred" : "forward";
+            if (shadows)
+                mode = "shadows, cache skipped " + std::to_string(pointShadow.skippedUpdates) + "/" + std::to_string(pointShadow.frames)
+                        + ", " + std::to_string(pointShadow.triangles()) + " shadow triangles, atlas "
+                        + std::to_string(shadowAtlas.updated) + " updated " + std::to_string(shadowAtlas.skipped) + " deferred "
+                        + std::to_string(shadowAtlas.views) + " views"
+                        + (evsmShadows ? ", EVSM " + std::to_string(evsmShadow.filteredFaces) + " faces filtered" : std::string());
+            std::string title = "OpengGL CMC MSU 2020 | " + mode
+                    + " | " + std::to_string(visibleLights.size()) + "/" + std::to_string(sceneLights.size()) + " lights | GPU " + std::to_string(frameTimer.averageMs()) + " ms"
+                    + " | resolution " + std::to_string((int)(100.0f * hdrTarget.renderWidth / std::max(hdrTarget.width, 1) + 0.5f)) + "%, "
+                    + std::to_string((int)(100.0f * resolutionController.adherence() + 0.5f)) + "% of frames in budget"
+                    + " | quality " + governor.modeName() + ": shadow map " + std::to_string(governor.value(shadowSizeSetting))
+                    + ", " + std::to_string(governor.value(shadowSamplesSetting)) + " taps, "
+                    + std::to_string(governor.value(parallaxSetting)) + " layers";
+            glfwSetWindowTitle(window, title.c_str());
+            frameTimer.reset();
+            resolutionController.resetStats();
+            statsTime = 0.0f;
+        }
+
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -365,6 +678,152 @@ void processInput(GLFWwindow *window) {
     {
         shadowsKeyPressed = false;
     }
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS && !shadowModeKeyPressed)
+    {
+        shadowMode = (shadowMode + 1) % (vertexLayerShadows ? 3 : 2);
+        shadowStatsPending = true;
+        shadowModeKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_G) == GLFW_RELEASE)
+    {
+        shadowModeKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS && !shadowSamplesKeyPressed)
+    {
+        shadowSamplesPending = true;
+        shadowSamplesKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_RELEASE)
+    {
+        shadowSamplesKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS && !coneStepKeyPressed)
+    {
+        coneStepParallax = !coneStepParallax;
+        std::cout << "Parallax mapping: " << (coneStepParallax ? "relaxed cone stepping" : "layer search") << std::endl;
+        coneStepKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_K) == GLFW_RELEASE)
+    {
+        coneStepKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS && !parallaxLodKeyPressed)
+    {
+        parallaxLod = !parallaxLod;
+        std::cout << "Parallax level of detail: " << (parallaxLod ? "on" : "off") << std::endl;
+        parallaxLodKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_J) == GLFW_RELEASE)
+    {
+        parallaxLodKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS && !parallaxReportKeyPressed)
+    {
+        parallaxReportPending = true; // printed when the wall is drawn next, it is only drawn without shadows
+        parallaxReportKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_N) == GLFW_RELEASE)
+    {
+        parallaxReportKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS && !shAmbientKeyPressed)
+    {
+        shAmbientLight = !shAmbientLight;
+        std::cout << "Sky ambient light: " << (shAmbientLight ? "spherical harmonics" : "constant") << std::endl;
+        shAmbientKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_U) == GLFW_RELEASE)
+    {
+        shAmbientKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS && !qualityKeyPressed)
+    {
+        qualityMode = (qualityMode + 1) % (QUALITY_ADAPTIVE + 1);
+        qualityModePending = true;
+        qualityKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_O) == GLFW_RELEASE)
+    {
+        qualityKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS && !dynamicResolutionKeyPressed)
+    {
+        dynamicResolution = !dynamicResolution;
+        std::cout << "Resolution: " << (dynamicResolution ? "dynamic" : "full") << std::endl;
+        dynamicResolutionKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_M) == GLFW_RELEASE)
+    {
+        dynamicResolutionKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS && !evsmKeyPressed)
+    {
+        evsmShadows = !evsmShadows;
+        std::cout << "Main light shadows: " << (evsmShadows ? "EVSM" : "PCF") << std::endl;
+        evsmKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_RELEASE)
+    {
+        evsmKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS && !atlasProjectionKeyPressed)
+    {
+        const char *projectionNames[3] = {"auto", "cube", "tetrahedral"};
+        atlasProjection = (atlasProjection + 1) % 3;
+        std::cout << "Atlas shadow projection: " << projectionNames[atlasProjection] << std::endl;
+        atlasProjectionKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_Y) == GLFW_RELEASE)
+    {
+        atlasProjectionKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS && !cascadesKeyPressed)
+    {
+        sunCascades = sunCascades == 4 ? 2 : sunCascades + 1;
+        std::cout << "Sun shadow cascades: " << sunCascades << std::endl;
+        cascadesKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_C) == GLFW_RELEASE)
+    {
+        cascadesKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS && !pauseKeyPressed)
+    {
+        lightPaused = !lightPaused;
+        pauseKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_P) == GLFW_RELEASE)
+    {
+        pauseKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS && !lightsKeyPressed)
+    {
+        lightCountIndex = (lightCountIndex + 1) % (sizeof(lightCounts) / sizeof(lightCounts[0]));
+        std::cout << "Point lights: " << lightCounts[lightCountIndex] << std::endl;
+        lightsKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_L) == GLFW_RELEASE)
+    {
+        lightsKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS && !deferredKeyPressed)
+    {
+        deferred = !deferred;
+        deferredKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_RELEASE)
+    {
+        deferredKeyPressed = false;
+    }
+    if (glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS && !benchmarkKeyPressed && benchmarkStep < 0)
+    {
+        benchmarkStep = 0;
+        benchmarkKeyPressed = true;
+    }
+    if (glfwGetKey(window, GLFW_KEY_B) == GLFW_RELEASE)
+    {
+        benchmarkKeyPressed = false;
+    }
 
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
     {
@@ -380,6 +839,11 @@ void processInput(GLFWwindow *window) {
         else
             heightScale = 1.0f;
     }
+
+    if (glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS)
+        parallaxPixelsPerLayer = std::max(parallaxPixelsPerLayer * 0.99f, 0.25f);
+    else if (glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS)
+        parallaxPixelsPerLayer = std::min(parallaxPixelsPerLayer * 1.01f, 16.0f);
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -412,46 +876,149 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
     camera.ProcessMouseScroll(yoffset);
 }
 
+// object of the 3D scene: the floor or one of the cubes
+struct SceneObject
+{
+    glm::mat4 model;
+    BoundingBox bounds; // world space
+    bool cube;
+    bool dynamic;
+    bool withEmission;
+};
+
+// the floor and the even cubes are static, the odd cubes rotate and are dynamic
+std::vector<SceneObject> sceneObjects(SceneObjects objects)
+{
+    std::vector<SceneObject> scene;
+    if (objects != DYNAMIC_OBJECTS) {
+        SceneObject floor;
+        floor.model = glm::mat4(1.0f);
+        floor.bounds = BoundingBox(glm::vec3(-25.0f, -0.5f, -25.0f), glm::vec3(25.0f, -0.5f, 25.0f));
+        floor.cube = false;
+        floor.dynamic = false;
+        floor.withEmission = false;
+        scene.push_back(floor);
+    }
+    for (unsigned int i = 0; i < 4; i++) {
+        SceneObject cube;
+        cube.dynamic = i & 1;
+        if ((objects == STATIC_OBJECTS && cube.dynamic) || (objects == DYNAMIC_OBJECTS && !cube.dynamic))
+            continue;
+        float angle = 15.0f;
+        cube.model = glm::mat4(1.0f);
+        cube.model = glm::translate(cube.model, cubePositions[i]);
+        cube.model = glm::rotate(cube.model, i * (cube.dynamic ? (float)glfwGetTime() : angle), glm::vec3(1.0f, 0.3f, 0.5f));
+        cube.bounds = BoundingBox(glm::vec3(-1.0f), glm::vec3(1.0f)).transformed(cube.model);
+        cube.cube = true;
+        cube.withEmission = i & 2;
+        scene.push_back(cube);
+    }
+    return scene;
+}
+
 // renders the 3D scene
-void renderScene(const Shader &shader, unsigned int flDiffuse, unsigned int flSpecular,
-                 unsigned int cDiffuse, unsigned int cSpecular, unsigned int cEmission)
+void renderScene(const Shader &shader, const TextureHandle &flDiffuse, const TextureHandle &flSpecular,
+                 const TextureHandle &cDiffuse, const TextureHandle &cSpecular, const TextureHandle &cEmission, SceneObjects objects)
 {
     //bind floor diffuse map
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, flDiffuse);
+    bindTexture(0, flDiffuse);
     // bind floor specular map
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, flSpecular);
-    //render floor
-    glm::mat4 model = glm::mat4(1.0f);
-    shader.setMat4("model", model);
-    shader.setBool("withEmission", false);
-    renderFloor();
-
-    // bind cubes diffuse map
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, cDiffuse);
-    // bind cubes specular map
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, cSpecular);
-    // bind cubes emission map
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, cEmission);
-    // render boxes
-    for (unsigned int i = 0; i < 4; i++) {
-        float angle = 15.0f;
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, cubePositions[i]);
-        model = glm::rotate(model,i * ((i & 1) ? (float)glfwGetTime() : angle), glm::vec3(1.0f, 0.3f, 0.5f));
-        shader.setMat4("model", model);
-        shader.setBool("withEmission", i & 2);
-        renderCube();
+    bindTexture(1, flSpecular);
+    bool cubeMaps = false;
+    for (const SceneObject &object : sceneObjects(objects)) {
+        if (object.cube && !cubeMaps) {
+            // bind cubes diffuse map
+            bindTexture(0, cDiffuse);
+            // bind cubes specular map
+            bindTexture(1, cSpecular);
+            // bind cubes emission map
+            bindTexture(2, cEmission);
+            cubeMaps = true;
+        }
+        shader.setMat4("model", object.model);
+        shader.setBool("withEmission", object.withEmission);
+        if (object.cube)
+            renderCube();
+        else
+            renderFloor();
+    }
+    // the shadow maps that go on these units next compare with their own parameters
+    unbindSamplers(0, 3);
+}
+
+// scene objects as shadow casters
+std::vector<ShadowCaster> shadowCasters(SceneObjects objects)
+{
+    std::vector<ShadowCaster> casters;
+    for (const SceneObject &object : sceneObjects(objects)) {
+        ShadowCaster caster;
+        caster.model = object.model;
+        caster.bounds = object.bounds;
+        caster.triangles = object.cube ? 12 : 2;
+        caster.draw = object.cube ? renderCube : renderFloor;
+        casters.push_back(caster);
+    }
+    return casters;
+}
+
+// the four scene lights followed by small randomly placed lights over the floor, up to count lights
+std::vector<PointLight> buildSceneLights(unsigned int count)
+{
+    std::vector<PointLight> lights;
+    for (unsigned int i = 0; i < 4 && i < count; i++)
+    {
+        PointLight light(pointLightPositions[i], pointLightColors[i]);
+        light.radius = lightRadius(light);
+        lights.push_back(light);
+    }
+    std::mt19937 random(2020);
+    std::uniform_real_distribution<float> spread(-24.0f, 24.0f);
+    std::uniform_real_distribution<float> height(-0.4f, 3.0f);
+    std::uniform_real_distribution<float> channel(0.1f, 1.0f);
+    while (lights.size() < count)
+    {
+        PointLight light(glm::vec3(spread(random), height(random), spread(random)),
+                         glm::vec3(channel(random), channel(random), channel(random)), 0.0f, 1.0f, 2.0f, 8.0f);
+        light.radius = lightRadius(light);
+        lights.push_back(light);
+    }
+    return lights;
+}
+
+// steps through forward/deferred shading at every light count, measuring the average GPU frame time of each
+const unsigned int BENCHMARK_WARMUP = 30;
+const unsigned int BENCHMARK_FRAMES = 120;
+unsigned int benchmarkFrame = 0;
+void updateBenchmark(GpuTimer &timer, std::vector<std::string> &results)
+{
+    if (benchmarkStep < 0)
+        return;
+    const unsigned int counts = sizeof(lightCounts) / sizeof(lightCounts[0]);
+    if (benchmarkFrame == 0) {
+        shadows = false;
+        deferred = benchmarkStep & 1;
+        lightCountIndex = benchmarkStep / 2;
+    }
+    if (benchmarkFrame == BENCHMARK_WARMUP)
+        timer.reset();
+    if (++benchmarkFrame < BENCHMARK_WARMUP + BENCHMARK_FRAMES)
+        return;
+
+    results.push_back(std::string(deferred ? "deferred" : "forward ") + " " + std::to_string(lightCounts[lightCountIndex])
+                      + " lights: " + std::to_string(timer.averageMs()) + " ms");
+    benchmarkFrame = 0;
+    if (++benchmarkStep == (int)(2 * counts)) {
+        std::cout << "GPU frame time, average of " << BENCHMARK_FRAMES << " frames" << std::endl;
+        for (const std::string &line : results)
+            std::cout << "  " << line << std::endl;
+        results.clear();
+        benchmarkStep = -1;
     }
 }
 
 // renders floor
 unsigned int floorVAO = 0;
-void renderFloor() {
+void renderFloor(unsigned int instances) {
     if (floorVAO == 0) {
         unsigned int floorVBO;
         glGenVertexArrays(1, &floorVAO);
@@ -468,13 +1035,13 @@ void renderFloor() {
         glBindVertexArray(0);
     }
     glBindVertexArray(floorVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, instances);
     glBindVertexArray(0);
 }
 
 // renders cube
 unsigned int cubeVAO = 0;
-void renderCube()
+void renderCube(unsigned int instances)
 {
     if (cubeVAO == 0) {
         unsigned int cubeVBO = 0;
@@ -498,7 +1065,7 @@ void renderCube()
         glBindVertexArray(0);
     }
     glBindVertexArray(cubeVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 36, instances);
     glBindVertexArray(0);
 }
 
@@ -618,10 +1185,10 @@ void renderSkybox()
 
 
 
-// renders (and builds at first invocation) a sphere
+// renders (and builds at first invocation) a sphere, the segment counts of the first call are kept
 unsigned int sphereIndexCount = 0;
 unsigned int sphereVAO = 0;
-void renderSphere(int xSeg, int ySeg)
+void renderSphere(int xSeg, int ySeg, unsigned int instances)
 {
     if (sphereVAO == 0) {
         glGenVertexArrays(1, &sphereVAO);
@@ -706,7 +1273,7 @@ void renderSphere(int xSeg, int ySeg)
         glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)(6 * sizeof(float)));
     }
     glBindVertexArray(sphereVAO);
-    glDrawElements(GL_TRIANGLE_STRIP, sphereIndexCount, GL_UNSIGNED_INT, nullptr);
+    glDrawElementsInstanced(GL_TRIANGLE_STRIP, sphereIndexCount, GL_UNSIGNED_INT, nullptr, instances);
 }
 
 // renders (and builds at first invocation) a torus
@@ -809,78 +1376,119 @@ void renderTorus(double r, double c,
     glDrawArrays(GL_TRIANGLE_STRIP, 0, torusIndexCount);
 }
 
-// utility function for loading a 2D texture from file
-unsigned int loadTexture(char const * path)
+// draws the parallax wall offscreen in front of the camera, turned 60 degrees away from it, at several distances with
+// and without level of detail, and prints the depth map fetches per covered pixel. Expects parallaxShader in use with
+// the wall's textures bound.
+void reportParallaxFetches(Shader &parallaxShader, const glm::mat4 &view)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format = 0;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    // same size as the frame, renderbuffers only so the wall's textures stay bound
+    int viewport[4], framebuffer;
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &framebuffer);
+    const int width = viewport[2], height = viewport[3];
+    unsigned int FBO, RBOs[2];
+    glGenFramebuffers(1, &FBO);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+    glGenRenderbuffers(2, RBOs);
+    glBindRenderbuffer(GL_RENDERBUFFER, RBOs[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, RBOs[0]);
+    glBindRenderbuffer(GL_RENDERBUFFER, RBOs[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, RBOs[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::PARALLAX_REPORT::FRAMEBUFFER_INCOMPLETE" << std::endl;
+    float clearColor[4];
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glViewport(0, 0, width, height);
 
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+    std::cout << "Parallax depth map fetches per pixel (" << (coneStepParallax ? "cone stepping" : "layer search")
+              << ", height scale " << heightScale << ", " << parallaxPixelsPerLayer << " pixels per layer):" << std::endl;
+    parallaxShader.setBool("countFetches", true);
+    std::vector<unsigned char> pixels(width * height * 4);
+    const float distances[] = {1.5f, 3.0f, 6.0f, 12.0f, 24.0f, 48.0f, 96.0f, 192.0f};
+    for (float distance : distances) {
+        glm::mat4 model = glm::inverse(view);
+        model = glm::translate(model, glm::vec3(0.0f, 0.0f, -distance));
+        model = glm::rotate(model, glm::radians(60.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        parallaxShader.setMat4("model", model);
+        std::cout << "  distance " << distance << ":";
+        for (int lod = 0; lod < 2; lod++) {
+            parallaxShader.setBool("parallaxLod", lod == 1);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            renderWall();
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            unsigned long long covered = 0, fetches = 0, normalMapped = 0;
+            for (size_t i = 0; i < pixels.size(); i += 4) {
+                if (!pixels[i + 1])
+                    continue;
+                covered++;
+                fetches += pixels[i];
+                if (pixels[i + 2])
+                    normalMapped++;
+            }
+            double average = covered ? (double)fetches / covered : 0.0;
+            if (lod == 0)
+                std::cout << " " << covered << " pixels, full detail " << average;
+            else
+                std::cout << ", LOD " << average << " (" << (covered ? 100.0 * normalMapped / covered : 0.0) << "% normal mapped)";
+        }
+        std::cout << std::endl;
     }
-
-    return textureID;
+    parallaxShader.setBool("countFetches", false);
+    parallaxShader.setBool("parallaxLod", parallaxLod);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glDeleteRenderbuffers(2, RBOs);
+    glDeleteFramebuffers(1, &FBO);
+    glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
 }
 
-// loads a cubemap texture from 6 individual texture faces
-// order:
-// +X (right)
-// -X (left)
-// +Y (top)
-// -Y (bottom)
-// +Z (front)
-// -Z (back)
-unsigned int loadCubemap(std::vector<std::string> faces)
+// relaxed cone step map of a depth map, read from the .cone file next to it (written by src/tools/cone_step_baker.cpp,
+// the cone_step_maps target) or baked and cached there when missing or baked from another version of the depth map
+unsigned int loadConeStepTexture(char const *path, ThreadPool &pool)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++)
+    std::string cachePath = std::string(path).substr(0, std::string(path).find_last_of('.')) + ".cone";
+    Resource source;
+    if (!readResource(path, source) || source.size() > INT_MAX)
     {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
-        else
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        return 0;
+    }
+    unsigned long long sourceHash = fnv1a(source.data(), source.size());
+    ConeStepMap map;
+    if (!loadConeStepMap(cachePath, map) || map.source != sourceHash)
+    {
+        int width, height, nrComponents;
+        unsigned char *data = stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &nrComponents, 0);
+        if (!data)
         {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
+            std::cout << "Texture failed to load at path: " << path << std::endl;
+            return 0;
         }
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        map = bakeConeStepMap(data, width, height, nrComponents, pool);
+        map.source = sourceHash;
+        stbi_image_free(data);
+        std::cout << "Baked cone step map " << cachePath << " in "
+                  << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()
+                  << " s (the cone_step_maps target bakes it ahead of time)" << std::endl;
+        if (!saveConeStepMap(cachePath, map))
+            std::cout << "ERROR::CONE_STEP::SAVE_FAILED " << cachePath << std::endl;
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, map.width, map.height, 0, GL_RG, GL_UNSIGNED_BYTE, map.texels.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    // no mipmaps, averaged cones are not cones of anything
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     return textureID;
 }
\ No newline at end of file
@@ -8,43 +8,231 @@ in VS_OUT {
 } fs_in;
 
 uniform sampler2D diffuseTexture;
-uniform samplerCube depthMap;
+uniform samplerCubeShadow depthMap; // hardware comparison, every tap is a bilinear PCF result
 
 uniform vec3 lightPos;
 uniform vec3 viewPos;
 
 uniform float far_plane;
+// 1 to 20 taps, the application compiles one permutation per count
+#ifndef SHADOW_SAMPLES
+#define SHADOW_SAMPLES 20
+#endif
 
-// array of offset direction for sampling
+// exponential variance shadows: one trilinear lookup of prefiltered moments instead of PCF taps
+uniform bool evsm;
+uniform samplerCube momentsMap;
+uniform float momentsBlur; // width of the box filter baked into mip 0, in texels
+const vec2 EVSM_EXPONENTS = vec2(40.0, 5.0); // must match evsm_blur_frag.glsl
+const float EVSM_BLEEDING_REDUCTION = 0.3;
+
+// directional sun with cascaded shadow maps
+#define MAX_CASCADES 4
+uniform vec3 sunDirection; // direction the light travels in
+uniform vec3 sunColor;
+uniform sampler2DArrayShadow cascadeMap;
+uniform int cascadeCount;
+uniform float cascadeSplits[MAX_CASCADES]; // view space distance where every cascade ends
+uniform mat4 cascadeMatrices[MAX_CASCADES];
+uniform float cascadeTexelSizes[MAX_CASCADES];
+uniform mat4 view;
+
+// point lights shadowed through the atlas, every tile holds six faces in a 3 x 2 grid
+#define MAX_ATLAS_LIGHTS 4
+uniform sampler2D shadowAtlas;
+uniform int atlasLightCount;
+uniform vec3 lightPositions[MAX_ATLAS_LIGHTS];
+uniform vec3 lightColors[MAX_ATLAS_LIGHTS];
+uniform vec4 lightAttenuations[MAX_ATLAS_LIGHTS]; // constant, linear, quadratic, radius
+uniform vec4 lightShadowTiles[MAX_ATLAS_LIGHTS]; // tile origin, face size; zero size while the tile is not rendered
+uniform float lightFarPlanes[MAX_ATLAS_LIGHTS];
+uniform bool lightTetrahedral[MAX_ATLAS_LIGHTS]; // four tetrahedral views instead of six cube faces
+
+// second order spherical harmonics ambient light of the skybox, see helpers/spherical_harmonics.h
+uniform bool shAmbient;
+layout (std140) uniform AmbientSH
+{
+    vec4 shCoefficients[9];
+};
+
+// forward and up vectors the faces were rendered with, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+const vec3 faceForward[6] = vec3[](vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1));
+const vec3 faceUp[6] = vec3[](vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0));
+// axes of the tetrahedral views, all rendered with up = +Y and a field of view of 2 * atan(TETRAHEDRAL_TAN)
+const vec3 tetraForward[4] = vec3[](vec3(0.57735027, 0.57735027, 0.57735027), vec3(0.57735027, -0.57735027, -0.57735027),
+                                    vec3(-0.57735027, 0.57735027, -0.57735027), vec3(-0.57735027, -0.57735027, 0.57735027));
+const float TETRAHEDRAL_TAN = 3.0;
+
+// array of offset direction for sampling, the first four span a tetrahedron so small tap counts stay balanced
 vec3 gridSamplingDisk[20] = vec3[]
 (
-   vec3(1, 1,  1), vec3( 1, -1,  1), vec3(-1, -1,  1), vec3(-1, 1,  1), 
-   vec3(1, 1, -1), vec3( 1, -1, -1), vec3(-1, -1, -1), vec3(-1, 1, -1),
+   vec3(1, 1,  1), vec3(-1, -1,  1), vec3( 1, -1, -1), vec3(-1, 1, -1),
+   vec3(1, -1, 1), vec3(-1,  1,  1), vec3( 1,  1, -1), vec3(-1, -1, -1),
    vec3(1, 1,  0), vec3( 1, -1,  0), vec3(-1, -1,  0), vec3(-1, 1,  0),
    vec3(1, 0,  1), vec3(-1,  0,  1), vec3( 1,  0, -1), vec3(-1, 0, -1),
    vec3(0, 1,  1), vec3( 0, -1,  1), vec3( 0, -1, -1), vec3( 0, 1, -1)
 );
 
+// smooth falloff that brings a light's attenuation to exactly zero at its radius
+float RadiusWindow(float distance, float radius)
+{
+    float x = distance / radius;
+    float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);
+    return window * window;
+}
+
+// irradiance / pi around the unit vector n, a few multiply-adds and no texture fetches
+vec3 ShIrradiance(vec3 n)
+{
+    return shCoefficients[0].rgb
+         + shCoefficients[1].rgb * n.y + shCoefficients[2].rgb * n.z + shCoefficients[3].rgb * n.x
+         + shCoefficients[4].rgb * (n.x * n.y) + shCoefficients[5].rgb * (n.y * n.z)
+         + shCoefficients[6].rgb * (3.0 * n.z * n.z - 1.0) + shCoefficients[7].rgb * (n.x * n.z)
+         + shCoefficients[8].rgb * (n.x * n.x - n.y * n.y);
+}
+
 float ShadowCalculation(vec3 fragPos)
 {
     // get vector between fragment position and light position
     vec3 fragToLight = fragPos - lightPos;
     // get current linear depth as the length between the fragment and light position
     float currentDepth = length(fragToLight);
-    // Percentage-closer Filtering
-    float shadow = 0.0;
+    // Percentage-closer Filtering, the depth comparison happens in the sampler
     float bias = 0.10;
-    int samples = 20;
+#if SHADOW_SAMPLES == 1
+    return 1.0 - texture(depthMap, vec4(fragToLight, (currentDepth - bias) / far_plane));
+#else
     float viewDistance = length(viewPos - fragPos);
     float diskRadius = (1.0 + (viewDistance / far_plane)) / 25.0;
-    for(int i = 0; i < samples; ++i)
+    float lit = 0.0;
+    for(int i = 0; i < SHADOW_SAMPLES; ++i)
+        lit += texture(depthMap, vec4(fragToLight + gridSamplingDisk[i] * diskRadius, (currentDepth - bias) / far_plane));
+    return 1.0 - lit / float(SHADOW_SAMPLES);
+#endif
+}
+
+float Chebyshev(vec2 moments, float mean, float minVariance)
+{
+    if (mean <= moments.x)
+        return 1.0;
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = mean - moments.x;
+    float pMax = variance / (variance + d * d);
+    // cut off the tail of the bound, it shows as light leaking behind overlapping casters
+    return clamp((pMax - EVSM_BLEEDING_REDUCTION) / (1.0 - EVSM_BLEEDING_REDUCTION), 0.0, 1.0);
+}
+
+float EvsmShadowCalculation(vec3 fragPos)
+{
+    vec3 fragToLight = fragPos - lightPos;
+    float currentDepth = length(fragToLight);
+    float bias = 0.10;
+    float depth = clamp((currentDepth - bias) / far_plane, 0.0, 1.0) * 2.0 - 1.0;
+    vec2 warped = vec2(exp(EVSM_EXPONENTS.x * depth), -exp(-EVSM_EXPONENTS.y * depth));
+    // the same penumbra as the PCF disk: its width in texels of the face picks the mip level
+    float viewDistance = length(viewPos - fragPos);
+    float diskRadius = (1.0 + (viewDistance / far_plane)) / 25.0;
+    vec3 a = abs(fragToLight);
+    float footprint = diskRadius / max(a.x, max(a.y, a.z)) * float(textureSize(momentsMap, 0).x);
+    float lod = log2(max(footprint / momentsBlur, 1.0));
+    vec4 moments = textureLod(momentsMap, fragToLight, lod);
+    // variance floor scaled by the slope of each warp
+    vec2 depthScale = 0.0001 * EVSM_EXPONENTS * warped;
+    float positive = Chebyshev(moments.xy, warped.x, depthScale.x * depthScale.x);
+    float negative = Chebyshev(moments.zw, warped.y, depthScale.y * depthScale.y);
+    return 1.0 - min(positive, negative);
+}
+
+float CascadeShadow(int cascade, vec3 fragPos, vec3 normal)
+{
+    // normal offset by about a texel, grazing surfaces would shadow themselves otherwise
+    float slope = 1.0 - max(dot(normal, -sunDirection), 0.0);
+    vec3 offsetPos = fragPos + normal * cascadeTexelSizes[cascade] * (0.5 + 1.5 * slope);
+    vec4 lightSpace = cascadeMatrices[cascade] * vec4(offsetPos, 1.0);
+    vec3 coords = lightSpace.xyz * 0.5 + 0.5;
+    // 4 bilinear comparisons cover a 3x3 texel footprint
+    vec2 texel = 1.0 / vec2(textureSize(cascadeMap, 0).xy);
+    float lit = 0.0;
+    for (int x = 0; x < 2; ++x)
+        for (int y = 0; y < 2; ++y)
+            lit += texture(cascadeMap, vec4(coords.xy + (vec2(x, y) - 0.5) * texel, float(cascade), coords.z));
+    return 1.0 - lit * 0.25;
+}
+
+float SunShadowCalculation(vec3 fragPos, vec3 normal)
+{
+    float viewDepth = -(view * vec4(fragPos, 1.0)).z;
+    int cascade = 0;
+    while (cascade < cascadeCount - 1 && viewDepth > cascadeSplits[cascade])
+        cascade++;
+    if (viewDepth > cascadeSplits[cascadeCount - 1])
+        return 0.0;
+    float shadow = CascadeShadow(cascade, fragPos, normal);
+    // fade into the next cascade over the last tenth of this one, hiding the seam
+    float cascadeStart = cascade == 0 ? 0.0 : cascadeSplits[cascade - 1];
+    float blendStart = cascadeSplits[cascade] - 0.1 * (cascadeSplits[cascade] - cascadeStart);
+    if (viewDepth > blendStart)
     {
-        float closestDepth = texture(depthMap, fragToLight + gridSamplingDisk[i] * diskRadius).r;
-        closestDepth *= far_plane;   // undo mapping [0;1]
-        if(currentDepth - bias > closestDepth)
-            shadow += 1.0;
+        float blend = (viewDepth - blendStart) / (cascadeSplits[cascade] - blendStart);
+        float next = cascade + 1 < cascadeCount ? CascadeShadow(cascade + 1, fragPos, normal) : 0.0;
+        shadow = mix(shadow, next, blend);
     }
-    shadow /= float(samples);
+    return shadow;
+}
+
+float AtlasShadowCalculation(int light, vec3 fragPos, vec3 normal)
+{
+    vec4 tile = lightShadowTiles[light];
+    if (tile.z == 0.0)
+        return 0.0;
+    vec2 atlasSize = vec2(textureSize(shadowAtlas, 0));
+    float faceTexels = tile.z * atlasSize.x;
+    // push the lookup off the surface by about a texel, grazing surfaces would shadow themselves otherwise
+    vec3 toLight = lightPositions[light] - fragPos;
+    bool tetrahedral = lightTetrahedral[light];
+    float texelSize = (tetrahedral ? 2.0 * TETRAHEDRAL_TAN : 2.0) * length(toLight) / faceTexels;
+    fragPos += normal * texelSize * (1.0 - dot(normal, normalize(toLight)));
+    vec3 fragToLight = fragPos - lightPositions[light];
+    int face;
+    vec3 forward, right;
+    float viewTan = 1.0;
+    if (tetrahedral)
+    {
+        // the view whose axis is closest to the direction
+        face = 0;
+        for (int i = 1; i < 4; ++i)
+            if (dot(tetraForward[i], fragToLight) > dot(tetraForward[face], fragToLight))
+                face = i;
+        forward = tetraForward[face];
+        right = normalize(cross(forward, vec3(0.0, 1.0, 0.0)));
+        viewTan = TETRAHEDRAL_TAN;
+    }
+    else
+    {
+        vec3 a = abs(fragToLight);
+        face = a.x >= a.y && a.x >= a.z ? (fragToLight.x > 0.0 ? 0 : 1) : a.y >= a.z ? (fragToLight.y > 0.0 ? 2 : 3) : (fragToLight.z > 0.0 ? 4 : 5);
+        forward = faceForward[face];
+        right = normalize(cross(forward, faceUp[face]));
+    }
+    // project onto the face the same way its view did
+    vec3 up = cross(right, forward);
+    float depth = dot(forward, fragToLight);
+    vec2 uv = vec2(dot(right, fragToLight), dot(up, fragToLight)) / (depth * viewTan) * 0.5 + 0.5;
+    // keep the filter inside the face, neighbouring faces are unrelated
+    uv = clamp(uv, 1.0 / faceTexels, 1.0 - 1.0 / faceTexels);
+    vec2 coords = tile.xy + (vec2(face % 3, face / 3) + uv) * tile.zw;
+
+    float currentDepth = length(fragToLight);
+    // one texel covers 2 * depth / faceTexels world units at this distance
+    float bias = max(0.05, 2.0 * texelSize);
+    float shadow = 0.0;
+    for (int x = 0; x < 2; ++x)
+        for (int y = 0; y < 2; ++y)
+        {
+            float closestDepth = texture(shadowAtlas, coords + (vec2(x, y) - 0.5) / atlasSize).r * lightFarPlanes[light];
+            if (currentDepth - bias > closestDepth)
+                shadow += 0.25;
+        }
     return shadow;
 }
 
@@ -54,7 +242,7 @@ void main()
     vec3 normal = normalize(fs_in.Normal);
     vec3 lightColor = vec3(0.3);
     // ambient
-    vec3 ambient = 0.3 * color;
+    vec3 ambient = (shAmbient ? ShIrradiance(normal) : vec3(0.3)) * color;
     // diffuse
     vec3 lightDir = normalize(lightPos - fs_in.FragPos);
     float diff = max(dot(lightDir, normal), 0.0);
@@ -67,8 +255,28 @@ void main()
     spec = pow(max(dot(normal, halfwayDir), 0.0), 64.0);
     vec3 specular = spec * lightColor;    
     // calculate shadow
-    float shadow = ShadowCalculation(fs_in.FragPos);
+    float shadow = evsm ? EvsmShadowCalculation(fs_in.FragPos) : ShadowCalculation(fs_in.FragPos);
     vec3 lighting = (ambient + (1.0 - shadow) * (diffuse + specular)) * color;
+    // sun
+    vec3 sunDir = -sunDirection;
+    float sunDiff = max(dot(sunDir, normal), 0.0);
+    float sunSpec = pow(max(dot(normal, normalize(sunDir + viewDir)), 0.0), 64.0);
+    lighting += (1.0 - SunShadowCalculation(fs_in.FragPos, normal)) * (sunDiff + sunSpec) * sunColor * color;
+    // point lights with atlas shadows
+    for (int i = 0; i < atlasLightCount; ++i)
+    {
+        vec3 toLight = lightPositions[i] - fs_in.FragPos;
+        float distance = length(toLight);
+        vec4 terms = lightAttenuations[i];
+        float attenuation = RadiusWindow(distance, terms.w) / (terms.x + terms.y * distance + terms.z * distance * distance);
+        if (attenuation <= 0.0)
+            continue;
+        vec3 pointDir = toLight / distance;
+        float pointDiff = max(dot(pointDir, normal), 0.0);
+        float pointSpec = pow(max(dot(normal, normalize(pointDir + viewDir)), 0.0), 64.0);
+        float pointShadow = AtlasShadowCalculation(i, fs_in.FragPos, normal);
+        lighting += (1.0 - pointShadow) * attenuation * (pointDiff + pointSpec) * lightColors[i] * color;
+    }
     
     FragColor = vec4(lighting, 1.0);
 }
\ No newline at end of file
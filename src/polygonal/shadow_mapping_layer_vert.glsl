@@ -0,0 +1,18 @@
+#version 330 core
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 shadowMatrices[6];
+uniform int faces[6]; // cube faces the object touches, one instance per face
+
+out vec4 FragPos;
+
+void main()
+{
+    int face = faces[gl_InstanceID];
+    FragPos = model * vec4(aPos, 1.0);
+    gl_Position = shadowMatrices[face] * FragPos;
+    gl_Layer = face; // written from the vertex shader, no geometry shader amplification
+}
@@ -0,0 +1,283 @@
+// Offline baker of the relaxed cone step map used by parallax_mapping_frag.glsl.
+// usage: cone_step_baker [depth map] [output]
+// defaults to the acoustic panel displacement map next to which polygonal looks for displacement.cone.
+// After baking, the map is checked and the tool exits with 1 when a check fails:
+// - the stored cones of VALIDATED_TEXELS random texels must not intersect the height field, a ray along the cone may
+//   enter the relief once but not leave it again before the apex;
+// - random rays are traced through CPU copies of the linear/relief search and of the cone step search and compared
+//   against a dense reference march, reporting texture fetches and hit accuracy of both; cone stepping must not miss
+//   the reference on more rays than the linear search.
+#include <stb_image.h>
+
+#include <helpers/cone_step.h>
+#include <helpers/filesystem.h>
+#include <helpers/resource_pack.h>
+#include <helpers/thread_pool.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <string>
+
+// texels whose cones are checked against the height field
+const int VALIDATED_TEXELS = 4096;
+
+// bilinear GL_REPEAT lookup of channel of an 8 bit texture, like texture() on the GPU
+float sampleTexture(const unsigned char *texels, int width, int height, int channels, int channel, glm::vec2 uv)
+{
+    float x = uv.x * width - 0.5f, y = uv.y * height - 0.5f;
+    int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+    float fx = x - x0, fy = y - y0;
+    float value[2][2];
+    for (int j = 0; j < 2; ++j)
+        for (int i = 0; i < 2; ++i)
+        {
+            int sx = ((x0 + i) % width + width) % width;
+            int sy = ((y0 + j) % height + height) % height;
+            value[j][i] = texels[(sy * width + sx) * channels + channel] / 255.0f;
+        }
+    return glm::mix(glm::mix(value[0][0], value[0][1], fx), glm::mix(value[1][0], value[1][1], fx), fy);
+}
+
+struct Relief
+{
+    const unsigned char *depth;
+    int channels;
+    const ConeStepMap *cones;
+    int width, height;
+};
+
+// whether a ray along the stored cone of texel (x, y) leaves the relief after entering it on its way to the apex, in any
+// of the baked directions. The ray is marched over the nearest depth texels like the bake samples them, and leaving
+// means clearing the surface by more than CONE_STEP_TOLERANCE, the terracing the bake allows for.
+bool coneIntersects(const Relief &relief, int x, int y)
+{
+    const unsigned char *texel = &relief.cones->texels[(y * relief.width + x) * 2];
+    float apexDepth = texel[0] / 255.0f;
+    float coneRoot = texel[1] / 255.0f;
+    float coneRatio = coneRoot * coneRoot * CONE_STEP_MAX_RATIO;
+    if (apexDepth <= 0.0f || coneRatio <= 0.0f)
+        return false;
+    for (int direction = 0; direction < CONE_STEP_DIRECTIONS; ++direction)
+    {
+        float angle = 2.0f * 3.14159265f * direction / CONE_STEP_DIRECTIONS;
+        float dirX = std::cos(angle), dirY = std::sin(angle);
+        float scale = std::sqrt(dirX * dirX / (relief.width * relief.width) + dirY * dirY / (relief.height * relief.height));
+        // from the top of the relief towards the apex
+        bool entered = false;
+        for (int r = (int)(apexDepth * coneRatio / scale); r > 0; --r)
+        {
+            int sx = std::min(std::max((int)std::floor(x + 0.5f + dirX * r), 0), relief.width - 1);
+            int sy = std::min(std::max((int)std::floor(y + 0.5f + dirY * r), 0), relief.height - 1);
+            float surface = relief.depth[(sy * relief.width + sx) * relief.channels] / 255.0f;
+            float ray = apexDepth - r * scale / coneRatio;
+            if (entered && ray < surface - CONE_STEP_TOLERANCE)
+                return true;
+            entered = entered || ray > surface;
+        }
+    }
+    return false;
+}
+
+// ParallaxMapping of parallax_mapping_frag.glsl
+glm::vec2 linearSearch(const Relief &relief, glm::vec2 texCoords, glm::vec3 viewDir, float heightScale, int &fetches)
+{
+    float numLayers = glm::mix(32.0f, 8.0f, std::abs(viewDir.z));
+    float layerDepth = 1.0f / numLayers;
+    float currentLayerDepth = 0.0f;
+    glm::vec2 deltaTexCoords = glm::vec2(viewDir) / viewDir.z * heightScale / numLayers;
+    glm::vec2 currentTexCoords = texCoords;
+    float currentDepthMapValue = sampleTexture(relief.depth, relief.width, relief.height, relief.channels, 0, currentTexCoords);
+    fetches++;
+    while (currentLayerDepth < currentDepthMapValue)
+    {
+        currentTexCoords -= deltaTexCoords;
+        currentDepthMapValue = sampleTexture(relief.depth, relief.width, relief.height, relief.channels, 0, currentTexCoords);
+        fetches++;
+        currentLayerDepth += layerDepth;
+    }
+    for (int step = 0; step < 6; ++step)
+    {
+        currentDepthMapValue = sampleTexture(relief.depth, relief.width, relief.height, relief.channels, 0, currentTexCoords);
+        fetches++;
+        deltaTexCoords *= 0.5f;
+        layerDepth *= 0.5f;
+        if (currentDepthMapValue > currentLayerDepth)
+        {
+            currentTexCoords -= deltaTexCoords;
+            currentLayerDepth += layerDepth;
+        }
+        else
+        {
+            currentTexCoords += deltaTexCoords;
+            currentLayerDepth -= layerDepth;
+        }
+    }
+    return currentTexCoords;
+}
+
+// ConeStepMapping of parallax_mapping_frag.glsl
+glm::vec2 coneStepSearch(const Relief &relief, glm::vec2 texCoords, glm::vec3 viewDir, float heightScale, int &fetches)
+{
+    const ConeStepMap &cones = *relief.cones;
+    glm::vec3 ray(-glm::vec2(viewDir) / viewDir.z * heightScale, 1.0f);
+    float rayRatio = glm::length(glm::vec2(ray));
+    glm::vec3 position(texCoords, 0.0f), previous = position;
+    float height = 0.0f;
+    for (int step = 0; step < 10; ++step)
+    {
+        float depth = sampleTexture(cones.texels.data(), cones.width, cones.height, 2, 0, glm::vec2(position));
+        float coneRoot = sampleTexture(cones.texels.data(), cones.width, cones.height, 2, 1, glm::vec2(position));
+        fetches++;
+        height = depth - position.z;
+        if (height <= 0.0f)
+            break;
+        float coneRatio = coneRoot * coneRoot * CONE_STEP_MAX_RATIO;
+        previous = position;
+        position += ray * (coneRatio * height / (rayRatio + coneRatio));
+    }
+    if (height > 0.0f)
+    {
+        previous = position;
+        position += ray * height;
+    }
+    for (int step = 0; step < 5; ++step)
+    {
+        glm::vec3 middle = (previous + position) * 0.5f;
+        fetches++;
+        if (sampleTexture(cones.texels.data(), cones.width, cones.height, 2, 0, glm::vec2(middle)) > middle.z)
+            previous = middle;
+        else
+            position = middle;
+    }
+    return glm::vec2(position);
+}
+
+// first intersection by a dense march refined by bisection
+glm::vec2 referenceSearch(const Relief &relief, glm::vec2 texCoords, glm::vec3 viewDir, float heightScale)
+{
+    glm::vec3 ray(-glm::vec2(viewDir) / viewDir.z * heightScale, 1.0f);
+    glm::vec3 start(texCoords, 0.0f);
+    const int steps = 4096;
+    float above = 0.0f, below = 1.0f;
+    for (int i = 1; i <= steps; ++i)
+    {
+        glm::vec3 position = start + ray * (i / (float)steps);
+        if (sampleTexture(relief.depth, relief.width, relief.height, relief.channels, 0, glm::vec2(position)) <= position.z)
+        {
+            below = i / (float)steps;
+            break;
+        }
+        above = i / (float)steps;
+    }
+    for (int i = 0; i < 24; ++i)
+    {
+        float middle = (above + below) * 0.5f;
+        glm::vec3 position = start + ray * middle;
+        if (sampleTexture(relief.depth, relief.width, relief.height, relief.channels, 0, glm::vec2(position)) > position.z)
+            above = middle;
+        else
+            below = middle;
+    }
+    return glm::vec2(start + ray * below);
+}
+
+int main(int argc, char **argv)
+{
+    std::string input = argc > 1 ? argv[1] : FileSystem::getPath("resources/textures/pbr/acoustic/displacement.png");
+    std::string output = argc > 2 ? argv[2] : input.substr(0, input.find_last_of('.')) + ".cone";
+
+    // the hash of the file as read, which polygonal compares to decide whether the map is current
+    Resource source;
+    int width, height, channels;
+    unsigned char *image = NULL;
+    if (readResource(input, source) && source.size() <= INT_MAX)
+        image = stbi_load_from_memory(source.data(), (int)source.size(), &width, &height, &channels, 0);
+    if (!image)
+    {
+        std::cout << "ERROR::CONE_STEP_BAKER::LOAD_FAILED " << input << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ConeStepMap cones = bakeConeStepMap(image, width, height, channels, pool);
+    cones.source = fnv1a(source.data(), source.size());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Baked " << width << "x" << height << " relaxed cone step map in " << seconds << " s on " << pool.size() + 1
+              << " threads" << std::endl;
+    if (!saveConeStepMap(output, cones))
+    {
+        std::cout << "ERROR::CONE_STEP_BAKER::SAVE_FAILED " << output << std::endl;
+        stbi_image_free(image);
+        return 1;
+    }
+    std::cout << "Saved " << output << std::endl;
+
+    Relief relief = {image, channels, &cones, width, height};
+    std::mt19937 random(42);
+    int intersecting = 0;
+    for (int i = 0; i < VALIDATED_TEXELS; ++i)
+    {
+        int x = (int)(random() % width), y = (int)(random() % height);
+        if (coneIntersects(relief, x, y))
+        {
+            if (intersecting == 0)
+                std::cout << "ERROR::CONE_STEP_BAKER::CONE_INTERSECTS texel " << x << ", " << y << std::endl;
+            intersecting++;
+        }
+    }
+    std::cout << "Cones: " << VALIDATED_TEXELS << " texels checked, " << intersecting << " intersect the height field" << std::endl;
+
+    // trace the same rays through both searches
+    const float heightScale = 0.1f; // polygonal's default
+    const int rays = 20000;
+    const float tolerance = 2.0f / width; // two texels
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    long long linearFetches = 0, coneFetches = 0;
+    int linearMaxFetches = 0, coneMaxFetches = 0, linearMisses = 0, coneMisses = 0, traced = 0;
+    double linearError = 0.0, coneError = 0.0;
+    for (int i = 0; i < rays; ++i)
+    {
+        float angle = 6.2831853f * unit(random);
+        float z = glm::mix(0.15f, 1.0f, unit(random));
+        float xy = std::sqrt(1.0f - z * z);
+        glm::vec3 viewDir(xy * std::cos(angle), xy * std::sin(angle), z);
+        glm::vec2 texCoords(unit(random), unit(random));
+
+        glm::vec2 reference = referenceSearch(relief, texCoords, viewDir, heightScale);
+        int fetches = 0;
+        glm::vec2 linear = linearSearch(relief, texCoords, viewDir, heightScale, fetches);
+        linearFetches += fetches;
+        linearMaxFetches = std::max(linearMaxFetches, fetches);
+        fetches = 0;
+        glm::vec2 cone = coneStepSearch(relief, texCoords, viewDir, heightScale, fetches);
+        coneFetches += fetches;
+        coneMaxFetches = std::max(coneMaxFetches, fetches);
+
+        traced++;
+        linearError += glm::length(linear - reference) * width;
+        coneError += glm::length(cone - reference) * width;
+        if (glm::length(linear - reference) > tolerance)
+            linearMisses++;
+        if (glm::length(cone - reference) > tolerance)
+            coneMisses++;
+    }
+    std::cout << "Rays: " << traced << ", height scale " << heightScale << std::endl;
+    std::cout << "  linear + relief search: " << linearFetches / (double)traced << " fetches on average, " << linearMaxFetches
+              << " at most, " << linearError / traced << " texels mean error, " << 100.0 * linearMisses / traced
+              << "% off by more than 2 texels" << std::endl;
+    std::cout << "  relaxed cone stepping:  " << coneFetches / (double)traced << " fetches on average, " << coneMaxFetches
+              << " at most, " << coneError / traced << " texels mean error, " << 100.0 * coneMisses / traced
+              << "% off by more than 2 texels" << std::endl;
+
+    stbi_image_free(image);
+    if (coneMisses > linearMisses)
+        std::cout << "ERROR::CONE_STEP_BAKER::LESS_ACCURATE_THAN_LINEAR" << std::endl;
+    return intersecting > 0 || coneMisses > linearMisses ? 1 : 0;
+}
@@ -0,0 +1,214 @@
+// Packs the resources and shaders the apps load into one file, which they map and read in place of the loose files
+// (see includes/helpers/resource_pack.h).
+// usage: resource_packer [--no-lz4] output [--base directory] file...
+// Files are named by their path relative to the last --base before them, with forward slashes; the resource_pack
+// target names everything relative to the repository root, resources/... and src/<chapter>/*.glsl, which is how
+// resourceName() looks them up. A name given twice is packed once if the contents match and is an error otherwise; identical contents
+// under different names share their bytes. A file is stored as an LZ4 block when that saves at least an eighth, which
+// holds for uncompressed images, caches and shaders but not for JPEG and PNG. Cooked .dds older than their source, or
+// than any of the three maps a packed ao_roughness_metallic.dds holds, are left out, as the runtime would ignore them.
+#include <helpers/channel_packing.h>
+#include <helpers/dds.h>
+#include <helpers/lz4.h>
+#include <helpers/resource_pack.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// LZ4 is kept when the block is at most this many eighths of the file
+const size_t LZ4_MAX_EIGHTHS = 7;
+
+bool readFile(const std::string &path, std::vector<unsigned char> &bytes)
+{
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    bool read = std::fseek(file, 0, SEEK_END) == 0;
+    long size = read ? std::ftell(file) : -1;
+    read = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+    if (read)
+    {
+        bytes.resize((size_t)size);
+        read = std::fread(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    }
+    std::fclose(file);
+    return read;
+}
+
+std::string forwardSlashes(std::string path)
+{
+    std::replace(path.begin(), path.end(), '\\', '/');
+    return path;
+}
+
+std::string lowerName(const std::string &path)
+{
+    std::string name = path.substr(path.find_last_of('/') + 1);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return name;
+}
+
+std::string folder(const std::string &path)
+{
+    size_t slash = path.find_last_of('/');
+    return slash == std::string::npos ? std::string() : path.substr(0, slash);
+}
+
+// a cooked texture whose source among the inputs is newer than it: the .dds of one image, or the packed occlusion,
+// roughness and metallic of a folder that has all three (as texture_cooker pairs them), stale when any of them is newer
+bool staleCooked(const std::string &path, const std::vector<std::pair<std::string, std::string>> &inputs)
+{
+    if (path.size() < 4 || path.compare(path.size() - 4, 4, ".dds") != 0)
+        return false;
+    for (const auto &input : inputs)
+        if (input.second != path && cookedTexturePath(input.second) == path && !cookedTextureCurrent(input.second, path))
+            return true;
+
+    const char *const ormNames[] = {"ao.", "roughness.", "metallic."};
+    for (const auto &input : inputs)
+    {
+        if (folder(input.second) != folder(path) || lowerName(input.second).compare(0, 3, ormNames[0]) != 0)
+            continue;
+        std::vector<std::string> channels(1, input.second);
+        for (unsigned int c = 1; c < 3; ++c)
+            for (const auto &other : inputs)
+                if (folder(other.second) == folder(path)
+                    && lowerName(other.second).compare(0, std::strlen(ormNames[c]), ormNames[c]) == 0)
+                {
+                    channels.push_back(other.second);
+                    break;
+                }
+        if (channels.size() < 3 || packedTexturePath(channels) != path)
+            continue;
+        for (const std::string &channel : channels)
+            if (!cookedTextureCurrent(channel, path))
+                return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    bool lz4 = true;
+    std::string output, base;
+    std::vector<std::pair<std::string, std::string>> inputs; // name and path
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument == "--no-lz4")
+            lz4 = false;
+        else if (argument == "--base" && i + 1 < argc)
+            base = forwardSlashes(argv[++i]);
+        else if (output.empty())
+            output = argument;
+        else
+        {
+            std::string path = forwardSlashes(argument), name = path;
+            if (!base.empty())
+            {
+                if (path.compare(0, base.size() + 1, base + "/") != 0)
+                {
+                    std::cout << "ERROR::RESOURCE_PACKER::OUTSIDE_BASE " << path << std::endl;
+                    return 1;
+                }
+                name = path.substr(base.size() + 1);
+            }
+            inputs.push_back(std::make_pair(name, path));
+        }
+    }
+    if (output.empty() || inputs.empty())
+    {
+        std::cout << "usage: resource_packer [--no-lz4] output [--base directory] file..." << std::endl;
+        return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<PackEntry> entries;
+    std::map<std::string, size_t> byName; // index into entries
+    std::map<std::pair<unsigned long long, uint64_t>, size_t> byContent; // hash and size to the entry storing them
+    std::vector<unsigned char> data;
+    size_t sourceBytes = 0, compressed = 0, shared = 0;
+    for (const auto &input : inputs)
+    {
+        if (staleCooked(input.second, inputs))
+        {
+            std::cout << "Skipping stale " << input.second << std::endl;
+            continue;
+        }
+        std::vector<unsigned char> bytes;
+        if (!readFile(input.second, bytes))
+        {
+            std::cout << "ERROR::RESOURCE_PACKER::READ_FAILED " << input.second << std::endl;
+            return 1;
+        }
+        PackEntry entry;
+        entry.name = input.first;
+        entry.size = bytes.size();
+        entry.hash = fnv1a(bytes.data(), bytes.size());
+        auto named = byName.find(entry.name);
+        if (named != byName.end())
+        {
+            if (entries[named->second].hash != entry.hash || entries[named->second].size != entry.size)
+            {
+                std::cout << "ERROR::RESOURCE_PACKER::NAME_CLASH " << entry.name << std::endl;
+                return 1;
+            }
+            continue;
+        }
+        sourceBytes += bytes.size();
+
+        auto same = byContent.find(std::make_pair(entry.hash, entry.size));
+        if (same != byContent.end())
+        {
+            const PackEntry &stored = entries[same->second];
+            entry.offset = stored.offset;
+            entry.storedSize = stored.storedSize;
+            entry.flags = stored.flags;
+            shared++;
+        }
+        else
+        {
+            std::vector<unsigned char> block;
+            if (lz4)
+                block = lz4Compress(bytes.data(), bytes.size());
+            entry.flags = lz4 && block.size() * 8 <= bytes.size() * LZ4_MAX_EIGHTHS ? RESOURCE_PACK_LZ4 : 0;
+            const std::vector<unsigned char> &stored = entry.flags & RESOURCE_PACK_LZ4 ? block : bytes;
+            if (entry.flags & RESOURCE_PACK_LZ4)
+                compressed++;
+            data.resize((data.size() + RESOURCE_PACK_ALIGNMENT - 1) / RESOURCE_PACK_ALIGNMENT * RESOURCE_PACK_ALIGNMENT, 0);
+            entry.offset = data.size();
+            entry.storedSize = stored.size();
+            data.insert(data.end(), stored.begin(), stored.end());
+            byContent[std::make_pair(entry.hash, entry.size)] = entries.size();
+        }
+        byName[entry.name] = entries.size();
+        entries.push_back(entry);
+        std::cout << entry.name << ": " << entry.size << " bytes"
+                  << (entry.flags & RESOURCE_PACK_LZ4 ? ", LZ4 " + std::to_string(entry.storedSize) : "")
+                  << (same != byContent.end() ? ", shared" : "") << std::endl;
+    }
+
+    if (!saveResourcePack(output, entries, data))
+    {
+        std::cout << "ERROR::RESOURCE_PACKER::SAVE_FAILED " << output << std::endl;
+        return 1;
+    }
+    ResourcePack pack(output);
+    if (!pack.isOpen() || pack.index().size() != entries.size() || !pack.verify())
+    {
+        std::cout << "ERROR::RESOURCE_PACKER::VERIFY_FAILED " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Packed " << entries.size() << " files (" << shared << " shared, " << compressed << " LZ4) into "
+              << output << ", " << data.size() / 1024 << " KB of " << sourceBytes / 1024 << " KB in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,232 @@
+// Offline cooker of the textures polygonal and pbr load: every source image becomes a .dds next to it with the full mip
+// chain and block compression, which TextureBatch uploads as is instead of decoding the image and generating mips.
+// usage: texture_cooker [--force] image...
+// The cook_textures target passes every image under resources/textures. Images whose .dds is newer are skipped
+// unless --force. Normal maps (named *normal*) become BC5 and their mips are renormalised; data maps (specular, ao,
+// roughness, metallic, displacement, height) become BC4 when grey and BC7 otherwise, averaged as stored; everything
+// else is color, BC7 with its mips averaged in linear light. The ao, roughness and metallic maps of a folder are also
+// packed into one BC7 texture in R, G and B (see packedTexturePath), which pbr samples instead of the three.
+#include <stb_image.h>
+
+#include <helpers/block_compression.h>
+#include <helpers/channel_packing.h>
+#include <helpers/dds.h>
+#include <helpers/thread_pool.h>
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// texels whose channels differ by more than this are colored
+const int GREY_TOLERANCE = 8;
+
+bool nameContains(const std::string &name, const char *const *words, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; ++i)
+        if (name.find(words[i]) != std::string::npos)
+            return true;
+    return false;
+}
+
+// all but a thousandth of the texels grey, JPEG noise aside
+bool isGrey(const unsigned char *rgba, size_t texels)
+{
+    size_t colored = 0;
+    for (size_t i = 0; i < texels; ++i)
+    {
+        const unsigned char *t = rgba + 4 * i;
+        if (std::abs(t[0] - t[1]) > GREY_TOLERANCE || std::abs(t[1] - t[2]) > GREY_TOLERANCE)
+            colored++;
+    }
+    return colored * 1000 <= texels;
+}
+
+const char *formatName(uint32_t format)
+{
+    switch (format)
+    {
+    case DXGI_FORMAT_BC4_UNORM:
+        return "BC4";
+    case DXGI_FORMAT_BC5_UNORM:
+        return "BC5";
+    case DXGI_FORMAT_BC7_UNORM:
+        return "BC7";
+    default:
+        return "BC7 sRGB";
+    }
+}
+
+struct CookStats
+{
+    size_t sourceBytes, cookedBytes;
+    unsigned int cooked, failed;
+};
+
+// mips and blocks of an RGBA8 image saved as output; components is what the runtime would upload otherwise
+void cook(const unsigned char *rgba, int width, int height, int components, uint32_t format, MipFilter filter,
+          const std::string &output, ThreadPool &pool, CookStats &stats)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::vector<unsigned char>> mips = buildMipChain(rgba, width, height, filter);
+    DdsImage dds;
+    dds.format = format;
+    dds.width = width;
+    dds.height = height;
+    for (unsigned int level = 0; level < mips.size(); ++level)
+        dds.levels.push_back(compressImage(mips[level].data(), DdsImage::levelSize(width, level),
+                                           DdsImage::levelSize(height, level), format, pool));
+    if (!saveDds(output, dds))
+    {
+        std::cout << "ERROR::TEXTURE_COOKER::SAVE_FAILED " << output << std::endl;
+        stats.failed++;
+        return;
+    }
+
+    // what the runtime keeps of the image otherwise: its channels at 8 bits plus generated mips
+    size_t uncompressed = 0, compressed = 0;
+    for (unsigned int level = 0; level < mips.size(); ++level)
+    {
+        uncompressed += (size_t)DdsImage::levelSize(width, level) * DdsImage::levelSize(height, level) * components;
+        compressed += dds.levels[level].size();
+    }
+    stats.sourceBytes += uncompressed;
+    stats.cookedBytes += compressed;
+    stats.cooked++;
+    std::cout << output << ": " << formatName(format) << ", " << width << "x" << height << ", " << mips.size() << " levels, "
+              << compressed / 1024 << " KB instead of " << uncompressed / 1024 << " KB, "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s" << std::endl;
+}
+
+std::string lowerName(const std::string &path)
+{
+    std::string name = path.substr(path.find_last_of("/\\") + 1);
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return name;
+}
+
+std::string folder(const std::string &path)
+{
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string::npos ? std::string() : path.substr(0, slash);
+}
+
+int main(int argc, char *argv[])
+{
+    bool force = false;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string argument = argv[i];
+        if (argument == "--force")
+            force = true;
+        else
+            inputs.push_back(argument);
+    }
+    if (inputs.empty())
+    {
+        std::cout << "usage: texture_cooker [--force] image..." << std::endl;
+        return 1;
+    }
+
+    const char *const normalWords[] = {"normal"};
+    const char *const dataWords[] = {"specular", "ao.", "rough", "metal", "displacement", "height"};
+    ThreadPool pool;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    CookStats stats = {0, 0, 0, 0};
+    for (const std::string &input : inputs)
+    {
+        std::string output = cookedTexturePath(input);
+        if (!force && cookedTextureCurrent(input, output))
+            continue;
+        int width, height, components;
+        unsigned char *image = stbi_load(input.c_str(), &width, &height, &components, 4);
+        if (!image)
+        {
+            std::cout << "ERROR::TEXTURE_COOKER::LOAD_FAILED " << input << std::endl;
+            stats.failed++;
+            continue;
+        }
+        std::string name = lowerName(input);
+        uint32_t format = DXGI_FORMAT_BC7_UNORM_SRGB;
+        MipFilter filter = MIP_SRGB;
+        if (nameContains(name, normalWords, 1))
+        {
+            format = DXGI_FORMAT_BC5_UNORM;
+            filter = MIP_NORMAL;
+        }
+        else if (nameContains(name, dataWords, sizeof(dataWords) / sizeof(dataWords[0])))
+        {
+            format = isGrey(image, (size_t)width * height) ? DXGI_FORMAT_BC4_UNORM : DXGI_FORMAT_BC7_UNORM;
+            filter = MIP_LINEAR;
+        }
+        cook(image, width, height, components, format, filter, output, pool, stats);
+        stbi_image_free(image);
+    }
+
+    // occlusion, roughness and metallic of every folder that has all three
+    const char *const ormNames[] = {"ao.", "roughness.", "metallic."};
+    unsigned int packs = 0;
+    for (const std::string &input : inputs)
+    {
+        if (lowerName(input).compare(0, 3, ormNames[0]) != 0)
+            continue;
+        std::vector<std::string> channels(1, input);
+        for (unsigned int c = 1; c < 3; ++c)
+            for (const std::string &other : inputs)
+                if (folder(other) == folder(input) && lowerName(other).compare(0, std::strlen(ormNames[c]), ormNames[c]) == 0)
+                {
+                    channels.push_back(other);
+                    break;
+                }
+        if (channels.size() < 3)
+            continue;
+        packs++;
+        std::string output = packedTexturePath(channels);
+        bool current = !force;
+        for (const std::string &channel : channels)
+            current = current && cookedTextureCurrent(channel, output);
+        if (current)
+            continue;
+        unsigned char *planes[3] = {NULL, NULL, NULL};
+        int width = 0, height = 0;
+        bool loaded = true;
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            int w, h, components;
+            planes[c] = stbi_load(channels[c].c_str(), &w, &h, &components, 1);
+            if (!planes[c] || (c > 0 && (w != width || h != height)))
+            {
+                std::cout << "ERROR::TEXTURE_COOKER::PACK_FAILED " << channels[c] << std::endl;
+                loaded = false;
+            }
+            width = w;
+            height = h;
+        }
+        if (loaded)
+        {
+            std::vector<unsigned char> rgba(4 * (size_t)width * height);
+            interleaveChannels(planes[0], planes[1], planes[2], rgba.data(), (size_t)width * height);
+            // three maps of one channel each
+            cook(rgba.data(), width, height, 3, DXGI_FORMAT_BC7_UNORM, MIP_LINEAR, output, pool, stats);
+        }
+        else
+            stats.failed++;
+        for (unsigned char *plane : planes)
+            if (plane)
+                stbi_image_free(plane);
+    }
+
+    std::cout << "Cooked " << stats.cooked << " of " << inputs.size() + packs << " textures in "
+              << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << " s on " << pool.size() + 1
+              << " threads";
+    if (stats.cookedBytes > 0)
+        std::cout << ", " << stats.cookedBytes / 1024 << " KB instead of " << stats.sourceBytes / 1024 << " KB ("
+                  << (double)stats.sourceBytes / stats.cookedBytes << "x smaller)";
+    std::cout << std::endl;
+    return stats.failed > 0 ? 1 : 0;
+}